@@ -0,0 +1,533 @@
+// ash_bench.c - Microbenchmarks for ash's hot paths
+// Measures tokenize(), parse_command(), expand_variables() and
+// execute_segment() over fixed corpora, plus end-to-end commands/sec for
+// fork/exec, builtin and function call loops, the fuzzy finder's search
+// over a large history, `z` lookups in the directory index, Tab
+// completion in a large directory and git ref completion in a repository
+// with many branches. Results are printed one JSON object per line
+// so runs from two releases can be diffed or loaded into a spreadsheet.
+//
+// Usage: ash_bench [--filter substring] [--min-time seconds]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "../include/parser.h"
+#include "../include/executor.h"
+#include "../include/vars.h"
+#include "../include/expand.h"
+#include "../include/fuzzy.h"
+#include "../include/frecency.h"
+#include "../include/complete.h"
+#include "../include/git.h"
+
+#define BENCH_VARS 64
+#define BENCH_LONG_WORDS 400
+#define BENCH_RUNS 3
+#define BENCH_HISTORY 500000
+#define BENCH_DIRS 5000
+#define BENCH_FILES 20000
+#define BENCH_LOOSE_REFS 1000
+#define BENCH_PACKED_REFS 4000
+
+typedef void (*bench_fn)(void *ctx, size_t iters);
+
+// A corpus of command lines, cycled through by the benchmarks.
+typedef struct {
+    const char **lines;
+    size_t count;
+    TokenList *tokens;    // Pre-tokenized lines for the parse benchmarks
+} Corpus;
+
+static const char *filter = NULL;
+static double min_time = 0.2;
+
+// Keeps the compiler from discarding results of the measured calls.
+static volatile size_t bench_sink;
+
+static const char *short_lines[] = {
+    "ls -la",
+    "cd ..",
+    "git status",
+    "make -j8",
+    "cat README.md | less",
+    "grep -rn TODO src",
+    "echo hello > out.txt",
+    "vim src/main.c",
+    "ps aux | grep ash | wc -l",
+    "cd ~/projects && git pull",
+    "sort < in.txt >> out.txt",
+    "sleep 1 &",
+};
+
+static const char *quote_lines[] = {
+    "echo \"hello world\" 'single $quoted' \"a \\\"b\\\" c\"",
+    "git commit -m \"fix: don't crash on empty input\" --author 'A U Thor <a@b.c>'",
+    "printf '%s\\n' \"one two\" \"three four\" 'five six' \"seven\\\\eight\"",
+    "grep -E \"^(foo|bar)[0-9]+$\" 'file with spaces.txt' \"another file.log\"",
+    "echo 'a' \"b\" 'c' \"d\" 'e' \"f\" 'g' \"h\" 'i' \"j\" 'k' \"l\"",
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Calibrates an iteration count that runs for at least min_time, then
+ * reports the best of BENCH_RUNS timed runs as a JSON line.
+ */
+static void run_bench(const char *name, bench_fn fn, void *ctx) {
+    if (filter && !strstr(name, filter)) return;
+
+    size_t iters = 1;
+    double elapsed;
+    for (;;) {
+        double t0 = now_seconds();
+        fn(ctx, iters);
+        elapsed = now_seconds() - t0;
+        if (elapsed >= min_time) break;
+        double scale = elapsed > 0 ? (min_time * 1.2) / elapsed : 100.0;
+        if (scale < 2.0) scale = 2.0;
+        if (scale > 100.0) scale = 100.0;
+        iters = (size_t)(iters * scale);
+    }
+
+    double best = elapsed;
+    for (int run = 1; run < BENCH_RUNS; run++) {
+        double t0 = now_seconds();
+        fn(ctx, iters);
+        double t = now_seconds() - t0;
+        if (t < best) best = t;
+    }
+
+    double ns_per_op = best * 1e9 / (double)iters;
+    printf("{\"name\":\"%s\",\"iterations\":%zu,\"ns_per_op\":%.1f,\"ops_per_sec\":%.1f}\n",
+           name, iters, ns_per_op, 1e9 / ns_per_op);
+    fflush(stdout);
+}
+
+static void bench_tokenize(void *ctx, size_t iters) {
+    Corpus *c = ctx;
+    for (size_t i = 0; i < iters; i++) {
+        TokenList tokens = tokenize(c->lines[i % c->count]);
+        bench_sink += tokens.head != NULL;
+        free_tokens(&tokens);
+    }
+}
+
+static void bench_parse(void *ctx, size_t iters) {
+    Corpus *c = ctx;
+    for (size_t i = 0; i < iters; i++) {
+        Command *cmd = parse_command(&c->tokens[i % c->count]);
+        bench_sink += cmd != NULL;
+        free_command(cmd);
+    }
+}
+
+static void bench_expand(void *ctx, size_t iters) {
+    Corpus *c = ctx;
+    for (size_t i = 0; i < iters; i++) {
+        char *expanded = expand_variables(c->lines[i % c->count]);
+        bench_sink += expanded[0];
+        free(expanded);
+    }
+}
+
+// Runs only execute_segment() on an already parsed command.
+static void bench_segment(void *ctx, size_t iters) {
+    Corpus *c = ctx;
+    Command *cmd = parse_command(&c->tokens[0]);
+    for (size_t i = 0; i < iters; i++) {
+        bench_sink += execute_segment(cmd, c->lines[0]);
+    }
+    free_command(cmd);
+}
+
+// Full tokenize -> parse -> execute -> free cycle, as the main loop does it.
+static void bench_end_to_end(void *ctx, size_t iters) {
+    Corpus *c = ctx;
+    for (size_t i = 0; i < iters; i++) {
+        const char *line = c->lines[i % c->count];
+        TokenList tokens = tokenize(line);
+        Command *cmd = parse_command(&tokens);
+        if (cmd) {
+            bench_sink += execute_commands(cmd, line);
+            free_command(cmd);
+        }
+        free_tokens(&tokens);
+    }
+}
+
+// A history index and the queries typed into it, one keystroke each.
+typedef struct {
+    FuzzyIndex *index;
+    const char **queries;
+    size_t count;
+} FuzzyBench;
+
+static void bench_fuzzy(void *ctx, size_t iters) {
+    FuzzyBench *b = ctx;
+    FuzzyMatch matches[100];
+    for (size_t i = 0; i < iters; i++) {
+        size_t found;
+        bench_sink += fuzzy_search(b->index, b->queries[i % b->count], matches, 100, &found);
+        bench_sink += found;
+    }
+}
+
+typedef struct {
+    char **fragments;
+    int count;
+} FrecencyBench;
+
+static void bench_frecency(void *ctx, size_t iters) {
+    FrecencyBench *b = ctx;
+    for (size_t i = 0; i < iters; i++) {
+        bench_sink += frecency_best(b->fragments, b->count, NULL) != NULL;
+    }
+}
+
+// Records visits to BENCH_DIRS generated directories in an index under a
+// scratch home, which is returned.
+static char *make_dirs_index(void) {
+    static const char *const parts[] = { "src", "lib", "include", "docs", "test", "build", "tools", "web" };
+    char *home = strdup("/tmp/ash_bench.XXXXXX");
+    if (!home || !mkdtemp(home)) {
+        perror("ash_bench");
+        exit(1);
+    }
+    frecency_init(home);
+    unsigned seed = 12345;
+    char dir[128];
+    for (int i = 0; i < BENCH_DIRS; i++) {
+        seed = seed * 1103515245u + 12345u;
+        snprintf(dir, sizeof(dir), "/home/user/work/repo%u/%s/%s/module%d",
+                 (seed >> 8) % 200, parts[(seed >> 12) % 8], parts[(seed >> 16) % 8], i);
+        for (unsigned v = 0; v <= (seed >> 20) % 3; v++) frecency_add(dir);
+    }
+    return home;
+}
+
+static void count_entry(const char *name, bool is_dir, void *ctx) {
+    (void)name;
+    (void)is_dir;
+    (void)ctx;
+    bench_sink++;
+}
+
+static void bench_complete(void *ctx, size_t iters) {
+    const char *dir = ctx;
+    static const char *const prefixes[] = { "file1234", "file012", "file19999", "nomatch" };
+    for (size_t i = 0; i < iters; i++) {
+        complete_dir_entries(dir, prefixes[i % 4], 0, count_entry, NULL);
+    }
+}
+
+// Creates a scratch directory of BENCH_FILES empty files, dated an hour
+// back so completion trusts its mtime, and returns its path.
+static char *make_files_dir(void) {
+    char *dir = strdup("/tmp/ash_bench.XXXXXX");
+    if (!dir || !mkdtemp(dir)) {
+        perror("ash_bench");
+        exit(1);
+    }
+    char path[64];
+    for (int i = 0; i < BENCH_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/file%05d.dat", dir, i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0) close(fd);
+    }
+    struct timespec times[2] = { { time(NULL) - 3600, 0 }, { time(NULL) - 3600, 0 } };
+    utimensat(AT_FDCWD, dir, times, 0);
+    return dir;
+}
+
+static void remove_files_dir(char *dir) {
+    char path[64];
+    for (int i = 0; i < BENCH_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/file%05d.dat", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+    free(dir);
+}
+
+static void count_ref(const char *name, void *ctx) {
+    (void)name;
+    (void)ctx;
+    bench_sink++;
+}
+
+static void bench_git_refs(void *ctx, size_t iters) {
+    const char *repo = ctx;
+    static const char *const prefixes[] = { "topic/b01", "origin/feature12", "v3", "nomatch" };
+    for (size_t i = 0; i < iters; i++) {
+        git_refs(repo, prefixes[i % 4], count_ref, NULL);
+    }
+}
+
+// The directories of the scratch repository, parents first
+static const char *const bench_ref_dirs[] = {
+    ".git", ".git/refs", ".git/refs/heads", ".git/refs/heads/topic", ".git/refs/remotes",
+    ".git/refs/remotes/origin", ".git/refs/tags"
+};
+
+// Creates a scratch repository with BENCH_LOOSE_REFS loose branches and
+// BENCH_PACKED_REFS packed remote branches and tags, dated an hour back so
+// the ref cache trusts its mtimes, and returns its path.
+static char *make_refs_repo(void) {
+    char *repo = strdup("/tmp/ash_bench.XXXXXX");
+    if (!repo || !mkdtemp(repo)) {
+        perror("ash_bench");
+        exit(1);
+    }
+    char path[128];
+    for (size_t i = 0; i < sizeof(bench_ref_dirs) / sizeof(*bench_ref_dirs); i++) {
+        snprintf(path, sizeof(path), "%s/%s", repo, bench_ref_dirs[i]);
+        mkdir(path, 0755);
+    }
+    for (int i = 0; i < BENCH_LOOSE_REFS; i++) {
+        snprintf(path, sizeof(path), "%s/.git/refs/heads/topic/b%04d", repo, i);
+        FILE *f = fopen(path, "w");
+        if (f) {
+            fprintf(f, "%040d\n", i);
+            fclose(f);
+        }
+    }
+    snprintf(path, sizeof(path), "%s/.git/packed-refs", repo);
+    FILE *f = fopen(path, "w");
+    if (f) {
+        fprintf(f, "# pack-refs with: peeled fully-peeled sorted \n");
+        for (int i = 0; i < BENCH_PACKED_REFS; i++) {
+            if (i % 2) fprintf(f, "%040d refs/remotes/origin/feature%04d\n", i, i);
+            else fprintf(f, "%040d refs/tags/v%d.%d\n^%040d\n", i, i / 100, i % 100, i);
+        }
+        fclose(f);
+    }
+    struct timespec times[2] = { { time(NULL) - 3600, 0 }, { time(NULL) - 3600, 0 } };
+    utimensat(AT_FDCWD, path, times, 0);
+    for (size_t i = 0; i < sizeof(bench_ref_dirs) / sizeof(*bench_ref_dirs); i++) {
+        snprintf(path, sizeof(path), "%s/%s", repo, bench_ref_dirs[i]);
+        utimensat(AT_FDCWD, path, times, 0);
+    }
+    return repo;
+}
+
+static void remove_refs_repo(char *repo) {
+    char path[128];
+    for (int i = 0; i < BENCH_LOOSE_REFS; i++) {
+        snprintf(path, sizeof(path), "%s/.git/refs/heads/topic/b%04d", repo, i);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/.git/packed-refs", repo);
+    unlink(path);
+    for (size_t i = sizeof(bench_ref_dirs) / sizeof(*bench_ref_dirs); i-- > 0;) {
+        snprintf(path, sizeof(path), "%s/%s", repo, bench_ref_dirs[i]);
+        rmdir(path);
+    }
+    rmdir(repo);
+    free(repo);
+}
+
+// Fills an index with BENCH_HISTORY generated command lines.
+static FuzzyIndex *make_history(void) {
+    static const char *const cmds[] = { "git", "make", "ls", "cd", "grep", "ssh", "docker", "vim", "cargo", "kubectl" };
+    static const char *const args[] = { "status", "commit -m", "--all", "src/", "build", "logs -f", "checkout", "test", "deploy", "README.md" };
+    FuzzyIndex *index = fuzzy_create(false);
+    unsigned seed = 12345;
+    char line[128];
+    for (int i = 0; i < BENCH_HISTORY; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int len = snprintf(line, sizeof(line), "%s %s %s/file%u.txt --opt=%u",
+                           cmds[(seed >> 8) % 10], args[(seed >> 12) % 10], args[(seed >> 16) % 10],
+                           (seed >> 4) % 1000, (seed >> 20) % 97);
+        fuzzy_add(index, line, (size_t)len);
+    }
+    return index;
+}
+
+static void corpus_tokenize(Corpus *c) {
+    c->tokens = calloc(c->count, sizeof(TokenList));
+    if (!c->tokens) {
+        perror("ash_bench");
+        exit(1);
+    }
+    for (size_t i = 0; i < c->count; i++) {
+        c->tokens[i] = tokenize(c->lines[i]);
+    }
+}
+
+static void corpus_free(Corpus *c) {
+    for (size_t i = 0; c->tokens && i < c->count; i++) {
+        free_tokens(&c->tokens[i]);
+    }
+    free(c->tokens);
+    c->tokens = NULL;
+}
+
+// Builds one long pipeline of generated words, e.g. for huge argument lists.
+static char *make_long_line(void) {
+    size_t cap = BENCH_LONG_WORDS * 24;
+    char *line = malloc(cap);
+    if (!line) {
+        perror("ash_bench");
+        exit(1);
+    }
+    size_t len = 0;
+    for (int i = 0; i < BENCH_LONG_WORDS; i++) {
+        if (i > 0 && i % 50 == 0) {
+            len += snprintf(line + len, cap - len, "| filter%d ", i);
+        } else {
+            len += snprintf(line + len, cap - len, "arg_%d.txt ", i);
+        }
+    }
+    return line;
+}
+
+// Defines BENCH_V0..BENCH_V63 and a line that references all of them.
+static char *make_vars_line(void) {
+    size_t cap = BENCH_VARS * 16;
+    char *line = malloc(cap);
+    if (!line) {
+        perror("ash_bench");
+        exit(1);
+    }
+    size_t len = snprintf(line, cap, "echo");
+    for (int i = 0; i < BENCH_VARS; i++) {
+        char name[32], value[32];
+        snprintf(name, sizeof(name), "BENCH_V%d", i);
+        snprintf(value, sizeof(value), "value_%d", i);
+        set_variable(name, value);
+        setenv(name, value, 1);
+        len += snprintf(line + len, cap - len, " $BENCH_V%d", i);
+    }
+    return line;
+}
+
+// Defines the function called by the segment/function benchmark.
+static void define_bench_function(void) {
+    const char *line = "bench_fn() { cd .; cd $1; }";
+    TokenList tokens = tokenize(line);
+    Command *cmd = parse_command(&tokens);
+    if (cmd) {
+        execute_commands(cmd, line);
+        free_command(cmd);
+    }
+    free_tokens(&tokens);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_time = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--filter substring] [--min-time seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+    shell_name = "ash";
+
+    char *long_line = make_long_line();
+    char *vars_line = make_vars_line();
+    const char *long_lines[] = { long_line };
+    const char *vars_lines[] = { vars_line };
+    const char *forkexec_lines[] = { "true" };
+    const char *pipeline_lines[] = { "true | true" };
+    const char *builtin_lines[] = { "cd ." };
+    const char *arith_lines[] = { "i=$((i + 1)) $(( (i * 31 + 7) % 1024 << 2 ))" };
+    const char *function_lines[] = { "bench_fn ." };
+
+    Corpus shorts = { short_lines, sizeof(short_lines) / sizeof(*short_lines), NULL };
+    Corpus longs = { long_lines, 1, NULL };
+    Corpus quotes = { quote_lines, sizeof(quote_lines) / sizeof(*quote_lines), NULL };
+    Corpus vars = { vars_lines, 1, NULL };
+    Corpus forkexec = { forkexec_lines, 1, NULL };
+    Corpus pipeline = { pipeline_lines, 1, NULL };
+    Corpus builtin = { builtin_lines, 1, NULL };
+    Corpus arith = { arith_lines, 1, NULL };
+    Corpus function = { function_lines, 1, NULL };
+
+    Corpus *all[] = { &shorts, &longs, &quotes, &vars, &forkexec, &pipeline, &builtin, &arith, &function };
+    for (size_t i = 0; i < sizeof(all) / sizeof(*all); i++) corpus_tokenize(all[i]);
+
+    run_bench("tokenize/short", bench_tokenize, &shorts);
+    run_bench("tokenize/long", bench_tokenize, &longs);
+    run_bench("tokenize/quotes", bench_tokenize, &quotes);
+    run_bench("tokenize/vars", bench_tokenize, &vars);
+
+    run_bench("parse/short", bench_parse, &shorts);
+    run_bench("parse/long", bench_parse, &longs);
+    run_bench("parse/quotes", bench_parse, &quotes);
+    run_bench("parse/vars", bench_parse, &vars);
+
+    run_bench("expand/short", bench_expand, &shorts);
+    run_bench("expand/quotes", bench_expand, &quotes);
+    run_bench("expand/vars", bench_expand, &vars);
+    run_bench("expand/arith", bench_expand, &arith);
+
+    run_bench("segment/forkexec", bench_segment, &forkexec);
+    run_bench("segment/builtin", bench_segment, &builtin);
+    define_bench_function();
+    run_bench("segment/function", bench_segment, &function);
+
+    run_bench("e2e/forkexec", bench_end_to_end, &forkexec);
+    run_bench("e2e/pipeline", bench_end_to_end, &pipeline);
+    run_bench("e2e/builtin", bench_end_to_end, &builtin);
+
+    if (!filter || strstr("fuzzy/", filter) || strstr(filter, "fuzzy")) {
+        // Typing a query narrows the last search; unrelated queries rescan
+        const char *typed[] = { "d", "do", "doc", "dock", "docke", "docker", "docker ", "docker l", "docker lo", "docker log" };
+        const char *fresh[] = { "kblg", "mkts", "gtcm", "vmrd" };
+        FuzzyBench keystroke = { make_history(), typed, sizeof(typed) / sizeof(*typed) };
+        FuzzyBench rescan = { keystroke.index, fresh, sizeof(fresh) / sizeof(*fresh) };
+        run_bench("fuzzy/keystroke500k", bench_fuzzy, &keystroke);
+        run_bench("fuzzy/rescan500k", bench_fuzzy, &rescan);
+        fuzzy_free(keystroke.index);
+    }
+
+    if (!filter || strstr("frecency/", filter) || strstr(filter, "frecency")) {
+        char *home = make_dirs_index();
+        char *one[] = { "module42" };
+        char *two[] = { "repo17", "module" };
+        FrecencyBench single = { one, 1 };
+        FrecencyBench pair = { two, 2 };
+        run_bench("frecency/z5k", bench_frecency, &single);
+        run_bench("frecency/z5k_two", bench_frecency, &pair);
+        frecency_free();
+        char path[64];
+        snprintf(path, sizeof(path), "%s/.ashdirs", home);
+        unlink(path);
+        rmdir(home);
+        free(home);
+    }
+
+    if (!filter || strstr("complete/", filter) || strstr(filter, "complete")) {
+        char *dir = make_files_dir();
+        run_bench("complete/cached20k", bench_complete, dir);
+        complete_free();
+        remove_files_dir(dir);
+    }
+
+    if (!filter || strstr("gitrefs/", filter) || strstr(filter, "gitrefs")) {
+        char *repo = make_refs_repo();
+        run_bench("gitrefs/cached5k", bench_git_refs, repo);
+        git_refs_free();
+        remove_refs_repo(repo);
+    }
+
+    for (size_t i = 0; i < sizeof(all) / sizeof(*all); i++) corpus_free(all[i]);
+    free(long_line);
+    free(vars_line);
+    return 0;
+}
@@ -0,0 +1,261 @@
+// ash_compare.c - Whole-script throughput comparison for ash
+// Generates a corpus of representative scripts and runs each one under ash's
+// script mode and under /bin/sh and bash when they are installed. For every
+// run it reports wall time, user/sys CPU and max RSS (from wait4, so they
+// include the shell's children) and the number of processes forked.
+//
+// The fork count is the delta of the system-wide "processes" counter in
+// /proc/stat, so run it on an otherwise quiet machine.
+//
+// Usage: ash_compare [--ash path] [--runs N] [--scale N] [--json]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#ifndef ASH_PATH
+#define ASH_PATH "./ash"
+#endif
+
+// One generated script of the corpus.
+typedef struct {
+    const char *name;
+    void (*generate)(FILE *f, int scale);
+    char path[4096];
+} Script;
+
+// Metrics of one script run under one shell.
+typedef struct {
+    double wall;
+    double user;
+    double sys;
+    long max_rss_kb;
+    long forks;
+    int status;
+} RunResult;
+
+// Assignments and expansions of many distinct variables.
+static void gen_variables(FILE *f, int scale) {
+    for (int i = 0; i < 200 * scale; i++) {
+        fprintf(f, "name_%d_v=value%d\n", i, i);
+    }
+    for (int i = 0; i < 50 * scale; i++) {
+        fprintf(f, "echo $name_%d_v $name_%d_v $name_%d_v\n", i, i + 1, i + 2);
+    }
+}
+
+// Short multi-stage pipelines.
+static void gen_pipelines(FILE *f, int scale) {
+    for (int i = 0; i < 50 * scale; i++) {
+        fprintf(f, "echo line %d | cat | wc -c\n", i);
+    }
+}
+
+// Many tiny commands, dominated by process creation.
+static void gen_small_commands(FILE *f, int scale) {
+    for (int i = 0; i < 200 * scale; i++) {
+        fprintf(f, "%s\n", (i % 2) ? "true" : "cd .");
+    }
+}
+
+// Commands with large argument lists.
+static void gen_large_args(FILE *f, int scale) {
+    for (int i = 0; i < 50 * scale; i++) {
+        fputs("echo", f);
+        for (int a = 0; a < 60; a++) fprintf(f, " argument_%d_%d", i, a);
+        fputc('\n', f);
+    }
+}
+
+// Background jobs under ash's job limit, which other shells do not have.
+// The last line queues a job, which still has to run before the script
+// exits: compare its fork count with the other shells'.
+static void gen_background_jobs(FILE *f, int scale) {
+    fputs("joblimit 2 2>/dev/null\n", f);
+    for (int i = 0; i < 20 * scale; i++) {
+        fputs("true & true & true &\n", f);
+        if (i % 5 == 4) fputs("wait\n", f);
+    }
+    fputs("wait\ntrue & true & true &\n", f);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reads the system-wide number of forks since boot from /proc/stat.
+static long read_fork_counter(void) {
+    FILE *f = fopen("/proc/stat", "re");
+    if (!f) return -1;
+    char line[256];
+    long forks = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "processes ", 10) == 0) {
+            forks = atol(line + 10);
+            break;
+        }
+    }
+    fclose(f);
+    return forks;
+}
+
+/**
+ * @brief Runs one script under one shell with stdout/stderr sent to /dev/null.
+ * @return True if the shell could be started.
+ */
+static bool run_script(const char *shell, const char *script, RunResult *res) {
+    long forks_before = read_fork_counter();
+    double t0 = now_seconds();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("ash_compare: fork");
+        return false;
+    }
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_RDWR);
+        if (devnull >= 0) {
+            dup2(devnull, STDIN_FILENO);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+        execl(shell, shell, script, (char *)NULL);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) {
+        perror("ash_compare: wait4");
+        return false;
+    }
+    res->wall = now_seconds() - t0;
+    long forks_after = read_fork_counter();
+
+    res->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    res->sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    res->max_rss_kb = ru.ru_maxrss;
+    // The harness's own fork is included in the delta; don't count it.
+    res->forks = (forks_before >= 0 && forks_after >= 0) ? forks_after - forks_before - 1 : -1;
+    res->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return res->status != 127;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--ash path] [--runs N] [--scale N] [--json]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *ash = ASH_PATH;
+    int runs = 3;
+    int scale = 1;
+    bool json = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ash") == 0 && i + 1 < argc) {
+            ash = argv[++i];
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (runs < 1) runs = 1;
+    if (scale < 1) scale = 1;
+
+    const char *candidates[] = { ash, "/bin/sh", "/bin/bash", "/usr/bin/bash" };
+    const char *shells[4];
+    int nshells = 0;
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(*candidates); i++) {
+        if (access(candidates[i], X_OK) != 0) {
+            if (i == 0) fprintf(stderr, "ash_compare: %s is not executable\n", ash);
+            continue;
+        }
+        // /bin/bash and /usr/bin/bash are the same shell; keep the first.
+        if (i == 3 && nshells > 0 && strstr(shells[nshells - 1], "bash")) continue;
+        shells[nshells++] = candidates[i];
+    }
+
+    const char *tmpdir = getenv("TMPDIR");
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s/ash_compare.XXXXXX", tmpdir ? tmpdir : "/tmp");
+    char *workdir = mkdtemp(dir);
+    if (!workdir) {
+        perror("ash_compare: mkdtemp");
+        return 1;
+    }
+
+    Script scripts[] = {
+        { "variables", gen_variables, "" },
+        { "pipelines", gen_pipelines, "" },
+        { "small_commands", gen_small_commands, "" },
+        { "large_args", gen_large_args, "" },
+        { "background_jobs", gen_background_jobs, "" },
+    };
+    size_t nscripts = sizeof(scripts) / sizeof(*scripts);
+    for (size_t i = 0; i < nscripts; i++) {
+        snprintf(scripts[i].path, sizeof(scripts[i].path), "%s/%s.sh", workdir, scripts[i].name);
+        FILE *f = fopen(scripts[i].path, "we");
+        if (!f) {
+            perror("ash_compare");
+            return 1;
+        }
+        scripts[i].generate(f, scale);
+        fclose(f);
+    }
+
+    if (!json) {
+        printf("%-16s %-16s %10s %10s %10s %10s %8s\n",
+               "script", "shell", "wall_s", "user_s", "sys_s", "maxrss_kb", "forks");
+    }
+    for (size_t i = 0; i < nscripts; i++) {
+        for (int s = 0; s < nshells; s++) {
+            // Keep the fastest run; the slower ones mostly measure noise.
+            RunResult best = {0};
+            bool ok = false;
+            for (int r = 0; r < runs; r++) {
+                RunResult res;
+                if (!run_script(shells[s], scripts[i].path, &res)) break;
+                if (!ok || res.wall < best.wall) best = res;
+                ok = true;
+            }
+            if (!ok) {
+                fprintf(stderr, "ash_compare: could not run %s\n", shells[s]);
+                continue;
+            }
+            if (json) {
+                printf("{\"script\":\"%s\",\"shell\":\"%s\",\"wall_s\":%.4f,\"user_s\":%.4f,"
+                       "\"sys_s\":%.4f,\"maxrss_kb\":%ld,\"forks\":%ld,\"status\":%d}\n",
+                       scripts[i].name, shells[s], best.wall, best.user, best.sys,
+                       best.max_rss_kb, best.forks, best.status);
+            } else {
+                const char *label = strrchr(shells[s], '/');
+                printf("%-16s %-16s %10.4f %10.4f %10.4f %10ld %8ld\n",
+                       scripts[i].name, label ? label + 1 : shells[s], best.wall, best.user, best.sys,
+                       best.max_rss_kb, best.forks);
+            }
+            fflush(stdout);
+        }
+    }
+
+    for (size_t i = 0; i < nscripts; i++) unlink(scripts[i].path);
+    rmdir(workdir);
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stdbool.h>
+
+// Evaluates a C-style integer expression such as "i += 2 * (j << 1)".
+// Returns 0 and stores the value in *result, or -1 after printing an error.
+int arith_eval(const char *text, long long *result);
+
+// Runs `let expr...` and `((expr))`: status 0 if the last value was non-zero.
+int builtin_let(char **argv);
+bool is_arith_command(const char *word);
+int run_arith_command(const char *word);
+
+#endif // ARITH_H
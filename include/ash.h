@@ -40,7 +40,6 @@ void run_ashrc(const char *homedir);
 void print_prompt(const char *distro_icon, const char *display_dir, const char *git_branch, char *prompt);
 bool ash_get_config_bool(const char *homedir, const char *key, bool default_value);
 void ash_create_config(const char *homedir);
-void syntax_highlight(const char *input);
 int handle_cd(const char *path);
 
 #endif // ASH_H
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stdbool.h>
+
+// Tab completion: command names where a command starts, directories after
+// cd, branch and tag names after git subcommands that take a commit, and
+// files elsewhere, including after redirection operators.
+// Directory listings are cached and reused while the directory's mtime is
+// unchanged, so pressing Tab again in a huge directory does not reread it.
+
+// Installs the completion function.
+void complete_init(void);
+void complete_free(void);
+
+enum {
+    COMPLETE_DIRS_ONLY = 1,
+    COMPLETE_HIDDEN = 2 // Also names starting with '.'
+};
+
+typedef void (*CompleteEntryFn)(const char *name, bool is_dir, void *ctx);
+
+// Calls fn, in byte order, for each entry of directory dir ("" for the
+// current one) whose name starts with prefix.
+void complete_dir_entries(const char *dir, const char *prefix, int flags, CompleteEntryFn fn, void *ctx);
+
+#endif // COMPLETE_H
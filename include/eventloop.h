@@ -0,0 +1,23 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdbool.h>
+
+// Reads a line at the interactive prompt like readline(), but from an epoll
+// loop: finished jobs are announced above the line being edited, terminal
+// resizes and timers are handled, and captured job output is drained while
+// the user types. Returns NULL at end of input.
+char *event_readline(const char *prompt);
+
+// Calls fn every interval_ms milliseconds (once, if repeat is false) while
+// the shell waits at the prompt. Returns an id for event_timer_remove(), or
+// -1 on error.
+int event_timer_add(int interval_ms, bool repeat, void (*fn)(void *ctx), void *ctx);
+void event_timer_remove(int id);
+
+// Runs fn with the line being edited taken off the screen, then draws the
+// prompt and line again below whatever fn printed. For output that does not
+// come from a command, such as notices and asynchronous updates.
+void event_print_above(void (*fn)(void *ctx), void *ctx);
+
+#endif // EVENTLOOP_H
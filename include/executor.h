@@ -3,7 +3,18 @@
 
 #include "../include/parser.h"
 
-// Function prototype for command execution
-int execute_commands(Command *cmd_list);
+// Function prototypes for command execution
+int execute_commands(Command *head, const char *original_input);
+int execute_segment(Command *head, const char *original_input);
+int start_queued_job(Command *pipeline, int job_id);
+void execute_commands_and_exit(Command *head, const char *original_input);
+int execute_builtin(Command *cmd, int input_fd, int output_fd);
+void exec_child(Command *cmd);
+bool is_builtin(const char *cmd);
+extern const char *const builtin_names[];
+
+// Built-ins implemented alongside the executor
+void builtin_help(void);
+void builtin_status(void);
 
 #endif // EXECUTOR_H
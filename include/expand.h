@@ -0,0 +1,14 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "../include/parser.h"
+#include "../include/pathglob.h"
+
+char *expand_variables(const char *text);
+char *expand_string(const char *word);
+int expand_word(const char *word, ArgVec *fields, DirCache **dircache);
+int expand_command(Command *cmd);
+bool expand_failed(void);
+char *command_substitute(const char *text);
+
+#endif // EXPAND_H
@@ -0,0 +1,24 @@
+#ifndef FINDER_H
+#define FINDER_H
+
+#include <stdbool.h>
+
+// Fuzzy finder at the prompt: Ctrl-R searches the history and Ctrl-T the
+// completions of the word at the cursor, with the ranked matches listed
+// under a query line that updates as it is typed.
+
+// Indexes readline's history and binds the keys, if stdin and stdout are
+// terminals.
+void finder_init(void);
+void finder_free(void);
+
+// Indexes a line just passed to add_history().
+void finder_add(const char *line);
+
+// While the finder is open, the event loop hands it the keys instead of
+// readline and has it redraw after readline's own redisplay and on resize.
+bool finder_active(void);
+void finder_input(void);
+void finder_draw(void);
+
+#endif // FINDER_H
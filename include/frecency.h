@@ -0,0 +1,25 @@
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+// Directory frecency: every directory entered with cd is ranked by how
+// often and how recently it was visited, and `z` jumps to the best one
+// matching a few fragments of its path.
+
+// Maps ~/.ashdirs, creating it if needed. Until this is called, visits
+// are not recorded.
+void frecency_init(const char *homedir);
+void frecency_free(void);
+
+// Records a visit to dir, an absolute path, or to the current directory
+// if dir is NULL.
+void frecency_add(const char *dir);
+
+// Returns the best-ranked directory, other than exclude, whose path has
+// the fragments in order with the last one in its final component, or
+// NULL. Fragments match regardless of case unless one has a capital.
+const char *frecency_best(char **fragments, int count, const char *exclude);
+
+// Runs `z [-l] [-x] [fragments...]`.
+int builtin_z(char **argv);
+
+#endif // FRECENCY_H
@@ -0,0 +1,32 @@
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+#include <stdbool.h>
+
+#include "../include/parser.h"
+
+// Function table: definitions are kept as parsed, so calls never re-tokenize
+// the body.
+void define_function(FuncDef *def);
+FuncDef *find_function(const char *name);
+int call_function(FuncDef *def, char **argv);
+void free_functions(void);
+
+// Positional parameters ($1.., $#, $@) of the innermost function call or
+// sourced file with arguments, else of the script.
+void set_positional(int count, char **args);
+void push_positional(int count, char **args);
+void pop_positional(void);
+int positional_count(void);
+const char *positional(int n);
+
+// `return` ends the innermost function or sourced file; the code running it
+// polls function_returning() and stops early.
+void scope_enter(void);
+int scope_leave(int status);
+bool function_returning(void);
+
+int builtin_local(char **argv);
+int builtin_return(char **argv);
+
+#endif // FUNCTIONS_H
@@ -0,0 +1,42 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Fuzzy matching over a set of strings, as used by the finder. A query
+// matches a string if each of its blank-separated terms appears in it as a
+// subsequence, ignoring ASCII case; matches are ranked fzf-style, favoring
+// characters at word starts and runs of consecutive characters.
+typedef struct FuzzyIndex FuzzyIndex;
+
+typedef struct {
+    size_t index; // As numbered by fuzzy_add()
+    int score;
+} FuzzyMatch;
+
+// With dedup, adding a string that is already in the index replaces the
+// older copy, so it ranks as the most recent.
+FuzzyIndex *fuzzy_create(bool dedup);
+void fuzzy_free(FuzzyIndex *index);
+
+// Adds a string and returns its index. Later strings are more recent and
+// win ties.
+size_t fuzzy_add(FuzzyIndex *index, const char *s, size_t len);
+const char *fuzzy_text(const FuzzyIndex *index, size_t i, size_t *len);
+
+// Returns how many strings there are, not counting replaced copies.
+size_t fuzzy_size(const FuzzyIndex *index);
+
+// Ranks the strings matching query and fills out with up to max of the
+// best, best first. Returns how many it filled and sets *found to how many
+// strings match in all. With an empty query every string matches, most
+// recent first. A query that extends the previous one only rechecks the
+// strings that matched it.
+size_t fuzzy_search(FuzzyIndex *index, const char *query, FuzzyMatch *out, size_t max, size_t *found);
+
+// Marks in `hit` (one flag per byte of string i) the characters that match
+// query, for display.
+void fuzzy_positions(const FuzzyIndex *index, size_t i, const char *query, bool *hit);
+
+#endif // FUZZY_H
@@ -6,5 +6,12 @@
 
 bool is_git_repo(const char *path);
 void get_git_branch(const char *path, char *buffer, size_t buffer_size);
+bool git_find_dir(const char *path, char *gitdir, size_t size);
+
+// Branch, remote branch and tag names for completion, read from the
+// repository's files and cached until they change.
+typedef void (*GitRefFn)(const char *name, void *ctx);
+void git_refs(const char *path, const char *prefix, GitRefFn fn, void *ctx);
+void git_refs_free(void);
 
 #endif // GIT_H
@@ -0,0 +1,27 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <stdbool.h>
+
+// As-you-type syntax highlighting and history suggestions. The line being
+// edited is drawn by highlight_redisplay(), installed as readline's
+// redisplay function by the event loop, instead of by readline itself.
+extern bool highlight_enabled;
+
+// Builds the set of known command names; call again after the command list
+// changes. Colors and suggestions are only shown if stdin and stdout are
+// terminals; highlight_enabled is set if either is.
+void highlight_init(bool enable_colors, bool enable_suggestions);
+void highlight_free(void);
+
+void highlight_redisplay(void);
+
+// Erases the prompt and line drawn so far, leaving the cursor where the
+// prompt started.
+void highlight_clear(void);
+
+// Moves below the line once it is accepted, where readline would print its
+// newline.
+void highlight_finish(void);
+
+#endif // HIGHLIGHT_H
@@ -0,0 +1,22 @@
+#ifndef JOBOUTPUT_H
+#define JOBOUTPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// A bounded buffer that keeps the most recent output of a background job.
+// Memory is allocated as output arrives, up to the buffer's cap; past that
+// the oldest bytes are overwritten.
+typedef struct OutputRing OutputRing;
+
+// Per-job cap from ASH_JOB_OUTPUT ("64K", "1M", a byte count), or 0 if
+// capturing is off.
+size_t job_output_cap(void);
+
+OutputRing *ring_create(size_t cap);
+void ring_append(OutputRing *ring, const char *data, size_t len);
+void ring_print(const OutputRing *ring, FILE *out);
+size_t ring_length(const OutputRing *ring);
+void ring_free(OutputRing *ring);
+
+#endif // JOBOUTPUT_H
@@ -0,0 +1,82 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "../include/joboutput.h"
+
+#define MAX_JOBS 1024
+
+// Job states
+enum {
+    JOB_RUNNING = 0,
+    JOB_STOPPED = 1,
+    JOB_DONE = 2,
+    JOB_QUEUED = 3  // Waiting for a slot, not started yet
+};
+
+struct Command;
+
+typedef struct {
+    pid_t pid;          // The last process of the pipeline, 0 while queued
+    pid_t pgid;         // Process group of the job, 0 without job control
+    pid_t *pids;        // Every process of the pipeline
+    int npids;
+    char *command_line;
+    int job_id;
+    int status;         // One of JOB_RUNNING, JOB_STOPPED, JOB_DONE, JOB_QUEUED
+    struct Command *queued; // A queued job's pipeline as parsed, else NULL
+    int alive;          // Processes not reaped yet
+    int exit_status;    // Status of the last process once the job is done
+    unsigned long done_seq; // Order in which done jobs finished
+    bool notified;      // A stop was already reported
+    int out_fd;         // Read end of the captured output pipe, or -1
+    OutputRing *out;    // Captured output, NULL if not captured
+} Job;
+
+extern Job jobs[MAX_JOBS];
+extern int job_count;
+extern int next_job_id;
+extern pid_t last_background_pid; // $!
+extern bool job_control;          // Jobs get process groups and the terminal
+
+int add_job(const pid_t *pids, int npids, pid_t pgid, const char *command_line);
+void add_stopped_job(const pid_t *pids, int npids, pid_t pgid, const char *command_line);
+void remove_job(int job_id);
+void reap_jobs(bool report);
+void update_jobs_status(void);
+int active_jobs(void);
+bool jobs_changed(void);
+void handle_sigchld(int sig);
+int builtin_jobs(char **argv);
+int builtin_fg(char **argv);
+int builtin_bg(char **argv);
+int builtin_wait(char **argv);
+int builtin_kill(char **argv);
+
+// Captured output of background jobs (ASH_JOB_OUTPUT)
+void job_attach_output(int job_id, int fd, size_t cap);
+bool job_output_active(void);
+int job_events_poll(int fd, const sigset_t *mask);
+int job_output_fds(int *fds, int max);
+void job_output_ready(int fd);
+extern void (*job_output_closing)(int fd); // Called before a pipe is closed
+
+// Process groups and the terminal
+void job_control_init(void);
+void job_signals(bool ignore);
+void job_setpgid(pid_t pid, pid_t pgid, bool foreground, bool child);
+void job_terminal(pid_t pgid);
+
+// Concurrency limit and CPU placement for background jobs
+bool job_must_queue(void);
+int queue_job(struct Command *pipeline, const char *command_line);
+void job_started(int job_id, const pid_t *pids, int npids, pid_t pgid);
+void start_queued_jobs(void);
+void drain_job_queue(void);
+void job_table_clear(void);
+int builtin_joblimit(char **argv);
+
+#endif // JOBS_H
@@ -0,0 +1,8 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Runs `parallel [-j N] [-k] command [args...] [::: arg...]` and returns the
+// aggregated exit status (number of failed jobs, capped at 101).
+int builtin_parallel(char **argv);
+
+#endif // PARALLEL_H
@@ -6,7 +6,7 @@
 #include <string.h>
 #include <stdbool.h>
 
-#define MAX_ARGS 64
+#define ARGV_INLINE 6
 
 // Enumeration for command separators
 typedef enum {
@@ -20,7 +20,9 @@ typedef enum {
 
 // Structure for a single token in a linked list
 typedef struct Token {
-    char *value;
+    char *value;          // The word with quotes and escapes removed
+    char *raw;            // The word as typed, expanded when the command runs
+    bool quoted;          // True if any part of the token was quoted
     struct Token *next;
 } Token;
 
@@ -30,13 +32,59 @@ typedef struct {
     Token *tail;
 } TokenList;
 
+// Kinds of redirection operations, applied in order in the child.
+typedef enum {
+    REDIR_OPEN,     // n<file, n>file, n>>file, n<>file
+    REDIR_DUP,      // n>&m, n<&m
+    REDIR_CLOSE,    // n>&-, n<&-
+    REDIR_HEREDOC,  // n<<EOF, n<<-EOF
+    REDIR_HERESTRING // n<<<word
+} RedirKind;
+
+// Structure for a single redirection of one file descriptor.
+typedef struct Redir {
+    RedirKind kind;
+    int fd;               // The file descriptor being redirected
+    int flags;            // open(2) flags for REDIR_OPEN
+    int src_fd;           // Source descriptor for REDIR_DUP
+    char *word;           // Target word or here-document text as written
+    char *path;           // Expanded file name for REDIR_OPEN
+    char *body;           // Expanded here-document or here-string body
+    size_t body_len;      // Length of the body in bytes
+    char *delim;          // Delimiter of a '<<' body not read yet
+    bool strip_tabs;      // True for '<<-': strip leading tabs
+    bool expand;          // True if the delimiter was unquoted
+    struct Redir *next;
+} Redir;
+
+// A growable, NULL-terminated argument vector. Short lists live in the
+// inline array; longer ones move to the heap. v may point into the struct
+// itself, so an ArgVec must never be copied by value.
+typedef struct {
+    char **v;             // The arguments, NULL-terminated
+    int count;
+    int cap;              // Slots in v, including the terminating NULL
+    char *small[ARGV_INLINE];
+} ArgVec;
+
+struct Command;
+
+// A function definition, `name() { body; }`. The parse tree and the function
+// table share it, so it is reference counted.
+typedef struct FuncDef {
+    char *name;
+    struct Command *body; // The parsed body, or NULL if it is empty
+    int refs;
+} FuncDef;
+
 // Structure for a single command, including arguments and redirection.
 typedef struct Command {
-    char *argv[MAX_ARGS]; // Array of arguments for execvp
-    char *redir_in;       // Input redirection file
-    char *redir_out;      // Output redirection file
-    bool redir_append;    // True if output redirection is '>>'
+    ArgVec words;         // Words as parsed, before expansion
+    ArgVec argv;          // Expanded arguments for execvp, see expand_command()
+    Redir *redirs;        // Redirections, in command line order
     CmdType type;         // The separator to the next command
+    bool timed;           // Prefixed with `time`: report resource usage
+    FuncDef *func;        // Set if the command defines a function
     struct Command *next; // Pointer to the next command in a pipeline
 } Command;
 
@@ -44,8 +92,17 @@ typedef struct Command {
 void add_token(TokenList *list, const char *value);
 TokenList tokenize(const char *input);
 void free_tokens(TokenList *tokens);
-char* expand_variables(const char* token_value);
+const char *skip_substitution(const char *p);
 Command *parse_command(TokenList *tokens);
+int open_function_bodies(const TokenList *tokens);
+Command *new_command(void);
+void argv_init(ArgVec *args);
+void argv_push(ArgVec *args, char *arg);
+void argv_clear(ArgVec *args);
 void free_command(Command *cmd);
+Command *copy_pipeline(const Command *head);
+void funcdef_release(FuncDef *def);
+int collect_heredocs(Command *cmd, char *(*read_line)(void *ctx), void *ctx);
+void free_redirs(Redir *redir);
 
 #endif // PARSER_H
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef PATHGLOB_H
+#define PATHGLOB_H
+
+#include <stdbool.h>
+
+// Directory listings read while expanding the words of one command.
+typedef struct DirCache DirCache;
+
+DirCache *dircache_new(void);
+void dircache_free(DirCache *cache);
+
+bool has_glob_chars(const char *pattern);
+int pathglob(const char *pattern, DirCache *cache, char ***matches);
+
+#endif // PATHGLOB_H
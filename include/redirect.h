@@ -0,0 +1,25 @@
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+#include <stddef.h>
+#include "../include/parser.h"
+
+#define REDIR_MAX_SAVED 16
+
+// Original state of a descriptor changed by an in-process redirection.
+typedef struct {
+    int fd;
+    int saved;            // Close-on-exec copy of the original, -1 if it was closed
+} SavedFd;
+
+// Descriptors to put back after a builtin ran with redirections.
+typedef struct {
+    SavedFd fds[REDIR_MAX_SAVED];
+    int count;
+} RedirSave;
+
+int heredoc_open(const char *body, size_t len);
+int apply_redirections(Redir *redir, RedirSave *save);
+void restore_redirections(RedirSave *save);
+
+#endif // REDIRECT_H
@@ -0,0 +1,21 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdbool.h>
+
+// Runs every command of a script file in the current shell and returns the
+// status of the last one. Parsed scripts are cached by path and mtime, so
+// sourcing an unchanged file again skips reading and parsing it. top_level
+// is set for `ash script`: the script's last command may then replace the
+// shell instead of being forked, in which case the call does not return.
+int source_file(const char *path, bool top_level);
+
+// Runs the commands of `ash -c text` the same way.
+int source_string(const char *text);
+
+// Runs `source file` and `. file`.
+int builtin_source(char **argv);
+
+void source_cache_free(void);
+
+#endif // SOURCE_H
@@ -0,0 +1,25 @@
+#ifndef SUGGEST_H
+#define SUGGEST_H
+
+// Fish-style autosuggestions: the most recent history entry that extends
+// the line being typed, preferring entries run in the current directory.
+// Entries are kept in a prefix index that grows with each line added, so a
+// lookup costs the length of the line, not the size of the history.
+
+// Indexes the lines already in readline's history, with the directories
+// they were run in from ~/.ashhistory_dirs, and binds the right arrow to
+// accept a suggestion.
+void suggest_init(const char *homedir);
+void suggest_free(void);
+
+// Sets the directory that suggestions prefer and new lines are recorded in.
+void suggest_set_dir(const char *cwd);
+
+// Indexes a line just passed to add_history() and records its directory.
+void suggest_add(const char *line);
+
+// Returns the history entry to suggest for the first len bytes of the
+// line, which it extends, or NULL.
+const char *suggest_lookup(const char *prefix, int len);
+
+#endif // SUGGEST_H
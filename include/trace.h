@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+// Set by trace_init() when ASH_TRACE names an output file. Every macro below
+// tests it first, so a disabled tracer costs one predictable branch.
+extern bool trace_enabled;
+
+void trace_init(void);
+void trace_begin(const char *name, const char *detail);
+void trace_end(const char *name);
+void trace_instant(const char *name, const char *detail);
+void trace_after_fork(void);
+void trace_flush(void);
+
+#define TRACE_BEGIN(name) do { if (trace_enabled) trace_begin((name), NULL); } while (0)
+#define TRACE_BEGIN_DETAIL(name, detail) do { if (trace_enabled) trace_begin((name), (detail)); } while (0)
+#define TRACE_END(name) do { if (trace_enabled) trace_end(name); } while (0)
+#define TRACE_INSTANT(name, detail) do { if (trace_enabled) trace_instant((name), (detail)); } while (0)
+#define TRACE_FLUSH() do { if (trace_enabled) trace_flush(); } while (0)
+#define TRACE_AFTER_FORK() do { if (trace_enabled) trace_after_fork(); } while (0)
+
+#endif // TRACE_H
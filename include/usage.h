@@ -0,0 +1,35 @@
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// Resources consumed by one command line or pipeline. CPU times, faults and
+// context switches are summed over every process; max_rss_kb is the largest
+// single process.
+typedef struct {
+    int status;
+    double wall;
+    double user;
+    double sys;
+    long max_rss_kb;
+    long minor_faults;
+    long major_faults;
+    long voluntary_switches;
+    long involuntary_switches;
+} CommandUsage;
+
+extern CommandUsage segment_usage; // Last pipeline run by execute_segment()
+extern CommandUsage line_usage;    // Everything run by the current command line
+extern CommandUsage last_usage;    // The previous command line, shown by `status`
+
+void usage_reset(CommandUsage *usage);
+void usage_add_rusage(CommandUsage *usage, const struct rusage *ru);
+void usage_add(CommandUsage *usage, const CommandUsage *other);
+void usage_begin(void);
+void usage_end(int status);
+void usage_print(FILE *out, const CommandUsage *usage);
+void usage_log(const char *homedir, const char *command_line);
+
+#endif // USAGE_H
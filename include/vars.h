@@ -2,9 +2,14 @@
 #define VARS_H
 
 #include <stdlib.h>
+#include <stdbool.h>
+
+extern char *shell_name;
+extern bool shell_interactive; // Reading commands at a prompt
 
 void set_variable(const char *name, const char *value);
 const char *get_variable(const char *name);
+void unset_variable(const char *name);
 void free_variables(void);
 
 #endif // VARS_H
\ No newline at end of file
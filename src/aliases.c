@@ -12,7 +12,7 @@ void load_aliases(const char *homedir) {
     alias_count = 0;
     char ashrc_path[ASH_MAX_PATH];
     snprintf(ashrc_path, sizeof(ashrc_path), "%s/.ashrc", homedir ? homedir : ".");
-    FILE *ashrc = fopen(ashrc_path, "r");
+    FILE *ashrc = fopen(ashrc_path, "re");
     if (!ashrc) return;
     char line[1024];
     while (fgets(line, sizeof(line), ashrc)) {
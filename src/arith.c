@@ -0,0 +1,607 @@
+// arith.c - Arithmetic expansion for ash shell
+// Evaluates $(( )), `let` and ((...)) over 64-bit signed integers with the
+// C operator set (plus ** for powers), reading and assigning variables in
+// the shell's variable store.
+//
+// An expression is compiled once into a small tree stored in a flat node
+// array and kept in a cache keyed by its text, so a script that evaluates
+// the same expression over and over (a counter, a loop body re-read from
+// the parse cache) only pays for evaluation.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "../include/arith.h"
+#include "../include/expand.h"
+#include "../include/vars.h"
+#include "../include/trace.h"
+
+#define ARITH_CACHE_SIZE 64
+#define ARITH_MAX_DEPTH 256
+// Evaluation recurses once per level of the tree, and a long chain such as
+// 1+1+...+1 is parsed in a loop into a tree as tall as it is long
+#define ARITH_MAX_HEIGHT 10000
+
+typedef enum {
+    A_NUM, A_VAR,
+    A_NEG, A_POS, A_NOT, A_BITNOT,
+    A_PREINC, A_PREDEC, A_POSTINC, A_POSTDEC,
+    A_POW, A_MUL, A_DIV, A_MOD, A_ADD, A_SUB, A_SHL, A_SHR,
+    A_LT, A_LE, A_GT, A_GE, A_EQ, A_NE,
+    A_BAND, A_BXOR, A_BOR, A_LAND, A_LOR,
+    A_COND, A_ASSIGN, A_COMMA
+} ArithOp;
+
+// One node of a compiled expression. Children are indices into the node
+// array; for A_ASSIGN, op2 holds the operator of a compound assignment
+// (A_ADD for "+=") or A_NUM for a plain "=".
+typedef struct {
+    unsigned char op;
+    unsigned char op2;
+    int a, b, c;
+    int height;           // Levels in the subtree rooted here
+    long long value;      // Literal for A_NUM, name offset for A_VAR
+} ArithNode;
+
+// A compiled expression.
+typedef struct {
+    ArithNode *nodes;
+    int count;
+    int cap;
+    char *names;          // Variable names, NUL separated
+    size_t names_len;
+    size_t names_cap;
+    int root;
+} ArithExpr;
+
+// Recursive descent parser state.
+typedef struct {
+    const char *text;     // The whole expression, for error messages
+    const char *p;
+    ArithExpr *expr;
+    const char *error;
+    int depth;
+} ArithParser;
+
+static struct {
+    char *text;
+    ArithExpr *expr;
+} arith_cache[ARITH_CACHE_SIZE];
+
+static int parse_comma(ArithParser *ps);
+
+static int new_node(ArithParser *ps, ArithOp op, int a, int b, int c) {
+    ArithExpr *e = ps->expr;
+    if (e->count == e->cap) {
+        int cap = e->cap ? e->cap * 2 : 16;
+        ArithNode *nodes = realloc(e->nodes, cap * sizeof(ArithNode));
+        if (!nodes) {
+            perror("ash: memory allocation failed");
+            exit(1);
+        }
+        e->nodes = nodes;
+        e->cap = cap;
+    }
+    ArithNode *n = &e->nodes[e->count];
+    n->op = (unsigned char)op;
+    n->op2 = A_NUM;
+    n->a = a;
+    n->b = b;
+    n->c = c;
+    n->value = 0;
+    int height = 0;
+    int children[3] = { a, b, c };
+    for (int i = 0; i < 3; i++) {
+        if (children[i] >= 0 && e->nodes[children[i]].height > height) height = e->nodes[children[i]].height;
+    }
+    n->height = height + 1;
+    if (n->height > ARITH_MAX_HEIGHT && !ps->error) ps->error = "expression too deep";
+    return e->count++;
+}
+
+static int new_var(ArithParser *ps, const char *name, size_t len) {
+    ArithExpr *e = ps->expr;
+    if (e->names_len + len + 1 > e->names_cap) {
+        size_t cap = e->names_cap ? e->names_cap : 32;
+        while (cap < e->names_len + len + 1) cap *= 2;
+        char *names = realloc(e->names, cap);
+        if (!names) {
+            perror("ash: memory allocation failed");
+            exit(1);
+        }
+        e->names = names;
+        e->names_cap = cap;
+    }
+    memcpy(e->names + e->names_len, name, len);
+    e->names[e->names_len + len] = '\0';
+    int node = new_node(ps, A_VAR, -1, -1, -1);
+    e->nodes[node].value = (long long)e->names_len;
+    e->names_len += len + 1;
+    return node;
+}
+
+static void skip_blanks(ArithParser *ps) {
+    while (isspace((unsigned char)*ps->p)) ps->p++;
+}
+
+// Consumes the binary operator op if it comes next. It must not be the
+// start of a longer operator: '&' is not "&&", '<<' is not "<<=", '+' is
+// not "+=" or "++".
+static bool accept(ArithParser *ps, const char *op) {
+    skip_blanks(ps);
+    size_t len = strlen(op);
+    if (strncmp(ps->p, op, len) != 0) return false;
+    char next = ps->p[len];
+    if (len == 1 && strchr("<>&|*+-", op[0]) && next == op[0]) return false;
+    if (next == '=' && op[len - 1] != '=') return false;
+    ps->p += len;
+    return true;
+}
+
+static int parse_unary(ArithParser *ps);
+
+static int parse_primary(ArithParser *ps) {
+    skip_blanks(ps);
+    if (*ps->p == '(') {
+        ps->p++;
+        int node = parse_comma(ps);
+        skip_blanks(ps);
+        if (*ps->p != ')') {
+            if (!ps->error) ps->error = "missing `)'";
+            return node;
+        }
+        ps->p++;
+        return node;
+    }
+    if (isdigit((unsigned char)*ps->p)) {
+        char *end;
+        long long value = (long long)strtoull(ps->p, &end, 0);
+        if (isalnum((unsigned char)*end) || *end == '_') {
+            ps->error = "value too great for base";
+            return new_node(ps, A_NUM, -1, -1, -1);
+        }
+        ps->p = end;
+        int node = new_node(ps, A_NUM, -1, -1, -1);
+        ps->expr->nodes[node].value = value;
+        return node;
+    }
+    if (isalpha((unsigned char)*ps->p) || *ps->p == '_') {
+        const char *start = ps->p;
+        while (isalnum((unsigned char)*ps->p) || *ps->p == '_') ps->p++;
+        return new_var(ps, start, (size_t)(ps->p - start));
+    }
+    ps->error = *ps->p ? "syntax error: operand expected" : "syntax error: operand expected (end of expression)";
+    return new_node(ps, A_NUM, -1, -1, -1);
+}
+
+static int parse_postfix(ArithParser *ps) {
+    int node = parse_primary(ps);
+    skip_blanks(ps);
+    if (ps->expr->nodes[node].op == A_VAR) {
+        if (strncmp(ps->p, "++", 2) == 0) {
+            ps->p += 2;
+            return new_node(ps, A_POSTINC, node, -1, -1);
+        }
+        if (strncmp(ps->p, "--", 2) == 0) {
+            ps->p += 2;
+            return new_node(ps, A_POSTDEC, node, -1, -1);
+        }
+    }
+    return node;
+}
+
+// Counts a level of parser recursion; false once there are too many.
+static bool nest(ArithParser *ps) {
+    if (ps->depth >= ARITH_MAX_DEPTH) {
+        if (!ps->error) ps->error = "expression nested too deeply";
+        return false;
+    }
+    ps->depth++;
+    return true;
+}
+
+static int parse_unary(ArithParser *ps) {
+    if (!nest(ps)) return new_node(ps, A_NUM, -1, -1, -1);
+    skip_blanks(ps);
+    int node;
+    ArithOp op;
+    if (strncmp(ps->p, "++", 2) == 0 || strncmp(ps->p, "--", 2) == 0) {
+        op = (*ps->p == '+') ? A_PREINC : A_PREDEC;
+        ps->p += 2;
+        int operand = parse_unary(ps);
+        if (ps->expr->nodes[operand].op != A_VAR && !ps->error) {
+            ps->error = "attempted assignment to non-variable";
+        }
+        node = new_node(ps, op, operand, -1, -1);
+    } else if (*ps->p == '-' || *ps->p == '+' || *ps->p == '!' || *ps->p == '~') {
+        op = (*ps->p == '-') ? A_NEG : (*ps->p == '+') ? A_POS : (*ps->p == '!') ? A_NOT : A_BITNOT;
+        ps->p++;
+        node = new_node(ps, op, parse_unary(ps), -1, -1);
+    } else {
+        node = parse_postfix(ps);
+    }
+    ps->depth--;
+    return node;
+}
+
+// '**' binds tighter than the other binary operators and groups right.
+static int parse_power(ArithParser *ps) {
+    int left = parse_unary(ps);
+    skip_blanks(ps);
+    if (strncmp(ps->p, "**", 2) == 0 && ps->p[2] != '=') {
+        ps->p += 2;
+        if (!nest(ps)) return left;
+        int right = parse_power(ps);
+        ps->depth--;
+        return new_node(ps, A_POW, left, right, -1);
+    }
+    return left;
+}
+
+// Binary operators from tightest to loosest binding; all group left.
+static const struct {
+    const char *token;
+    ArithOp op;
+    int level;
+} binary_ops[] = {
+    { "*", A_MUL, 0 }, { "/", A_DIV, 0 }, { "%", A_MOD, 0 },
+    { "+", A_ADD, 1 }, { "-", A_SUB, 1 },
+    { "<<", A_SHL, 2 }, { ">>", A_SHR, 2 },
+    { "<=", A_LE, 3 }, { ">=", A_GE, 3 }, { "<", A_LT, 3 }, { ">", A_GT, 3 },
+    { "==", A_EQ, 4 }, { "!=", A_NE, 4 },
+    { "&", A_BAND, 5 },
+    { "^", A_BXOR, 6 },
+    { "|", A_BOR, 7 },
+    { "&&", A_LAND, 8 },
+    { "||", A_LOR, 9 },
+};
+#define ARITH_LEVELS 10
+
+static int parse_binary(ArithParser *ps, int level) {
+    if (level < 0) return parse_power(ps);
+    int left = parse_binary(ps, level - 1);
+    for (;;) {
+        bool matched = false;
+        for (size_t i = 0; i < sizeof(binary_ops) / sizeof(*binary_ops); i++) {
+            if (binary_ops[i].level != level) continue;
+            if (accept(ps, binary_ops[i].token)) {
+                int right = parse_binary(ps, level - 1);
+                left = new_node(ps, binary_ops[i].op, left, right, -1);
+                matched = true;
+                break;
+            }
+        }
+        if (!matched || ps->error) return left;
+    }
+}
+
+static int parse_assign(ArithParser *ps);
+
+static int parse_cond(ArithParser *ps) {
+    int cond = parse_binary(ps, ARITH_LEVELS - 1);
+    skip_blanks(ps);
+    if (*ps->p != '?') return cond;
+    ps->p++;
+    int then = parse_comma(ps);
+    skip_blanks(ps);
+    if (*ps->p != ':') {
+        if (!ps->error) ps->error = "`:' expected for conditional expression";
+        return cond;
+    }
+    ps->p++;
+    if (!nest(ps)) return cond;
+    int otherwise = parse_cond(ps);
+    ps->depth--;
+    return new_node(ps, A_COND, cond, then, otherwise);
+}
+
+// Assignment operators and the binary operator each one applies.
+static const struct {
+    const char *token;
+    ArithOp op;
+} assign_ops[] = {
+    { "**=", A_POW }, { "<<=", A_SHL }, { ">>=", A_SHR },
+    { "+=", A_ADD }, { "-=", A_SUB }, { "*=", A_MUL }, { "/=", A_DIV }, { "%=", A_MOD },
+    { "&=", A_BAND }, { "^=", A_BXOR }, { "|=", A_BOR }, { "=", A_NUM },
+};
+
+static int parse_assign(ArithParser *ps) {
+    int left = parse_cond(ps);
+    if (ps->error) return left;
+    skip_blanks(ps);
+    for (size_t i = 0; i < sizeof(assign_ops) / sizeof(*assign_ops); i++) {
+        size_t len = strlen(assign_ops[i].token);
+        if (strncmp(ps->p, assign_ops[i].token, len) != 0) continue;
+        if (len == 1 && ps->p[1] == '=') break; // "==" is a comparison
+        if (ps->expr->nodes[left].op != A_VAR) {
+            ps->error = "attempted assignment to non-variable";
+            return left;
+        }
+        ps->p += len;
+        if (!nest(ps)) return left;
+        int value = parse_assign(ps);
+        ps->depth--;
+        int node = new_node(ps, A_ASSIGN, left, value, -1);
+        ps->expr->nodes[node].op2 = (unsigned char)assign_ops[i].op;
+        return node;
+    }
+    return left;
+}
+
+static int parse_comma(ArithParser *ps) {
+    int left = parse_assign(ps);
+    skip_blanks(ps);
+    while (!ps->error && *ps->p == ',') {
+        ps->p++;
+        left = new_node(ps, A_COMMA, left, parse_assign(ps), -1);
+        skip_blanks(ps);
+    }
+    return left;
+}
+
+static void free_expr(ArithExpr *e) {
+    if (!e) return;
+    free(e->nodes);
+    free(e->names);
+    free(e);
+}
+
+// Compiles text into an expression tree; returns NULL after printing an error.
+static ArithExpr *compile(const char *text) {
+    ArithExpr *expr = calloc(1, sizeof(ArithExpr));
+    if (!expr) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    ArithParser ps = { text, text, expr, NULL, 0 };
+    skip_blanks(&ps);
+    if (*ps.p == '\0') {
+        // An empty expression evaluates to 0
+        expr->root = new_node(&ps, A_NUM, -1, -1, -1);
+        return expr;
+    }
+    expr->root = parse_comma(&ps);
+    skip_blanks(&ps);
+    if (!ps.error && *ps.p != '\0') {
+        ps.error = "syntax error in expression";
+    }
+    if (ps.error) {
+        fprintf(stderr, "ash: %s: %s (error token is \"%s\")\n", text, ps.error, ps.p);
+        free_expr(expr);
+        return NULL;
+    }
+    return expr;
+}
+
+// Returns the cached compilation of text, compiling it on a miss.
+static ArithExpr *lookup(const char *text) {
+    unsigned int hash = 2166136261u;
+    for (const char *p = text; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    unsigned int slot = hash % ARITH_CACHE_SIZE;
+    if (arith_cache[slot].text && strcmp(arith_cache[slot].text, text) == 0) {
+        return arith_cache[slot].expr;
+    }
+    ArithExpr *expr = compile(text);
+    if (!expr) return NULL;
+    char *copy = strdup(text);
+    if (!copy) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    free(arith_cache[slot].text);
+    free_expr(arith_cache[slot].expr);
+    arith_cache[slot].text = copy;
+    arith_cache[slot].expr = expr;
+    return expr;
+}
+
+static long long var_value(const char *name) {
+    const char *value = get_variable(name);
+    if (!value) return 0;
+    return (long long)strtoull(value, NULL, 0);
+}
+
+static void var_assign(const char *name, long long value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", value);
+    set_variable(name, buf);
+    setenv(name, buf, 1);
+}
+
+// Applies a binary operator; returns an error message or NULL.
+static const char *apply_binary(ArithOp op, long long a, long long b, long long *out) {
+    // Wrap around on overflow like the hardware does, without the undefined
+    // behavior of signed overflow in C.
+    unsigned long long ua = (unsigned long long)a, ub = (unsigned long long)b;
+    switch (op) {
+    case A_ADD: *out = (long long)(ua + ub); break;
+    case A_SUB: *out = (long long)(ua - ub); break;
+    case A_MUL: *out = (long long)(ua * ub); break;
+    case A_DIV:
+    case A_MOD:
+        if (b == 0) return "division by 0";
+        if (a == LLONG_MIN && b == -1) {
+            *out = (op == A_DIV) ? a : 0;
+        } else {
+            *out = (op == A_DIV) ? a / b : a % b;
+        }
+        break;
+    case A_POW: {
+        if (b < 0) return "exponent less than 0";
+        unsigned long long result = 1;
+        while (b > 0) {
+            if (b & 1) result *= ua;
+            ua *= ua;
+            b >>= 1;
+        }
+        *out = (long long)result;
+        break;
+    }
+    case A_SHL: *out = (long long)(ua << (b & 63)); break;
+    case A_SHR: *out = a >> (b & 63); break;
+    case A_LT: *out = a < b; break;
+    case A_LE: *out = a <= b; break;
+    case A_GT: *out = a > b; break;
+    case A_GE: *out = a >= b; break;
+    case A_EQ: *out = a == b; break;
+    case A_NE: *out = a != b; break;
+    case A_BAND: *out = a & b; break;
+    case A_BXOR: *out = a ^ b; break;
+    case A_BOR: *out = a | b; break;
+    default: *out = b; break;
+    }
+    return NULL;
+}
+
+// Evaluates one node; returns an error message or NULL.
+static const char *eval(const ArithExpr *e, int index, long long *out) {
+    const ArithNode *n = &e->nodes[index];
+    const char *err = NULL;
+    long long a = 0, b = 0;
+    switch ((ArithOp)n->op) {
+    case A_NUM:
+        *out = n->value;
+        return NULL;
+    case A_VAR:
+        *out = var_value(e->names + n->value);
+        return NULL;
+    case A_NEG:
+    case A_POS:
+    case A_NOT:
+    case A_BITNOT:
+        if ((err = eval(e, n->a, &a))) return err;
+        *out = (n->op == A_NEG) ? (long long)(0ULL - (unsigned long long)a) :
+               (n->op == A_POS) ? a : (n->op == A_NOT) ? !a : ~a;
+        return NULL;
+    case A_PREINC:
+    case A_PREDEC:
+    case A_POSTINC:
+    case A_POSTDEC: {
+        const char *name = e->names + e->nodes[n->a].value;
+        a = var_value(name);
+        bool inc = (n->op == A_PREINC || n->op == A_POSTINC);
+        long long updated = (long long)((unsigned long long)a + (inc ? 1ULL : -1ULL));
+        var_assign(name, updated);
+        *out = (n->op == A_PREINC || n->op == A_PREDEC) ? updated : a;
+        return NULL;
+    }
+    case A_LAND:
+        if ((err = eval(e, n->a, &a))) return err;
+        if (!a) { *out = 0; return NULL; }
+        if ((err = eval(e, n->b, &b))) return err;
+        *out = b != 0;
+        return NULL;
+    case A_LOR:
+        if ((err = eval(e, n->a, &a))) return err;
+        if (a) { *out = 1; return NULL; }
+        if ((err = eval(e, n->b, &b))) return err;
+        *out = b != 0;
+        return NULL;
+    case A_COND:
+        if ((err = eval(e, n->a, &a))) return err;
+        return eval(e, a ? n->b : n->c, out);
+    case A_COMMA:
+        if ((err = eval(e, n->a, &a))) return err;
+        return eval(e, n->b, out);
+    case A_ASSIGN: {
+        const char *name = e->names + e->nodes[n->a].value;
+        if ((err = eval(e, n->b, &b))) return err;
+        if (n->op2 != A_NUM) {
+            if ((err = apply_binary((ArithOp)n->op2, var_value(name), b, &b))) return err;
+        }
+        var_assign(name, b);
+        *out = b;
+        return NULL;
+    }
+    default:
+        if ((err = eval(e, n->a, &a))) return err;
+        if ((err = eval(e, n->b, &b))) return err;
+        return apply_binary((ArithOp)n->op, a, b, out);
+    }
+}
+
+/**
+ * @brief Evaluates an arithmetic expression.
+ *
+ * Variables are read from and assigned to the shell's variable store (and
+ * exported like `NAME=value` assignments are); unset or non-numeric
+ * variables count as 0.
+ *
+ * @param text The expression, already free of $ expansions.
+ * @param result Receives the value.
+ * @return 0 on success, -1 after printing an error.
+ */
+int arith_eval(const char *text, long long *result) {
+    TRACE_BEGIN("arith");
+    ArithExpr *expr = lookup(text);
+    if (!expr) {
+        TRACE_END("arith");
+        return -1;
+    }
+    const char *err = eval(expr, expr->root, result);
+    TRACE_END("arith");
+    if (err) {
+        fprintf(stderr, "ash: %s: %s\n", text, err);
+        return -1;
+    }
+    return 0;
+}
+
+// Expands $ constructs inside an expression, then evaluates it.
+static int eval_expanded(const char *text, long long *result) {
+    if (!strpbrk(text, "$`")) {
+        return arith_eval(text, result);
+    }
+    char *expanded = expand_variables(text);
+    int rc = arith_eval(expanded ? expanded : "", result);
+    free(expanded);
+    return rc;
+}
+
+/**
+ * @brief Runs `let expr...`.
+ * @return 0 if the last expression is non-zero, 1 if it is zero, 2 on error.
+ */
+int builtin_let(char **argv) {
+    if (argv[1] == NULL) {
+        fprintf(stderr, "ash: let: expression expected\n");
+        return 2;
+    }
+    long long value = 0;
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (arith_eval(argv[i], &value) != 0) return 2;
+    }
+    return value != 0 ? 0 : 1;
+}
+
+// True for a word of the form ((expr)).
+bool is_arith_command(const char *word) {
+    size_t len = strlen(word);
+    return len >= 4 && strncmp(word, "((", 2) == 0 && strcmp(word + len - 2, "))") == 0;
+}
+
+/**
+ * @brief Runs the ((expr)) command.
+ * @return 0 if the expression is non-zero, 1 if it is zero, 2 on error.
+ */
+int run_arith_command(const char *word) {
+    size_t len = strlen(word);
+    char *inner = strndup(word + 2, len - 4);
+    if (!inner) {
+        perror("ash: memory allocation failed");
+        return 2;
+    }
+    long long value = 0;
+    int rc = eval_expanded(inner, &value);
+    free(inner);
+    if (rc != 0) return 2;
+    return value != 0 ? 0 : 1;
+}
@@ -2,14 +2,15 @@
 // Ensures ~/.ashrc exists and runs its commands at startup
 
 #include "ash.h"
+#include "trace.h"
 
 // Create ~/.ashrc if it does not exist
 void ensure_ashrc(const char *homedir) {
     char ashrc_path[ASH_MAX_PATH];
     snprintf(ashrc_path, sizeof(ashrc_path), "%s/.ashrc", homedir ? homedir : ".");
-    FILE *ashrc = fopen(ashrc_path, "r");
+    FILE *ashrc = fopen(ashrc_path, "re");
     if (!ashrc) {
-        ashrc = fopen(ashrc_path, "w");
+        ashrc = fopen(ashrc_path, "we");
         if (!ashrc) {
             fprintf(stderr, "ash: could not create %s\n", ashrc_path);
             return;
@@ -26,7 +27,7 @@ void ensure_ashrc(const char *homedir) {
 void run_ashrc(const char *homedir) {
     char ashrc_path[ASH_MAX_PATH];
     snprintf(ashrc_path, sizeof(ashrc_path), "%s/.ashrc", homedir ? homedir : ".");
-    FILE *ashrc = fopen(ashrc_path, "r");
+    FILE *ashrc = fopen(ashrc_path, "re");
     if (!ashrc) {
         fprintf(stderr, "ash: could not open %s\n", ashrc_path);
         return;
@@ -42,6 +43,7 @@ void run_ashrc(const char *homedir) {
                 exit(1);
             }
             if (pid == 0) {
+                TRACE_AFTER_FORK();
                 execl("/bin/sh", "sh", "-c", line, (char *)NULL);
                 fprintf(stderr, "ash: exec failed\n");
                 exit(1);
@@ -1,4 +1,5 @@
 #include "../include/builtins.h"
+#include "../include/frecency.h"
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,5 +16,6 @@ int handle_cd(const char *path) {
         perror("cd");
         return -1;
     }
+    frecency_add(NULL);
     return 0;
 }
\ No newline at end of file
@@ -15,7 +15,7 @@ void build_command_list(const char *homedir) {
     }
     char ashrc_path[ASH_MAX_PATH];
     snprintf(ashrc_path, sizeof(ashrc_path), "%s/.ashrc", homedir ? homedir : ".");
-    FILE *ashrc = fopen(ashrc_path, "r");
+    FILE *ashrc = fopen(ashrc_path, "re");
     if (ashrc) {
         char line[1024];
         while (fgets(line, sizeof(line), ashrc)) {
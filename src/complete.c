@@ -0,0 +1,346 @@
+// complete.c - Tab completion for ash shell
+// The tokens before the word being completed decide what it can be: a
+// command name at the start of a command, a directory after cd, a file
+// after a redirection operator or anywhere else. Commands come from the
+// $PATH list, the builtins and the aliases. After `git checkout` and the
+// other git subcommands that take a commit, branch and tag names come
+// first, read from the repository by git.c.
+//
+// Directory listings are kept sorted in a small cache keyed by device and
+// inode, so the same directory reached by another path shares an entry.
+// Each Tab press stats the directory and reuses the listing while its
+// mtime is unchanged, then finds the names with the typed prefix by
+// binary search. A directory modified within a second of being read may
+// have changed again within the same timestamp, so it is read again next
+// time until it settles. Whether a symlink names a directory is only
+// looked up for names that match, and then remembered.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <readline/readline.h>
+
+#include "../include/ash.h"
+#include "../include/complete.h"
+#include "../include/executor.h"
+#include "../include/git.h"
+#include "../include/parser.h"
+
+#define COMPLETE_CACHE_SIZE 16
+
+// What the word being completed can be
+enum { WORD_NONE, WORD_COMMAND, WORD_ARGUMENT, WORD_FILE };
+
+// Each name in the arena follows a byte giving its type
+enum { TYPE_DIR = 'd', TYPE_OTHER = 'f', TYPE_UNKNOWN = '?' };
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    bool racy;           // Modified too close to the read to trust mtime
+    char *arena;
+    char **names;        // Into arena, sorted
+    size_t count;
+    unsigned long used;  // Last use, for evicting the oldest
+} Listing;
+
+static Listing cache[COMPLETE_CACHE_SIZE];
+static unsigned long use_clock = 0;
+
+static char **matches = NULL;
+static size_t match_count = 0, match_cap = 0, match_next = 0;
+
+static void *grow(void *p, size_t size) {
+    void *q = realloc(p, size);
+    if (q == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    return q;
+}
+
+static void listing_clear(Listing *l) {
+    free(l->arena);
+    free(l->names);
+    memset(l, 0, sizeof(*l));
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Reads the directory at path into l.
+static bool listing_read(Listing *l, const char *path, const struct stat *st) {
+    struct timespec started;
+    clock_gettime(CLOCK_REALTIME, &started);
+    DIR *d = opendir(path);
+    if (d == NULL) return false;
+    listing_clear(l);
+    size_t len = 0, cap = 0, count = 0, offsets_cap = 0;
+    size_t *offsets = NULL;
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        const char *n = entry->d_name;
+        if (strcmp(n, ".") == 0 || strcmp(n, "..") == 0) continue;
+        size_t need = strlen(n) + 2;
+        if (len + need > cap) {
+            cap = cap ? cap * 2 : 4096;
+            while (len + need > cap) cap *= 2;
+            l->arena = grow(l->arena, cap);
+        }
+        if (count == offsets_cap) {
+            offsets_cap = offsets_cap ? offsets_cap * 2 : 256;
+            offsets = grow(offsets, offsets_cap * sizeof(size_t));
+        }
+        offsets[count++] = len;
+        l->arena[len] = entry->d_type == DT_DIR ? TYPE_DIR
+                      : (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) ? TYPE_UNKNOWN : TYPE_OTHER;
+        memcpy(l->arena + len + 1, n, need - 1);
+        len += need;
+    }
+    closedir(d);
+    l->names = grow(NULL, (count ? count : 1) * sizeof(char *));
+    for (size_t i = 0; i < count; i++) l->names[i] = l->arena + offsets[i] + 1;
+    free(offsets);
+    qsort(l->names, count, sizeof(char *), by_name);
+    l->count = count;
+    l->dev = st->st_dev;
+    l->ino = st->st_ino;
+    l->mtime = st->st_mtim;
+    l->racy = st->st_mtim.tv_sec >= started.tv_sec - 1;
+    return true;
+}
+
+// Returns the cached listing of the directory at path, reading it if it
+// is new or has changed.
+static Listing *listing_for(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+    Listing *slot = &cache[0];
+    for (int i = 0; i < COMPLETE_CACHE_SIZE; i++) {
+        Listing *l = &cache[i];
+        if (l->names && l->dev == st.st_dev && l->ino == st.st_ino) {
+            slot = l;
+            break;
+        }
+        if (l->used < slot->used) slot = l;
+    }
+    bool fresh = slot->names && slot->dev == st.st_dev && slot->ino == st.st_ino && !slot->racy &&
+                 slot->mtime.tv_sec == st.st_mtim.tv_sec && slot->mtime.tv_nsec == st.st_mtim.tv_nsec;
+    if (!fresh && !listing_read(slot, path, &st)) return NULL;
+    slot->used = ++use_clock;
+    return slot;
+}
+
+void complete_dir_entries(const char *dir, const char *prefix, int flags, CompleteEntryFn fn, void *ctx) {
+    const char *path = *dir ? dir : ".";
+    Listing *l = listing_for(path);
+    if (l == NULL) return;
+    size_t prefix_len = strlen(prefix);
+    size_t lo = 0, hi = l->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(l->names[mid], prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    for (size_t i = lo; i < l->count && strncmp(l->names[i], prefix, prefix_len) == 0; i++) {
+        char *name = l->names[i];
+        if (name[0] == '.' && !(flags & COMPLETE_HIDDEN)) continue;
+        char *type = name - 1;
+        if (*type == TYPE_UNKNOWN) {
+            char full[ASH_MAX_PATH];
+            struct stat st;
+            snprintf(full, sizeof(full), "%s/%s", path, name);
+            *type = stat(full, &st) == 0 && S_ISDIR(st.st_mode) ? TYPE_DIR : TYPE_OTHER;
+        }
+        if ((flags & COMPLETE_DIRS_ONLY) && *type != TYPE_DIR) continue;
+        fn(name, *type == TYPE_DIR, ctx);
+    }
+}
+
+static void add_match(char *s) {
+    if (match_count == match_cap) {
+        match_cap = match_cap ? match_cap * 2 : 64;
+        matches = grow(matches, match_cap * sizeof(char *));
+    }
+    matches[match_count++] = s;
+}
+
+// Readline frees the strings it is handed.
+static char *next_match(const char *text, int state) {
+    (void)text;
+    if (state == 0) match_next = 0;
+    return match_next < match_count ? matches[match_next++] : NULL;
+}
+
+static void add_prefixed(const char *typed_dir, const char *name) {
+    size_t n = strlen(typed_dir), m = strlen(name);
+    char *s = malloc(n + m + 1);
+    if (s == NULL) return;
+    memcpy(s, typed_dir, n);
+    memcpy(s + n, name, m + 1);
+    add_match(s);
+}
+
+static void add_path(const char *name, bool is_dir, void *ctx) {
+    (void)is_dir;
+    add_prefixed(ctx, name);
+}
+
+static void complete_paths(const char *text, int flags) {
+    const char *slash = strrchr(text, '/');
+    const char *base = slash ? slash + 1 : text;
+    char typed[ASH_MAX_PATH];
+    snprintf(typed, sizeof(typed), "%.*s", (int)(base - text), text);
+    char *dir = typed[0] == '~' ? tilde_expand(typed) : strdup(typed);
+    if (dir == NULL) return;
+    if (base[0] == '.') flags |= COMPLETE_HIDDEN;
+    complete_dir_entries(dir, base, flags, add_path, typed);
+    free(dir);
+}
+
+static void complete_commands(const char *text) {
+    size_t len = strlen(text);
+    for (size_t i = 0; i < commands_count; i++) {
+        if (strncmp(commands[i], text, len) == 0) add_prefixed("", commands[i]);
+    }
+    for (int i = 0; builtin_names[i]; i++) {
+        if (strncmp(builtin_names[i], text, len) == 0) add_prefixed("", builtin_names[i]);
+    }
+    for (int i = 0; i < alias_count; i++) {
+        if (strncmp(aliases[i], text, len) == 0) add_prefixed("", aliases[i]);
+    }
+}
+
+static bool is_separator(const char *op) {
+    return strcmp(op, "|") == 0 || strcmp(op, "||") == 0 || strcmp(op, "&&") == 0 ||
+           strcmp(op, ";") == 0 || strcmp(op, "&") == 0;
+}
+
+static bool is_redirection(const char *op) {
+    while (isdigit((unsigned char)*op)) op++;
+    return *op == '<' || *op == '>' || strcmp(op, "&>") == 0 || strcmp(op, "&>>") == 0;
+}
+
+static bool is_assignment(const char *word) {
+    if (!isalpha((unsigned char)*word) && *word != '_') return false;
+    while (isalnum((unsigned char)*word) || *word == '_') word++;
+    return *word == '=';
+}
+
+// What the word being completed can be, and the command it belongs to
+typedef struct {
+    int kind;
+    char command[64];
+    char subcommand[64]; // First argument not starting with '-'
+    bool end_of_options; // A `--` came before the word
+} WordContext;
+
+// Works out what the word starting at offset start of the line can be
+// from the tokens before it.
+static void word_context(int start, WordContext *w) {
+    memset(w, 0, sizeof(*w));
+    w->kind = WORD_NONE;
+    char *before = strndup(rl_line_buffer, (size_t)start);
+    if (before == NULL) return;
+    // Readline also splits words at characters such as '=' and '$'; what
+    // comes before one of those is part of the same shell word
+    bool joined = start > 0 && !isspace((unsigned char)before[start - 1]) &&
+                  strchr("|&;<>", before[start - 1]) == NULL;
+    TokenList tokens = tokenize(before);
+    w->kind = WORD_COMMAND;
+    for (Token *t = tokens.head; t; t = t->next) {
+        if (joined && t->next == NULL) {
+            // `VAR=/pa` and `--file=pa` take a path, `$HO` does not
+            w->kind = strchr(t->value, '=') ? WORD_FILE : WORD_NONE;
+        } else if (!t->quoted && is_separator(t->value)) {
+            memset(w, 0, sizeof(*w));
+            w->kind = WORD_COMMAND;
+        } else if (!t->quoted && is_redirection(t->value)) {
+            if (t->next == NULL) {
+                // A here-document delimiter is not a file
+                const char *op = t->value + strspn(t->value, "0123456789");
+                w->kind = strncmp(op, "<<", 2) == 0 && strcmp(op, "<<<") != 0 ? WORD_NONE : WORD_FILE;
+            } else {
+                t = t->next; // Its target
+            }
+        } else if (w->kind == WORD_COMMAND && !is_assignment(t->value)) {
+            snprintf(w->command, sizeof(w->command), "%s", t->value);
+            w->kind = WORD_ARGUMENT;
+        } else if (w->kind == WORD_ARGUMENT && strcmp(t->value, "--") == 0) {
+            w->end_of_options = true;
+        } else if (w->kind == WORD_ARGUMENT && w->subcommand[0] == '\0' && t->value[0] != '-') {
+            snprintf(w->subcommand, sizeof(w->subcommand), "%s", t->value);
+        }
+    }
+    free_tokens(&tokens);
+    free(before);
+}
+
+// Whether the word is an argument to a git subcommand that takes a branch,
+// tag or other commit, where no `--` has ended its revisions yet
+static bool takes_git_ref(const WordContext *w) {
+    static const char *const subcommands[] = {
+        "branch", "checkout", "cherry-pick", "diff", "log", "merge", "rebase",
+        "reset", "revert", "show", "switch", "tag", NULL
+    };
+    if (w->kind != WORD_ARGUMENT || w->end_of_options || strcmp(w->command, "git") != 0) return false;
+    for (int i = 0; subcommands[i]; i++) {
+        if (strcmp(w->subcommand, subcommands[i]) == 0) return true;
+    }
+    return false;
+}
+
+static void add_ref(const char *name, void *ctx) {
+    (void)ctx;
+    add_prefixed("", name);
+}
+
+static char **attempt_completion(const char *text, int start, int end) {
+    (void)end;
+    // Never fall back to readline's own filename completion
+    rl_attempted_completion_over = 1;
+    match_count = 0;
+    WordContext w;
+    word_context(start, &w);
+    bool refs = false;
+    if (takes_git_ref(&w)) {
+        char cwd[ASH_MAX_PATH];
+        if (getcwd(cwd, sizeof(cwd))) git_refs(cwd, text, add_ref, NULL);
+        refs = match_count > 0;
+    }
+    if (refs) {
+        // `git checkout` and the like also take paths, when no ref matches
+    } else if (w.kind == WORD_COMMAND && strchr(text, '/') == NULL) {
+        complete_commands(text);
+    } else if (w.kind == WORD_ARGUMENT && strcmp(w.command, "cd") == 0) {
+        complete_paths(text, COMPLETE_DIRS_ONLY);
+    } else if (w.kind != WORD_NONE) {
+        complete_paths(text, 0);
+    }
+    // Readline then lists only what follows the last '/', and marks
+    // directories with one instead of a space after them. Ref names such
+    // as origin/main are not paths.
+    rl_filename_completion_desired = !refs && (w.kind != WORD_COMMAND || strchr(text, '/') != NULL);
+    return match_count ? rl_completion_matches(text, next_match) : NULL;
+}
+
+void complete_init(void) {
+    rl_attempted_completion_function = attempt_completion;
+}
+
+void complete_free(void) {
+    for (int i = 0; i < COMPLETE_CACHE_SIZE; i++) listing_clear(&cache[i]);
+    free(matches);
+    matches = NULL;
+    match_count = match_cap = 0;
+}
@@ -9,7 +9,7 @@
 bool ash_get_config_bool(const char *homedir, const char *key, bool default_value) {
     char path[ASH_MAX_PATH];
     snprintf(path, sizeof(path), "%s%s", homedir, ASH_CONFIG_PATH);
-    FILE *f = fopen(path, "r");
+    FILE *f = fopen(path, "re");
     if (!f) return default_value;
     char line[256];
     while (fgets(line, sizeof(line), f)) {
@@ -32,8 +32,8 @@ void ash_create_config(const char *homedir) {
     snprintf(path, sizeof(path), "%s%s", homedir, ASH_CONFIG_PATH);
     struct stat st;
     if (stat(path, &st) == 0) return; // Already exists
-    FILE *f = fopen(path, "w");
+    FILE *f = fopen(path, "we");
     if (!f) return;
-    fprintf(f, "first_time=false\nhide_icon=false\n");
+    fprintf(f, "first_time=false\nhide_icon=false\nlog_usage=false\nsyntax_highlight=true\nautosuggest=true\n");
     fclose(f);
 }
\ No newline at end of file
@@ -0,0 +1,291 @@
+// eventloop.c - Event loop for the interactive prompt
+// The prompt reads keys through readline's callback interface from an epoll
+// loop, instead of blocking inside readline(). The loop watches stdin, a
+// signalfd for SIGCHLD and SIGWINCH, timerfds, and the output pipes of
+// background jobs whose output is captured. Everything runs on the shell's
+// one thread between keystrokes, so a job that finishes while the user types
+// is announced above the line being edited without a signal handler
+// touching the screen or the job table.
+//
+// SIGCHLD and SIGWINCH are blocked only while the loop runs; commands are
+// still run, waited for and reaped as before, with the SIGCHLD handler.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <readline/readline.h>
+
+#include "../include/eventloop.h"
+#include "../include/jobs.h"
+#include "../include/highlight.h"
+#include "../include/finder.h"
+
+#define EVENT_MAX_TIMERS 16
+#define EVENT_BATCH 32
+
+// What an epoll event is for, kept in the top half of its data
+enum {
+    EV_STDIN = 1,
+    EV_SIGNAL,
+    EV_TIMER,
+    EV_JOB_OUTPUT
+};
+
+typedef struct {
+    int fd;             // -1 for a free slot
+    bool repeat;
+    void (*fn)(void *ctx);
+    void *ctx;
+} Timer;
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static bool loop_failed = false;
+static Timer timers[EVENT_MAX_TIMERS];
+static bool timers_ready = false;
+
+static char *line_result;
+static bool line_done;
+static bool in_line = false;
+
+static uint64_t event_tag(int kind, int value) {
+    return ((uint64_t)kind << 32) | (uint32_t)value;
+}
+
+static bool watch(int fd, int kind, int value) {
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.u64 = event_tag(kind, value);
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0 || errno == EEXIST;
+}
+
+static void unwatch(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static void timers_init(void) {
+    if (timers_ready) return;
+    for (int i = 0; i < EVENT_MAX_TIMERS; i++) timers[i].fd = -1;
+    timers_ready = true;
+}
+
+// Sets up the epoll set on first use. Returns false if the loop cannot be
+// used, for example when stdin is a regular file, which epoll refuses.
+static bool loop_init(void) {
+    if (epoll_fd >= 0) return true;
+    if (loop_failed) return false;
+    timers_init();
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGWINCH);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd >= 0) {
+        signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
+    if (epoll_fd < 0 || signal_fd < 0 ||
+        !watch(STDIN_FILENO, EV_STDIN, 0) || !watch(signal_fd, EV_SIGNAL, 0)) {
+        if (signal_fd >= 0) close(signal_fd);
+        if (epoll_fd >= 0) close(epoll_fd);
+        signal_fd = epoll_fd = -1;
+        loop_failed = true;
+        return false;
+    }
+    for (int i = 0; i < EVENT_MAX_TIMERS; i++) {
+        if (timers[i].fd >= 0) watch(timers[i].fd, EV_TIMER, i);
+    }
+    // Window size changes come through the signalfd
+    rl_catch_sigwinch = 0;
+    job_output_closing = unwatch;
+    return true;
+}
+
+int event_timer_add(int interval_ms, bool repeat, void (*fn)(void *ctx), void *ctx) {
+    timers_init();
+    int slot = -1;
+    for (int i = 0; i < EVENT_MAX_TIMERS && slot < 0; i++) {
+        if (timers[i].fd < 0) slot = i;
+    }
+    if (slot < 0 || interval_ms <= 0) return -1;
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) return -1;
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = interval_ms / 1000;
+    spec.it_value.tv_nsec = (long)(interval_ms % 1000) * 1000000L;
+    if (repeat) spec.it_interval = spec.it_value;
+    if (timerfd_settime(fd, 0, &spec, NULL) != 0) {
+        close(fd);
+        return -1;
+    }
+    timers[slot] = (Timer){ .fd = fd, .repeat = repeat, .fn = fn, .ctx = ctx };
+    if (epoll_fd >= 0) watch(fd, EV_TIMER, slot);
+    return slot;
+}
+
+void event_timer_remove(int id) {
+    if (id < 0 || id >= EVENT_MAX_TIMERS || timers[id].fd < 0) return;
+    if (epoll_fd >= 0) unwatch(timers[id].fd);
+    close(timers[id].fd);
+    timers[id].fd = -1;
+}
+
+static void run_timer(int id) {
+    Timer *timer = &timers[id];
+    uint64_t expirations;
+    if (timer->fd < 0 || read(timer->fd, &expirations, sizeof(expirations)) <= 0) {
+        return;
+    }
+    // A timer that expired several times while commands ran fires once
+    void (*fn)(void *) = timer->fn;
+    void *ctx = timer->ctx;
+    if (!timer->repeat) event_timer_remove(id);
+    fn(ctx);
+}
+
+void event_print_above(void (*fn)(void *ctx), void *ctx) {
+    if (!in_line) {
+        fn(ctx);
+        fflush(stdout);
+        return;
+    }
+    if (highlight_enabled) {
+        highlight_clear();
+    } else {
+        rl_clear_visible_line();
+    }
+    fn(ctx);
+    fflush(stdout);
+    rl_on_new_line();
+    (*rl_redisplay_function)();
+}
+
+static void report_jobs(void *ctx) {
+    (void)ctx;
+    reap_jobs(true);
+}
+
+// Announces jobs that finished or stopped since the prompt was drawn.
+// Queued jobs may start in the slots they free, so their output pipes are
+// watched too.
+static void notify_jobs(void) {
+    // Notices wait while the finder covers the prompt
+    if (jobs_changed() && !finder_active()) {
+        event_print_above(report_jobs, NULL);
+        int fds[MAX_JOBS];
+        int nfds = job_output_fds(fds, MAX_JOBS);
+        for (int i = 0; i < nfds; i++) {
+            watch(fds[i], EV_JOB_OUTPUT, fds[i]);
+        }
+    }
+}
+
+static void read_signals(void) {
+    struct signalfd_siginfo info;
+    bool child = false, winch = false;
+    while (read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+        if (info.ssi_signo == SIGCHLD) child = true;
+        if (info.ssi_signo == SIGWINCH) winch = true;
+    }
+    if (child) notify_jobs();
+    if (winch) {
+        if (finder_active()) {
+            rl_reset_screen_size();
+            finder_draw();
+        } else if (highlight_enabled) {
+            rl_reset_screen_size();
+            highlight_redisplay();
+        } else {
+            rl_resize_terminal();
+        }
+    }
+}
+
+static void line_handler(char *line) {
+    // Readline prints the newline after an accepted line only when it drew
+    // the line itself
+    if (highlight_enabled) highlight_finish();
+    line_result = line;
+    line_done = true;
+    rl_callback_handler_remove();
+}
+
+char *event_readline(const char *prompt) {
+    if (!loop_init()) {
+        return readline(prompt);
+    }
+
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigaddset(&block, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &block, &old);
+
+    // Jobs only start while the prompt is up from notify_jobs(), which
+    // watches their pipes
+    int fds[MAX_JOBS];
+    int nfds = job_output_fds(fds, MAX_JOBS);
+    for (int i = 0; i < nfds; i++) {
+        watch(fds[i], EV_JOB_OUTPUT, fds[i]);
+    }
+
+    line_result = NULL;
+    line_done = false;
+    in_line = true;
+    rl_redisplay_function = highlight_enabled ? highlight_redisplay : rl_redisplay;
+    rl_callback_handler_install(prompt, line_handler);
+
+    while (!line_done) {
+        struct epoll_event events[EVENT_BATCH];
+        int n = epoll_wait(epoll_fd, events, EVENT_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("ash: epoll_wait");
+            rl_callback_handler_remove();
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            int kind = (int)(events[i].data.u64 >> 32);
+            int value = (int)(uint32_t)events[i].data.u64;
+            switch (kind) {
+            case EV_STDIN:
+                if (finder_active()) {
+                    finder_input();
+                    if (!finder_active()) notify_jobs();
+                } else if (!line_done) {
+                    rl_callback_read_char();
+                    // A key that opened the finder: draw it over the
+                    // line readline just redrew
+                    if (finder_active()) finder_draw();
+                }
+                break;
+            case EV_SIGNAL:
+                read_signals();
+                break;
+            case EV_TIMER:
+                run_timer(value);
+                break;
+            case EV_JOB_OUTPUT:
+                job_output_ready(value);
+                break;
+            }
+        }
+    }
+
+    in_line = false;
+    nfds = job_output_fds(fds, MAX_JOBS);
+    for (int i = 0; i < nfds; i++) {
+        unwatch(fds[i]);
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return line_result;
+}
@@ -1,134 +1,747 @@
 // executor.c - Implements the logic for executing a parsed command list.
+// Handles builtins, pipelines, redirection, separators and background jobs.
+
+#define _GNU_SOURCE
 
-#include "../include/executor.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <readline/history.h>
+
+#include "../include/executor.h"
+#include "../include/builtins.h"
+#include "../include/vars.h"
+#include "../include/jobs.h"
+#include "../include/parallel.h"
+#include "../include/usage.h"
+#include "../include/trace.h"
+#include "../include/redirect.h"
+#include "../include/expand.h"
+#include "../include/arith.h"
+#include "../include/source.h"
+#include "../include/functions.h"
+#include "../include/frecency.h"
+
+// Names of the built-in commands, NULL-terminated.
+const char *const builtin_names[] = {
+    "cd", "exit", "history", "help", "clear", "version", "status", "jobs",
+    "fg", "bg", "parallel", "exec", "let", "source", "local", "return",
+    "wait", "kill", "joblimit", "z", ".", NULL
+};
+
+// Checks if a command is a built-in.
+bool is_builtin(const char *cmd) {
+    for (int i = 0; builtin_names[i]; i++) {
+        if (strcmp(cmd, builtin_names[i]) == 0) return true;
+    }
+    return false;
+}
 
 /**
- * @brief Executes a single command.
- * @param cmd The Command structure to execute.
+ * @brief Replaces the shell with an external command, for `exec cmd` and
+ * the last command of a script.
+ *
+ * SIGINT and the job control signals, which the interactive shell ignores,
+ * are reset first since an ignored disposition survives execve(). Only
+ * returns if the command could not be run, with the status a failed command
+ * gets (127 if it was not found); a non-interactive shell exits with it
+ * instead, as POSIX requires.
  */
-void execute_single_command(Command *cmd) {
-    // Check for built-in commands like 'exit'
-    if (strcmp(cmd->argv[0], "exit") == 0) {
-        // Handle exit built-in
-        exit(0);
+static int exec_command(char **argv) {
+    fflush(stdout);
+    fflush(stderr);
+    TRACE_INSTANT("exec", argv[0]);
+    TRACE_FLUSH();
+    void (*old_sigint)(int) = signal(SIGINT, SIG_DFL);
+    job_signals(false);
+    execvp(argv[0], argv);
+    int err = errno;
+    fprintf(stderr, "ash: exec: %s: %s\n", argv[0], strerror(err));
+    signal(SIGINT, old_sigint);
+    job_signals(job_control);
+    return err == ENOENT ? 127 : 126;
+}
+
+// Ends a non-interactive shell after an error that POSIX makes fatal there.
+// Queued jobs start first, as at the end of a script; _exit() leaves stdio
+// streams shared with a parent shell alone.
+static void exit_shell(int status) {
+    drain_job_queue();
+    fflush(stdout);
+    fflush(stderr);
+    TRACE_FLUSH();
+    _exit(status);
+}
+
+// Functions and builtins run inside the shell process rather than through
+// exec.
+static bool runs_in_shell(const char *name) {
+    return is_builtin(name) || find_function(name) != NULL;
+}
+
+// Executes a built-in command or function with optional I/O redirection.
+int execute_builtin(Command *cmd, int input_fd, int output_fd) {
+    int status = 0;
+    RedirSave save = { .count = 0 };
+
+    // `exec` changes the shell's own descriptors for good and, given a
+    // command, replaces the shell with it.
+    if (strcmp(cmd->argv.v[0], "exec") == 0) {
+        if (apply_redirections(cmd->redirs, NULL) != 0) {
+            return 1;
+        }
+        if (cmd->argv.v[1] == NULL) return 0;
+        status = exec_command(cmd->argv.v + 1);
+        if (!shell_interactive) exit_shell(status);
+        return status;
+    }
+
+    int saved_stdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+
+    if (input_fd != STDIN_FILENO) {
+        dup2(input_fd, STDIN_FILENO);
+        close(input_fd);
+    }
+    if (output_fd != STDOUT_FILENO) {
+        dup2(output_fd, STDOUT_FILENO);
+        close(output_fd);
+    }
+    if (apply_redirections(cmd->redirs, &save) != 0) {
+        status = 1;
+        goto restore;
     }
     
-    // Check for I/O redirection and set up file descriptors
-    if (cmd->redir_in) {
-        int fd_in = open(cmd->redir_in, O_RDONLY);
-        if (fd_in == -1) {
-            perror("ash: open input file");
-            exit(1);
+    // Execute the function or built-in based on the command name
+    FuncDef *func = find_function(cmd->argv.v[0]);
+    if (func) {
+        status = call_function(func, cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "cd") == 0) {
+        handle_cd(cmd->argv.v[1]);
+    } else if (strcmp(cmd->argv.v[0], "exit") == 0) {
+        // Exit from the shell
+        free_command(cmd);
+        exit(0);
+    } else if (strcmp(cmd->argv.v[0], "history") == 0) {
+        HIST_ENTRY **hist = history_list();
+        if (hist) {
+            for (int i = 0; hist[i]; ++i) {
+                printf("%d  %s\n", i + history_base, hist[i]->line);
+            }
         }
-        dup2(fd_in, STDIN_FILENO);
-        close(fd_in);
+    } else if (strcmp(cmd->argv.v[0], "help") == 0) {
+        builtin_help();
+    } else if (strcmp(cmd->argv.v[0], "clear") == 0) {
+        printf("\033[2J\033[H");
+    } else if (strcmp(cmd->argv.v[0], "version") == 0) {
+        printf("ash shell version 1.0\n");
+    } else if (strcmp(cmd->argv.v[0], "status") == 0) {
+        builtin_status();
+    } else if (strcmp(cmd->argv.v[0], "jobs") == 0) {
+        status = builtin_jobs(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "fg") == 0) {
+        status = builtin_fg(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "bg") == 0) {
+        status = builtin_bg(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "kill") == 0) {
+        status = builtin_kill(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "wait") == 0) {
+        status = builtin_wait(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "joblimit") == 0) {
+        status = builtin_joblimit(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "z") == 0) {
+        status = builtin_z(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "parallel") == 0) {
+        status = builtin_parallel(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "let") == 0) {
+        status = builtin_let(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "source") == 0 || strcmp(cmd->argv.v[0], ".") == 0) {
+        status = builtin_source(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "local") == 0) {
+        status = builtin_local(cmd->argv.v);
+    } else if (strcmp(cmd->argv.v[0], "return") == 0) {
+        status = builtin_return(cmd->argv.v);
     }
+
+restore:
+    // Restore original file descriptors; stdio buffers still belong to the
+    // redirected ones.
+    fflush(stdout);
+    fflush(stderr);
+    restore_redirections(&save);
+    dup2(saved_stdin, STDIN_FILENO);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdin);
+    close(saved_stdout);
     
-    if (cmd->redir_out) {
-        int fd_out = open(cmd->redir_out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (fd_out == -1) {
-            perror("ash: open output file");
-            exit(1);
+    return status;
+}
+
+// Bytes an argument occupies in the kernel's ARG_MAX accounting
+static size_t arg_cost(const char *arg) {
+    return strlen(arg) + 1 + sizeof(char *);
+}
+
+// Runs the command xargs-style after exec failed with E2BIG: the command
+// name and its leading options are repeated in front of as many of the
+// remaining arguments as fit the limit. Exits with the worst batch status.
+static void exec_in_batches(Command *cmd) {
+    extern char **environ;
+    char **argv = cmd->argv.v;
+    int argc = cmd->argv.count;
+
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max <= 0) {
+        arg_max = 128 * 1024;
+    }
+    size_t budget = (size_t)arg_max;
+    size_t used = 4096;  // headroom for the auxiliary vector and exec path
+    for (char **env = environ; *env; env++) {
+        used += arg_cost(*env);
+    }
+
+    // The command name and its options up to (and including) "--"
+    int fixed = 1;
+    while (fixed < argc && argv[fixed][0] == '-') {
+        used += arg_cost(argv[fixed]);
+        if (strcmp(argv[fixed++], "--") == 0) {
+            break;
         }
-        dup2(fd_out, STDOUT_FILENO);
-        close(fd_out);
     }
-    
-    // Execute the command using execvp
-    execvp(cmd->argv[0], cmd->argv);
-    
-    // If execvp returns, an error occurred
-    perror("ash: command not found");
-    exit(1);
+    used += arg_cost(argv[0]);
+    if (used >= budget) {
+        fprintf(stderr, "ash: %s: environment too large to split arguments\n", argv[0]);
+        _exit(126);
+    }
+
+    char **batch = malloc((size_t)(argc + 1) * sizeof(char *));
+    if (!batch) {
+        perror("ash: malloc");
+        _exit(1);
+    }
+    memcpy(batch, argv, (size_t)fixed * sizeof(char *));
+
+    int worst = 0;
+    int next = fixed;
+    while (next < argc) {
+        size_t size = used;
+        int n = fixed;
+        // Every batch takes at least one argument so a lone oversized one
+        // is reported by exec rather than looping forever
+        do {
+            size += arg_cost(argv[next]);
+            batch[n++] = argv[next++];
+        } while (next < argc && size + arg_cost(argv[next]) <= budget);
+        batch[n] = NULL;
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("ash: fork");
+            _exit(1);
+        }
+        if (pid == 0) {
+            execvp(batch[0], batch);
+            perror("ash");
+            _exit(errno == ENOENT ? 127 : 126);
+        }
+
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        if (code > worst) {
+            worst = code;
+        }
+    }
+    _exit(worst);
 }
 
-/**
- * @brief Executes a list of commands, handling pipes and separators.
- * @param cmd_list The head of the Command linked list.
- * @return The exit status of the last executed command.
- */
-int execute_commands(Command *cmd_list) {
-    if (!cmd_list || !cmd_list->argv[0]) {
-        return 0; // No commands to execute
+// Applies the command's own redirections and replaces the current (child)
+// process with it. Never returns.
+void exec_child(Command *cmd) {
+    if (apply_redirections(cmd->redirs, NULL) != 0) {
+        _exit(1);
     }
+
+    // Executing the command
+    TRACE_INSTANT("exec", cmd->argv.v[0]);
+    TRACE_FLUSH();
+    execvp(cmd->argv.v[0], cmd->argv.v);
+    if (errno == E2BIG) {
+        const char *split = get_variable("ASH_SPLIT_ARGS");
+        if (split && *split && strcmp(split, "0") != 0) {
+            exec_in_batches(cmd);
+        }
+        fprintf(stderr, "ash: %s: argument list too long (set ASH_SPLIT_ARGS=1 to run it in batches)\n",
+                cmd->argv.v[0]);
+        _exit(126);
+    }
+    perror("ash");
+    _exit(1);
+}
+
+// Runs a builtin inside the shell process and accounts its CPU time.
+static int run_builtin_in_process(Command *cmd, int input_fd, int output_fd) {
+    struct rusage before, after;
+    TRACE_BEGIN_DETAIL("builtin", cmd->argv.v[0]);
+    getrusage(RUSAGE_SELF, &before);
+    int status = execute_builtin(cmd, input_fd, output_fd);
+    getrusage(RUSAGE_SELF, &after);
+    TRACE_END("builtin");
+
+    // The shell's peak RSS says nothing about the builtin, so it is left out
+    struct rusage delta = {0};
+    timersub(&after.ru_utime, &before.ru_utime, &delta.ru_utime);
+    timersub(&after.ru_stime, &before.ru_stime, &delta.ru_stime);
+    delta.ru_minflt = after.ru_minflt - before.ru_minflt;
+    delta.ru_majflt = after.ru_majflt - before.ru_majflt;
+    delta.ru_nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+    delta.ru_nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+    usage_add_rusage(&segment_usage, &delta);
+    return status;
+}
+
+// Waits for a foreground process like wait4(). While background jobs have
+// their output captured, their pipes are drained meanwhile so they do not
+// block on a full pipe; SIGCHLD stays blocked between the check and the
+// wait so the child's exit cannot be missed.
+static pid_t wait_foreground(pid_t pid, int *status, int options, struct rusage *ru) {
+    if (!job_output_active()) {
+        return wait4(pid, status, options, ru);
+    }
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    sigset_t mask = old;
+    sigdelset(&mask, SIGCHLD);
+    pid_t result;
+    while ((result = wait4(pid, status, options | WNOHANG, ru)) == 0) {
+        job_events_poll(-1, &mask);
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return result;
+}
+
+// Runs a pipeline segment, or with queued_id set, starts that queued job.
+// All stages are started before any of them is waited for, so a stage that
+// fills its pipe can never block the stages after it. Foreground stages are
+// reaped with wait4() and their resource usage is added to segment_usage.
+// Under job control the stages share a process group led by the first one,
+// which holds the terminal while a foreground pipeline runs; if it is
+// stopped from the terminal it becomes a stopped job.
+static int run_segment(Command *head, const char *original_input, int queued_id) {
+    Command *cmd = head;
+    int input_fd = STDIN_FILENO;
+    int last_status = 0;
+    bool background = false;
+    struct timespec t0, t1;
+
+    size_t stages = 0;
+    for (Command *c = head; c; c = (c->type == CMD_PIPE) ? c->next : NULL) {
+        if (c->type == CMD_BG) background = true;
+        stages++;
+    }
+
+    // A background job over the job limit waits in the job table, as
+    // parsed, until a slot frees
+    if (background && queued_id == 0 && job_must_queue()) {
+        if (queue_job(copy_pipeline(head), original_input) == 0) {
+            printf("[%d] queued\n", next_job_id - 1);
+        }
+        return 0;
+    }
+
+    // Expand every stage first, in order, so substitutions run before any
+    // stage of this pipeline starts. If one fails, none of them runs, and
+    // a script stops there.
+    for (Command *c = head; c; c = (c->type == CMD_PIPE) ? c->next : NULL) {
+        if (expand_command(c) != 0) {
+            if (!shell_interactive) exit_shell(1);
+            return 1;
+        }
+    }
+    pid_t *pids = malloc((stages ? stages : 1) * sizeof(pid_t));
+    if (!pids) {
+        perror("ash: memory allocation failed");
+        return -1;
+    }
+    size_t npids = 0;
+    pid_t pgid = 0;
+
+    // With ASH_JOB_OUTPUT set, the job's output goes to a pipe the shell
+    // drains into a buffer, rather than to the terminal
+    int capture[2] = { -1, -1 };
+    size_t capture_cap = background ? job_output_cap() : 0;
+    if (capture_cap > 0 && pipe2(capture, O_CLOEXEC) == -1) {
+        perror("ash: pipe");
+        capture[0] = capture[1] = -1;
+    }
+
+    // A queued job starting in the middle of another command is not part
+    // of its usage
+    if (queued_id == 0) usage_reset(&segment_usage);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
     
-    Command *current_cmd = cmd_list;
-    pid_t pid;
-    int status = 0;
-    int pipe_fd[2];
-    int prev_pipe_read_fd = STDIN_FILENO;
-    
-    while (current_cmd != NULL) {
-        bool is_pipe = (current_cmd->type == CMD_PIPE);
-        bool is_background = (current_cmd->type == CMD_BACKGROUND);
+    while (cmd) {
+        bool is_pipe = cmd->next && cmd->type == CMD_PIPE;
+
+        if (!cmd->argv.v[0]) {
+            // If the command is empty, just move to the next one
+            cmd = is_pipe ? cmd->next : NULL;
+            continue;
+        }
 
+        int pipe_fd[2];
+        
+        // If there's a next command AND it's a pipe, set up a new pipe
         if (is_pipe) {
-            if (pipe(pipe_fd) == -1) {
-                perror("ash: pipe failed");
-                return -1;
+            if (pipe2(pipe_fd, O_CLOEXEC) == -1) {
+                perror("ash: pipe");
+                break;
             }
         }
         
-        pid = fork();
-        if (pid == -1) {
+        // A builtin at the end of a pipeline runs in the main process so that
+        // `cd` and friends affect the shell. Earlier stages are forked like
+        // any other command, otherwise their output could fill the pipe
+        // before the reader exists. So is every stage of a queued job, which
+        // starts at whatever point a slot frees.
+        if (runs_in_shell(cmd->argv.v[0]) && !is_pipe && queued_id == 0) {
+            last_status = run_builtin_in_process(cmd, input_fd, STDOUT_FILENO);
+            input_fd = STDIN_FILENO;
+            cmd = NULL;
+            continue;
+        }
+
+        TRACE_BEGIN_DETAIL("fork", cmd->argv.v[0]);
+        pid_t pid = fork();
+        if (pid < 0) {
             perror("ash: fork failed");
-            return -1;
-        } else if (pid == 0) {
+            TRACE_END("fork");
+            break;
+        }
+        
+        if (pid == 0) {
             // Child process
-            
-            // Set up signal handling in child
+            TRACE_AFTER_FORK();
             signal(SIGINT, SIG_DFL);
-            signal(SIGQUIT, SIG_DFL);
+            job_setpgid(0, pgid, !background, true);
+            if (queued_id) {
+                // Queued jobs may start while the shell blocks these
+                sigset_t unblock;
+                sigemptyset(&unblock);
+                sigaddset(&unblock, SIGCHLD);
+                sigaddset(&unblock, SIGWINCH);
+                sigprocmask(SIG_UNBLOCK, &unblock, NULL);
+            }
             
-            // Handle piping from previous command
-            if (prev_pipe_read_fd != STDIN_FILENO) {
-                dup2(prev_pipe_read_fd, STDIN_FILENO);
-                close(prev_pipe_read_fd);
+            // Redirect input if necessary
+            if (input_fd != STDIN_FILENO) {
+                dup2(input_fd, STDIN_FILENO);
+                close(input_fd);
             }
             
-            // Handle piping to next command
+            if (capture[1] >= 0) {
+                dup2(capture[1], STDERR_FILENO);
+                if (!is_pipe) dup2(capture[1], STDOUT_FILENO);
+                close(capture[0]);
+                close(capture[1]);
+            }
+
+            // Redirect output if this is not the last command in the pipeline
             if (is_pipe) {
-                close(pipe_fd[0]); // Close read end of the pipe
+                close(pipe_fd[0]);
                 dup2(pipe_fd[1], STDOUT_FILENO);
                 close(pipe_fd[1]);
             }
-            
-            // Execute the single command
-            execute_single_command(current_cmd);
-        } else {
-            // Parent process
-            
-            // Close the previous read end of the pipe
-            if (prev_pipe_read_fd != STDIN_FILENO) {
-                close(prev_pipe_read_fd);
+
+            if (runs_in_shell(cmd->argv.v[0])) {
+                job_table_clear();
+                int status = execute_builtin(cmd, STDIN_FILENO, STDOUT_FILENO);
+                fflush(stdout);
+                TRACE_FLUSH();
+                _exit(status);
             }
-            
-            if (is_pipe) {
-                close(pipe_fd[1]); // Close write end of the pipe
-                prev_pipe_read_fd = pipe_fd[0];
-            } else {
-                // If not a pipe, close any remaining pipe
-                prev_pipe_read_fd = STDIN_FILENO;
+            exec_child(cmd);
+        }
+
+        // Parent process
+        TRACE_END("fork");
+        pids[npids++] = pid;
+        job_setpgid(pid, pgid, !background, false);
+        if (job_control && pgid == 0) {
+            pgid = pid;
+            if (!background) job_terminal(pgid);
+        }
+        if (input_fd != STDIN_FILENO) {
+            close(input_fd);
+            input_fd = STDIN_FILENO;
+        }
+        if (is_pipe) {
+            close(pipe_fd[1]);
+            input_fd = pipe_fd[0];
+        }
+        cmd = is_pipe ? cmd->next : NULL;
+    }
+
+    if (input_fd != STDIN_FILENO) {
+        close(input_fd);
+    }
+
+    if (capture[1] >= 0) {
+        close(capture[1]);
+    }
+
+    if (background && npids > 0) {
+        int job_id = queued_id;
+        if (queued_id) {
+            job_started(queued_id, pids, (int)npids, pgid);
+        } else if (add_job(pids, (int)npids, pgid, original_input) == 0) {
+            job_id = next_job_id - 1;
+            printf("[%d] %d\n", job_id, pids[npids - 1]);
+        }
+        if (job_id && capture[0] >= 0) {
+            job_attach_output(job_id, capture[0], capture_cap);
+            capture[0] = -1;
+        }
+    } else if (npids > 0) {
+        TRACE_BEGIN("wait");
+        for (size_t i = 0; i < npids; i++) {
+            int status;
+            struct rusage ru;
+            if (wait_foreground(pids[i], &status, job_control ? WUNTRACED : 0, &ru) < 0) continue;
+            if (WIFSTOPPED(status)) {
+                // Ctrl-Z: this stage and the ones after it become a job
+                add_stopped_job(pids + i, (int)(npids - i), pgid, original_input);
+                last_status = 128 + WSTOPSIG(status);
+                break;
             }
-            
-            if (!is_background) {
-                waitpid(pid, &status, 0);
+            usage_add_rusage(&segment_usage, &ru);
+            if (i == npids - 1) {
+                last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
             }
         }
-        
-        current_cmd = current_cmd->next;
+        job_terminal(0);
+        TRACE_END("wait");
+    }
+    if (capture[0] >= 0) {
+        close(capture[0]);
+    }
+    free(pids);
+
+    if (queued_id == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        segment_usage.wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        segment_usage.status = last_status;
+        usage_add(&line_usage, &segment_usage);
     }
     
-    // Clean up any remaining pipes
-    if (prev_pipe_read_fd != STDIN_FILENO) {
-        close(prev_pipe_read_fd);
+    return last_status;
+}
+
+// Executes a single pipeline segment (one or more commands connected by '|').
+int execute_segment(Command *head, const char *original_input) {
+    // Between commands is a safe point to start jobs that waited for a slot
+    start_queued_jobs();
+    return run_segment(head, original_input, 0);
+}
+
+/**
+ * @brief Expands and forks a job that waited in the queue for a slot, for
+ * the job table.
+ * @return The status of the pipeline if nothing could be forked, else 0.
+ */
+int start_queued_job(Command *pipeline, int job_id) {
+    // Its builtins are forked too, and must not write the shell's buffered
+    // output a second time
+    fflush(stdout);
+    fflush(stderr);
+    return run_segment(pipeline, NULL, job_id);
+}
+
+// True for a word of the form NAME=value.
+static bool is_assignment(const char *word) {
+    if (!isalpha((unsigned char)*word) && *word != '_') return false;
+    while (isalnum((unsigned char)*word) || *word == '_') word++;
+    return *word == '=';
+}
+
+// Sets the shell and environment variable of a NAME=value word. Returns
+// false, leaving the variable alone, if the value fails to expand.
+static bool assign_word(const char *word) {
+    const char *eq = strchr(word, '=');
+    char *key = strndup(word, eq - word);
+    expand_failed();
+    char *expanded_value = expand_string(eq + 1);
+    bool ok = !expand_failed();
+    if (ok && key && expanded_value) {
+        set_variable(key, expanded_value);
+        setenv(key, expanded_value, 1);
+    }
+    free(expanded_value);
+    free(key);
+    return ok;
+}
+
+// Handles `NAME=value` and `export NAME=value` segments, which change the
+// shell itself, setting *status. Returns false if the segment is an
+// ordinary command.
+static bool run_assignment(Command *cmd, int *status) {
+    if (cmd->type == CMD_PIPE || cmd->words.v[0] == NULL) return false;
+    if (is_assignment(cmd->words.v[0]) && cmd->words.v[1] == NULL) {
+        *status = assign_word(cmd->words.v[0]) ? 0 : 1;
+        return true;
+    }
+    if (strcmp(cmd->words.v[0], "export") == 0) {
+        *status = 0;
+        for (int i = 1; cmd->words.v[i] != NULL; i++) {
+            if (is_assignment(cmd->words.v[i]) && !assign_word(cmd->words.v[i])) *status = 1;
+        }
+        return true;
+    }
+    return false;
+}
+
+// The main execution function that handles command separators.
+int execute_commands(Command *head, const char *original_input) {
+    int last_status = 0;
+    Command *current = head;
+
+    while (current) {
+        // `time pipeline` reports the resources of that pipeline on stderr.
+        // Only run_segment() fills them in, so what runs in the shell below
+        // starts from zero rather than the previous pipeline.
+        bool timed = current->timed;
+        if (timed) usage_reset(&segment_usage);
+
+        if (current->func) {
+            // Definitions are stored as parsed; nothing runs yet
+            define_function(current->func);
+            last_status = 0;
+        } else if (run_assignment(current, &last_status)) {
+            if (last_status != 0 && !shell_interactive) exit_shell(last_status);
+        } else if (current->type != CMD_PIPE && current->words.v[0] && !current->words.v[1] &&
+                   is_arith_command(current->words.v[0])) {
+            // ((expression)) is evaluated in the shell, before any expansion
+            last_status = run_arith_command(current->words.v[0]);
+        } else {
+            last_status = execute_segment(current, original_input);
+        }
+
+        if (timed) {
+            usage_print(stderr, &segment_usage);
+        }
+        if (function_returning()) {
+            break;
+        }
+        
+        // Move past the current pipeline segment
+        while(current && current->next && current->type == CMD_PIPE) {
+            current = current->next;
+        }
+
+        // Check logical operators
+        if (current && current->type == CMD_AND) {
+            if (last_status != 0) {
+                // Previous command failed, skip the next one
+                current = current->next;
+            }
+        } else if (current && current->type == CMD_OR) {
+            if (last_status == 0) {
+                // Previous command succeeded, skip the next one
+                current = current->next;
+            }
+        }
+        
+        if (current) {
+            current = current->next;
+        }
     }
     
-    return status;
+    return last_status;
+}
+
+/**
+ * @brief Runs a command list in a child process that exits afterwards.
+ *
+ * A lone external command replaces the child through exec instead of being
+ * forked once more; anything else goes through execute_commands().
+ */
+void execute_commands_and_exit(Command *head, const char *original_input) {
+    int status;
+    if (head->next == NULL && head->type == CMD_END && head->words.v[0] != NULL &&
+        !head->timed && strcmp(head->words.v[0], "export") != 0 &&
+        !is_assignment(head->words.v[0]) && !is_arith_command(head->words.v[0])) {
+        if (expand_command(head) != 0) _exit(1);
+        if (head->argv.v[0] == NULL) _exit(0);
+        if (!runs_in_shell(head->argv.v[0])) exec_child(head);
+        status = execute_builtin(head, STDIN_FILENO, STDOUT_FILENO);
+    } else {
+        status = execute_commands(head, original_input);
+        // Jobs the list queued would be lost with the process
+        drain_job_queue();
+    }
+    fflush(stdout);
+    fflush(stderr);
+    TRACE_FLUSH();
+    // _exit: a plain exit() would rewind stdio streams shared with the shell
+    // (such as the script being read) back to their buffered position.
+    _exit(status);
+}
+
+// Built-in functions
+void builtin_help(void) {
+    printf("\n\033[1;36mWelcome to ash!\033[0m\n\n");
+    printf("Features:\n");
+    printf("- Customizable prompt with Linux distro icon and current directory\n");
+    printf("- Git branch in prompt\n"); // Added this line
+    printf("- Tab completion for all executables in /bin, /usr/bin, ~/.local/bin, and custom paths via PATH+= in ~/.ashrc\n");
+    printf("- Tab completes directories after cd and files elsewhere, reusing each listing until the directory changes\n");
+    printf("- Tab after git checkout, switch, merge, log and the like completes branch and tag names\n");
+    printf("- Command history saved to ~/.ashhistory\n");
+    printf("- Built-in cd command; `z fragments...` jumps to the most frecent directory matching them (`z -l` lists)\n");
+    printf("- Command separators ('&&', '||', ';', '&')\n");
+    printf("- Ctrl+C only terminates running commands, not the shell\n");
+    printf("- Runs commands from ~/.ashrc at startup\n");
+    printf("- Basic variable assignment and substitution\n");
+    printf("- Command substitution with '$(command)' and backticks\n");
+    printf("- Integer arithmetic with '$((expr))', 'let expr' and '((expr))'\n");
+    printf("- Globbing with '*', '?', '[...]' and '**'\n");
+    printf("- Pipeline ('|') and I/O redirection ('<', '>', '>>', '<>', '&>') on any fd\n");
+    printf("- Descriptor duplication and closing ('2>&1', '3<&0', '>&-'); 'exec 3>file' keeps it open\n");
+    printf("- `exec cmd` replaces the shell; `ash -c 'cmds'` runs a command string\n");
+    printf("- Here-documents ('<<EOF', '<<-EOF') and here-strings ('<<< word')\n");
+    printf("- Job control with `jobs`, `fg`, `bg` and `kill %%job`; Ctrl-Z stops the whole pipeline\n");
+    printf("- `joblimit N [-a spread|pin] [-c cpus]` queues '&' jobs beyond N and places them on CPUs; `wait` drains them\n");
+    printf("- `ASH_JOB_OUTPUT=64K` keeps '&' job output in a buffer instead of the terminal; `jobs -o N` prints it\n");
+    printf("- `wait [-n] [%%job|pid...]` waits for jobs and returns their status; `-n` returns when any one finishes\n");
+    printf("- `parallel -j N [-k] cmd ::: args...` to fan a command out over N slots\n");
+    printf("- `source file` (or `. file`) runs a script in the current shell; parsed scripts are cached\n");
+    printf("- Functions: `name() { cmds; }` with $1.., $#, $@, `local` and `return`\n");
+    printf("- Syntax highlighting as you type; `syntax_highlight=false` in ~/.config/ash.conf turns it off\n");
+    printf("- Suggestions from history in grey; the right arrow accepts one (`autosuggest=false` to hide)\n");
+    printf("- Ctrl-R fuzzy-searches history, Ctrl-T fuzzy-completes the word at the cursor\n");
+    printf("- `time pipeline` and `status` report CPU, memory, faults and context switches\n");
+    printf("More features coming soon!\n");
+    printf("\nType 'exit' to quit.\n\n");
+}
+
+void builtin_status(void) {
+    printf("Last exit status: %d\n", last_usage.status);
+    printf("Last command time: %.3f seconds\n", last_usage.wall);
+    printf("CPU time: %.3fs user, %.3fs sys\n", last_usage.user, last_usage.sys);
+    printf("Max RSS: %ld KB\n", last_usage.max_rss_kb);
+    printf("Page faults: %ld major, %ld minor\n", last_usage.major_faults, last_usage.minor_faults);
+    printf("Context switches: %ld voluntary, %ld involuntary\n",
+           last_usage.voluntary_switches, last_usage.involuntary_switches);
 }
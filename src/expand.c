@@ -0,0 +1,617 @@
+// expand.c - Word expansion for ash shell
+// Commands keep their words exactly as typed; expand_command() turns them
+// into argv right before the command runs, so expansions see the effects of
+// the commands before them on the same line. Handles quote removal, $NAME,
+// ${NAME}, $0, the positional parameters $1.., $#, $@ and $*, arithmetic
+// with $((...)) and command substitution with $(...) and backticks. Results
+// of unquoted expansions are split into fields on blanks, quoted ones never
+// are. Fields with unquoted '*', '?' or '[...]' then go through pathname
+// expansion (pathglob.c).
+//
+// A substitution runs through the shell's own parser and executor. Builtins
+// that only print run in the shell with stdout sent to a memfd; everything
+// else runs in a forked child whose output is read from a pipe.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../include/expand.h"
+#include "../include/arith.h"
+#include "../include/pathglob.h"
+#include "../include/executor.h"
+#include "../include/vars.h"
+#include "../include/functions.h"
+#include "../include/jobs.h"
+#include "../include/trace.h"
+
+#define SUBST_READ_CHUNK 65536
+#define SUBST_PIPE_SIZE (1 << 20)
+
+// A growable, NUL-terminated string.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+// State of one word expansion.
+typedef struct {
+    StrBuf cur;           // The field being built
+    StrBuf pat;           // The same field as a glob pattern, quoted chars escaped
+    bool have_field;      // The current field exists even if empty ("" or '')
+    bool glob;            // The field has unquoted glob characters
+    ArgVec *fields;       // Output fields, or NULL to never split or glob
+    int count;            // Fields added by this expansion
+    DirCache **dircache;  // Listings shared by the words of one command
+} Expander;
+
+// Makes room for extra more bytes plus the terminating NUL.
+static void sb_reserve(StrBuf *sb, size_t extra) {
+    if (sb->len + extra + 1 <= sb->cap) return;
+    size_t cap = sb->cap ? sb->cap : 64;
+    while (cap < sb->len + extra + 1) cap *= 2;
+    char *data = realloc(sb->data, cap);
+    if (!data) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    sb->data = data;
+    sb->cap = cap;
+}
+
+static void sb_append(StrBuf *sb, const char *s, size_t n) {
+    sb_reserve(sb, n);
+    memcpy(sb->data + sb->len, s, n);
+    sb->len += n;
+    sb->data[sb->len] = '\0';
+}
+
+static void sb_putc(StrBuf *sb, char c) {
+    sb_reserve(sb, 1);
+    sb->data[sb->len++] = c;
+    sb->data[sb->len] = '\0';
+}
+
+// Returns the string, leaving the buffer empty.
+static char *sb_take(StrBuf *sb) {
+    sb_reserve(sb, 0);
+    sb->data[sb->len] = '\0';
+    char *data = sb->data;
+    sb->data = NULL;
+    sb->len = sb->cap = 0;
+    return data;
+}
+
+// Reads fd to EOF with large reads straight into the buffer's free space.
+static void read_all(int fd, StrBuf *out) {
+    for (;;) {
+        sb_reserve(out, SUBST_READ_CHUNK);
+        ssize_t n = read(fd, out->data + out->len, out->cap - out->len - 1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("ash: command substitution");
+            break;
+        }
+        if (n == 0) break;
+        out->len += (size_t)n;
+    }
+    sb_reserve(out, 0);
+    out->data[out->len] = '\0';
+}
+
+// Appends one character to the current field. Quoted characters are
+// escaped in the pattern so they never act as glob characters.
+static void ex_putc(Expander *ex, char c, bool quoted) {
+    sb_putc(&ex->cur, c);
+    if (!ex->fields) return;
+    if (c == '*' || c == '?' || c == '[') {
+        if (quoted) {
+            sb_putc(&ex->pat, '\\');
+        } else {
+            ex->glob = true;
+        }
+    } else if (c == '\\') {
+        sb_putc(&ex->pat, '\\');
+    }
+    sb_putc(&ex->pat, c);
+}
+
+static void ex_append(Expander *ex, const char *s, size_t n, bool quoted) {
+    if (!ex->fields) {
+        sb_append(&ex->cur, s, n);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) ex_putc(ex, s[i], quoted);
+}
+
+// Adds one finished field.
+static void add_field(Expander *ex, char *field) {
+    argv_push(ex->fields, field);
+    ex->count++;
+}
+
+// Ends the current field and adds it to the output. A field with unquoted
+// glob characters is replaced by the matching paths, if there are any.
+static void emit_field(Expander *ex) {
+    if (ex->cur.len == 0 && !ex->have_field) return;
+    char **matches = NULL;
+    int n = 0;
+    if (ex->glob && has_glob_chars(ex->pat.data)) {
+        if (*ex->dircache == NULL) *ex->dircache = dircache_new();
+        n = pathglob(ex->pat.data, *ex->dircache, &matches);
+    }
+    if (n > 0) {
+        for (int i = 0; i < n; i++) add_field(ex, matches[i]);
+        free(matches);
+        free(sb_take(&ex->cur));
+    } else {
+        add_field(ex, sb_take(&ex->cur));
+    }
+    ex->pat.len = 0;
+    ex->have_field = false;
+    ex->glob = false;
+}
+
+// Appends an expansion result; unquoted results are split into fields.
+static void add_expansion(Expander *ex, const char *value, bool quoted) {
+    if (quoted || !ex->fields) {
+        ex_append(ex, value, strlen(value), quoted);
+        return;
+    }
+    for (const char *p = value; *p; p++) {
+        if (*p == ' ' || *p == '\t' || *p == '\n') {
+            emit_field(ex);
+        } else {
+            ex_putc(ex, *p, false);
+        }
+    }
+}
+
+// Runs a command substitution and appends its output.
+static void add_substitution(Expander *ex, const char *text, size_t len, bool quoted) {
+    char *inner = strndup(text, len);
+    if (!inner) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    char *output = command_substitute(inner);
+    add_expansion(ex, output, quoted);
+    free(output);
+    free(inner);
+}
+
+// Set when an arithmetic expansion fails; see expand_failed().
+static bool arith_failed = false;
+
+// Evaluates an arithmetic expansion and appends its value. A failure was
+// reported by arith_eval() and is remembered for expand_failed().
+static void add_arithmetic(Expander *ex, const char *text, size_t len, bool quoted) {
+    char *inner = strndup(text, len);
+    if (!inner) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    // Variables and substitutions inside are expanded first, as in $((x + $(f)))
+    char *expanded = strpbrk(inner, "$`") ? expand_variables(inner) : NULL;
+    long long value;
+    if (arith_eval(expanded ? expanded : inner, &value) == 0) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%lld", value);
+        add_expansion(ex, buf, quoted);
+    } else {
+        arith_failed = true;
+    }
+    free(expanded);
+    free(inner);
+}
+
+// Appends the positional parameters for $@ and $*. "$@" gives one field
+// per parameter (none at all without parameters); "$*" joins them with
+// spaces. Unquoted, both split every parameter on blanks.
+static void add_positionals(Expander *ex, bool separate, bool quoted) {
+    int count = positional_count();
+    if (quoted && separate && count == 0 && ex->cur.len == 0) {
+        ex->have_field = false;
+    }
+    for (int i = 1; i <= count; i++) {
+        if (i > 1) {
+            if ((separate || !quoted) && ex->fields) {
+                emit_field(ex);
+                ex->have_field = quoted;
+            } else {
+                ex_putc(ex, ' ', quoted);
+            }
+        }
+        add_expansion(ex, positional(i), quoted);
+    }
+}
+
+// Expands the '$' construct at p and returns the position after it.
+static const char *expand_dollar(Expander *ex, const char *p, bool quoted) {
+    if (p[1] == '(' && p[2] == '(') {
+        const char *end = skip_substitution(p);
+        if (end - p >= 5 && end[-1] == ')' && end[-2] == ')') {
+            add_arithmetic(ex, p + 3, (size_t)(end - p) - 5, quoted);
+            return end;
+        }
+        // Not "$((...))" but a substitution starting with a subshell
+    }
+    if (p[1] == '(') {
+        const char *end = skip_substitution(p);
+        size_t len = (size_t)(end - p) - 2;
+        if (end[-1] == ')') len--; // Unterminated: take the rest as is
+        add_substitution(ex, p + 2, len, quoted);
+        return end;
+    }
+    if (p[1] == '0') {
+        if (shell_name) add_expansion(ex, shell_name, quoted);
+        return p + 2;
+    }
+    if (p[1] == '@' || p[1] == '*') {
+        add_positionals(ex, p[1] == '@', quoted);
+        return p + 2;
+    }
+    if (p[1] == '!') {
+        // Pid of the last background job
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", (int)last_background_pid);
+        if (last_background_pid > 0) add_expansion(ex, buf, quoted);
+        return p + 2;
+    }
+    if (p[1] == '#') {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", positional_count());
+        add_expansion(ex, buf, quoted);
+        return p + 2;
+    }
+    if (isdigit((unsigned char)p[1])) {
+        // $1..$9; later parameters need braces, as in ${10}
+        const char *value = positional(p[1] - '0');
+        if (value) add_expansion(ex, value, quoted);
+        return p + 2;
+    }
+
+    bool braced = p[1] == '{';
+    const char *name = p + 1 + braced;
+    const char *end = name;
+    while (isalnum((unsigned char)*end) || *end == '_') end++;
+    if (end == name || (braced && *end != '}')) {
+        // If there's a '$' but no variable name, just copy the '$'
+        ex_putc(ex, '$', quoted);
+        return p + 1;
+    }
+    char var_name[256];
+    size_t len = (size_t)(end - name);
+    if (len >= sizeof(var_name)) len = sizeof(var_name) - 1;
+    memcpy(var_name, name, len);
+    var_name[len] = '\0';
+    const char *value;
+    if (isdigit((unsigned char)var_name[0])) {
+        value = positional(atoi(var_name));
+    } else {
+        value = getenv(var_name);
+    }
+    if (value) add_expansion(ex, value, quoted);
+    return braced ? end + 1 : end;
+}
+
+// Expands the backtick substitution at p and returns the position after it.
+// Inside backticks a backslash only escapes '$', '`' and '\'.
+static const char *expand_backtick(Expander *ex, const char *p, bool quoted) {
+    const char *end = skip_substitution(p);
+    const char *stop = (end > p + 1 && end[-1] == '`') ? end - 1 : end;
+    StrBuf inner = {0};
+    sb_reserve(&inner, (size_t)(stop - p));
+    for (const char *q = p + 1; q < stop; q++) {
+        if (*q == '\\' && q + 1 < stop && strchr("$`\\", q[1])) q++;
+        sb_putc(&inner, *q);
+    }
+    add_substitution(ex, inner.data, inner.len, quoted);
+    free(inner.data);
+    return end;
+}
+
+// Expands the inside of a double-quoted string; returns the position after
+// the closing quote.
+static const char *expand_double_quoted(Expander *ex, const char *p) {
+    while (*p && *p != '"') {
+        if (*p == '\\' && p[1] && strchr("$`\"\\", p[1])) {
+            ex_putc(ex, p[1], true);
+            p += 2;
+        } else if (*p == '$') {
+            p = expand_dollar(ex, p, true);
+        } else if (*p == '`') {
+            p = expand_backtick(ex, p, true);
+        } else {
+            ex_putc(ex, *p++, true);
+        }
+    }
+    return *p ? p + 1 : p;
+}
+
+/**
+ * @brief Runs the expansions of a word or text into ex.
+ * @param remove_quotes True for command words: quotes are removed and single
+ *        quotes suppress expansion. False for here-document text, where
+ *        quotes are literal and a backslash only escapes '$', '`' and '\'.
+ */
+static void expand_into(Expander *ex, const char *p, bool remove_quotes) {
+    while (*p) {
+        if (remove_quotes && *p == '\'') {
+            const char *close = strchr(p + 1, '\'');
+            if (!close) close = p + strlen(p);
+            ex_append(ex, p + 1, (size_t)(close - p - 1), true);
+            ex->have_field = true;
+            p = *close ? close + 1 : close;
+        } else if (remove_quotes && *p == '"') {
+            ex->have_field = true;
+            p = expand_double_quoted(ex, p + 1);
+        } else if (*p == '\\' && p[1]) {
+            if (!remove_quotes && !strchr("$`\\", p[1])) ex_putc(ex, '\\', true);
+            ex_putc(ex, p[1], true);
+            p += 2;
+        } else if (*p == '$') {
+            p = expand_dollar(ex, p, false);
+        } else if (*p == '`') {
+            p = expand_backtick(ex, p, false);
+        } else {
+            ex_putc(ex, *p++, false);
+        }
+    }
+}
+
+/**
+ * @brief Expands variables and command substitutions in free text.
+ *
+ * Used for here-document bodies: quotes are kept as they are and the result
+ * is never split.
+ *
+ * @param text The text to expand.
+ * @return A newly allocated string with the expansions done.
+ */
+char *expand_variables(const char *text) {
+    // If the text has nothing to expand, just return a copy.
+    if (!text || !strpbrk(text, "$`\\")) {
+        return text ? strdup(text) : NULL;
+    }
+    TRACE_BEGIN("expand");
+    Expander ex = {0};
+    expand_into(&ex, text, false);
+    TRACE_END("expand");
+    return sb_take(&ex.cur);
+}
+
+/**
+ * @brief Expands a word into exactly one string, without field splitting.
+ *
+ * Used for assignments, redirection targets and here-strings.
+ *
+ * @param word The word as typed.
+ * @return A newly allocated string with quotes removed and expansions done.
+ */
+char *expand_string(const char *word) {
+    if (!strpbrk(word, "$`'\"\\")) {
+        return strdup(word);
+    }
+    TRACE_BEGIN("expand");
+    Expander ex = {0};
+    expand_into(&ex, word, true);
+    TRACE_END("expand");
+    return sb_take(&ex.cur);
+}
+
+/**
+ * @brief Expands a word into fields.
+ *
+ * Unquoted expansion results are split on blanks, so one word can produce
+ * no fields ($EMPTY) or several ($(ls)). A field with unquoted glob
+ * characters is replaced by the sorted paths it matches, if any.
+ *
+ * @param word The word as typed.
+ * @param fields Receives the newly allocated fields.
+ * @param dircache Directory listings shared by the words of one command;
+ *        created on first use, freed by the caller with dircache_free().
+ * @return The number of fields added.
+ */
+int expand_word(const char *word, ArgVec *fields, DirCache **dircache) {
+    bool plain = !strpbrk(word, "$`'\"\\");
+    if (plain && !has_glob_chars(word)) {
+        char *copy = strdup(word);
+        if (!copy) {
+            perror("ash: memory allocation failed");
+            exit(1);
+        }
+        argv_push(fields, copy);
+        return 1;
+    }
+    TRACE_BEGIN("expand");
+    Expander ex = { .fields = fields, .dircache = dircache };
+    if (plain) {
+        // Nothing to expand or unquote; the word is its own pattern
+        sb_append(&ex.cur, word, strlen(word));
+        sb_append(&ex.pat, word, strlen(word));
+        ex.glob = true;
+    } else {
+        expand_into(&ex, word, true);
+    }
+    emit_field(&ex);
+    free(ex.cur.data);
+    free(ex.pat.data);
+    TRACE_END("expand");
+    return ex.count;
+}
+
+/**
+ * @brief Tells whether an expansion failed since the last call, as when an
+ * arithmetic expansion divides by zero, and forgets it.
+ *
+ * The error was already reported; the command it belongs to must not run.
+ */
+bool expand_failed(void) {
+    bool failed = arith_failed;
+    arith_failed = false;
+    return failed;
+}
+
+/**
+ * @brief Expands a command's words into argv and its redirection targets.
+ *
+ * Called each time the command is about to run; the results of an earlier
+ * run are replaced.
+ *
+ * @param cmd The command to expand (only this one, not cmd->next).
+ * @return 0, or -1 if an expansion failed and the command must not run.
+ */
+int expand_command(Command *cmd) {
+    expand_failed();
+    argv_clear(&cmd->argv);
+    DirCache *dircache = NULL;
+    for (int i = 0; i < cmd->words.count; i++) {
+        expand_word(cmd->words.v[i], &cmd->argv, &dircache);
+    }
+    dircache_free(dircache);
+
+    for (Redir *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+        if (redir->word == NULL) continue;
+        if (redir->kind == REDIR_OPEN) {
+            free(redir->path);
+            redir->path = expand_string(redir->word);
+        } else if (redir->kind == REDIR_HEREDOC) {
+            free(redir->body);
+            redir->body = redir->expand ? expand_variables(redir->word) : strdup(redir->word);
+            redir->body_len = redir->body ? strlen(redir->body) : 0;
+        } else if (redir->kind == REDIR_HERESTRING) {
+            // A here-string gets a trailing newline, like a one-line here-document
+            char *value = expand_string(redir->word);
+            size_t len = strlen(value);
+            free(redir->body);
+            redir->body = realloc(value, len + 2);
+            if (redir->body == NULL) {
+                perror("ash: memory allocation failed");
+                exit(1);
+            }
+            redir->body[len] = '\n';
+            redir->body[len + 1] = '\0';
+            redir->body_len = len + 1;
+        }
+    }
+    return expand_failed() ? -1 : 0;
+}
+
+// Builtins that only print, so running them inside the shell has no side
+// effects a subshell would have hidden.
+static bool is_capturable_builtin(const char *name) {
+    return strcmp(name, "help") == 0 ||
+           strcmp(name, "version") == 0 ||
+           strcmp(name, "status") == 0 ||
+           strcmp(name, "jobs") == 0 ||
+           strcmp(name, "history") == 0;
+}
+
+// Runs a lone builtin in the shell with stdout going to a memfd.
+static bool capture_builtin(Command *cmd, StrBuf *out) {
+    int fd = memfd_create("ash-subst", MFD_CLOEXEC);
+    if (fd < 0) return false;
+    int out_fd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    if (out_fd < 0) {
+        close(fd);
+        return false;
+    }
+    fflush(stdout);
+    if (expand_command(cmd) == 0) {
+        execute_builtin(cmd, STDIN_FILENO, out_fd); // Takes ownership of out_fd
+    } else {
+        close(out_fd);
+    }
+    lseek(fd, 0, SEEK_SET);
+    read_all(fd, out);
+    close(fd);
+    return true;
+}
+
+// Runs a command list in a child with stdout going to a pipe.
+static void capture_child(Command *cmd, const char *text, StrBuf *out) {
+    int pipe_fd[2];
+    if (pipe2(pipe_fd, O_CLOEXEC) == -1) {
+        perror("ash: pipe");
+        return;
+    }
+    // A bigger pipe means fewer wakeups for large outputs; best effort.
+    fcntl(pipe_fd[1], F_SETPIPE_SZ, SUBST_PIPE_SIZE);
+
+    // Pending output would otherwise be flushed by both processes.
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("ash: fork failed");
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+        return;
+    }
+    if (pid == 0) {
+        TRACE_AFTER_FORK();
+        signal(SIGINT, SIG_DFL);
+        // Commands of the substitution belong to the caller's job; they
+        // neither take the terminal nor keep the shell's ignored signals
+        job_signals(false);
+        job_control = false;
+        job_table_clear();
+        close(pipe_fd[0]);
+        dup2(pipe_fd[1], STDOUT_FILENO);
+        close(pipe_fd[1]);
+        execute_commands_and_exit(cmd, text);
+    }
+
+    close(pipe_fd[1]);
+    read_all(pipe_fd[0], out);
+    close(pipe_fd[0]);
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        // Interrupted by SIGCHLD from a background job; wait again
+    }
+}
+
+/**
+ * @brief Runs a command substitution and returns its output.
+ *
+ * The text is parsed and executed like a command line of its own, so
+ * pipelines, separators and nested substitutions all work. Trailing
+ * newlines are removed from the output.
+ *
+ * @param text The command inside $(...) or backticks.
+ * @return A newly allocated string with the command's output.
+ */
+char *command_substitute(const char *text) {
+    StrBuf out = {0};
+    TRACE_BEGIN_DETAIL("subst", text);
+    TokenList tokens = tokenize(text);
+    Command *cmd = parse_command(&tokens);
+    if (cmd) {
+        bool captured = false;
+        if (cmd->next == NULL && cmd->redirs == NULL && cmd->words.count > 0 &&
+            is_capturable_builtin(cmd->words.v[0])) {
+            captured = capture_builtin(cmd, &out);
+        }
+        if (!captured) {
+            capture_child(cmd, text, &out);
+        }
+        free_command(cmd);
+    }
+    free_tokens(&tokens);
+    TRACE_END("subst");
+
+    while (out.len > 0 && out.data[out.len - 1] == '\n') out.len--;
+    return sb_take(&out);
+}
@@ -0,0 +1,414 @@
+// finder.c - Fuzzy finder for history and completions
+// Ctrl-R opens the finder over every distinct history line, with the line
+// being edited as the starting query; Ctrl-T opens it over the commands or
+// file names that could complete the word at the cursor. The finder takes
+// the place of the prompt: a query line, a count of matches, and the best
+// matches with the matched characters marked. Enter puts the selected match
+// on the line, Esc or Ctrl-G leaves the line as it was.
+//
+// The finder runs inside the prompt's event loop, which passes it the raw
+// keys while it is open, so jobs keep being reaped and captured output
+// drained; their notices wait until it closes.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+
+#include "../include/ash.h"
+#include "../include/complete.h"
+#include "../include/finder.h"
+#include "../include/fuzzy.h"
+#include "../include/highlight.h"
+#include "../include/trace.h"
+
+#define FINDER_RESULTS 100
+#define FINDER_ROWS 10
+#define FINDER_QUERY_MAX 256
+
+#define FINDER_LABEL_COLOR "\033[1;38;5;81m"
+#define FINDER_COUNT_COLOR "\033[0;38;5;244m"
+#define FINDER_HIT_ON "\033[1;38;5;220m"
+#define FINDER_HIT_OFF "\033[22;39m"
+#define FINDER_SELECTED "\033[48;5;236m"
+
+enum { FIND_HISTORY, FIND_COMPLETION };
+
+static FuzzyIndex *history_index = NULL;
+static FuzzyIndex *completion_index = NULL;
+static FuzzyIndex *searched = NULL; // The one being searched
+
+static bool active = false;
+static bool shown = false;
+static int mode;
+static char query[FINDER_QUERY_MAX];
+static size_t query_len = 0;
+
+static FuzzyMatch results[FINDER_RESULTS];
+static size_t nresults = 0, found = 0, selected = 0, top = 0;
+static int replace_start = 0; // Where a completion goes in the line
+
+static bool *hit = NULL;
+static size_t hit_cap = 0;
+static char *out = NULL;
+static size_t out_len = 0, out_cap = 0;
+
+static void out_append(const char *s, size_t n) {
+    if (out_len + n > out_cap) {
+        size_t cap = out_cap ? out_cap : 4096;
+        while (cap < out_len + n) cap *= 2;
+        char *grown = realloc(out, cap);
+        if (grown == NULL) return;
+        out = grown;
+        out_cap = cap;
+    }
+    memcpy(out + out_len, s, n);
+    out_len += n;
+}
+
+static void out_str(const char *s) {
+    out_append(s, strlen(s));
+}
+
+static void search(void) {
+    query[query_len] = '\0';
+    TRACE_BEGIN_DETAIL("finder_search", query);
+    nresults = fuzzy_search(searched, query, results, FINDER_RESULTS, &found);
+    selected = top = 0;
+    TRACE_END("finder_search");
+}
+
+// Appends s[0..len) in at most width columns, with hits marked. Control
+// characters are shown as blanks.
+static void draw_text(const char *s, size_t len, const bool *marks, int width) {
+    mbstate_t mbs;
+    memset(&mbs, 0, sizeof(mbs));
+    bool on = false;
+    int col = 0;
+    for (size_t p = 0; p < len; ) {
+        wchar_t wc;
+        size_t n = mbrtowc(&wc, s + p, len - p, &mbs);
+        if (n == (size_t)-1 || n == (size_t)-2 || n == 0) {
+            memset(&mbs, 0, sizeof(mbs));
+            n = 1;
+            wc = (unsigned char)s[p];
+        }
+        bool control = (unsigned char)s[p] < 0x20 || s[p] == 0x7f;
+        int w = control ? 1 : wcwidth(wc);
+        if (w < 0) w = 1;
+        if (col + w > width) break;
+        if (marks[p] != on) {
+            on = marks[p];
+            out_str(on ? FINDER_HIT_ON : FINDER_HIT_OFF);
+        }
+        if (control) {
+            out_append(" ", 1);
+        } else {
+            out_append(s + p, n);
+        }
+        col += w;
+        p += n;
+    }
+    if (on) out_str(FINDER_HIT_OFF);
+}
+
+// Width of s on screen.
+static int text_width(const char *s, size_t len) {
+    mbstate_t mbs;
+    memset(&mbs, 0, sizeof(mbs));
+    int width = 0;
+    for (size_t p = 0; p < len; ) {
+        wchar_t wc;
+        size_t n = mbrtowc(&wc, s + p, len - p, &mbs);
+        if (n == (size_t)-1 || n == (size_t)-2 || n == 0) {
+            memset(&mbs, 0, sizeof(mbs));
+            n = 1;
+            wc = (unsigned char)s[p];
+        }
+        int w = wcwidth(wc);
+        width += w < 0 ? 1 : w;
+        p += n;
+    }
+    return width;
+}
+
+void finder_draw(void) {
+    if (!active) return;
+    if (!shown) {
+        // Take the prompt and line off the screen; the finder goes there
+        if (highlight_enabled) {
+            highlight_clear();
+        } else {
+            rl_clear_visible_line();
+        }
+        shown = true;
+    }
+    int rows, cols;
+    rl_get_screen_size(&rows, &cols);
+    if (cols <= 0) cols = 80;
+    if (rows <= 0) rows = 24;
+
+    out_len = 0;
+    const char *label = mode == FIND_HISTORY ? "history> " : "complete> ";
+    out_str("\r\033[J" FINDER_LABEL_COLOR);
+    out_str(label);
+    out_str("\033[0m");
+    // Only the end of a long query is shown, so the line never wraps
+    int room = cols - (int)strlen(label) - 1;
+    size_t from = 0;
+    while (from < query_len && text_width(query + from, query_len - from) > room) {
+        from++;
+        while (from < query_len && ((unsigned char)query[from] & 0xc0) == 0x80) from++;
+    }
+    out_append(query + from, query_len - from);
+    int query_col = (int)strlen(label) + text_width(query + from, query_len - from);
+
+    char count[64];
+    snprintf(count, sizeof(count), "\r\n" FINDER_COUNT_COLOR "  %zu/%zu\033[0m", found, fuzzy_size(searched));
+    out_str(count);
+
+    int visible = rows - 3 < FINDER_ROWS ? rows - 3 : FINDER_ROWS;
+    if (visible < 1) visible = 1;
+    if ((int)nresults < visible) visible = (int)nresults;
+    if (selected < top) top = selected;
+    if (selected >= top + (size_t)visible) top = selected - (size_t)visible + 1;
+    for (int r = 0; r < visible; r++) {
+        size_t k = top + (size_t)r;
+        size_t len;
+        const char *text = fuzzy_text(searched, results[k].index, &len);
+        if (len > hit_cap) {
+            bool *grown = realloc(hit, len);
+            if (grown == NULL) break;
+            hit = grown;
+            hit_cap = len;
+        }
+        fuzzy_positions(searched, results[k].index, query, hit);
+        out_str("\r\n");
+        if (k == selected) {
+            out_str(FINDER_SELECTED FINDER_LABEL_COLOR "> \033[22;39m");
+        } else {
+            out_str("  ");
+        }
+        draw_text(text, len, hit, cols - 3);
+        // Fills the rest of the selected row with its background
+        out_str("\033[K\033[0m");
+    }
+    snprintf(count, sizeof(count), "\033[%dA\r", visible + 1);
+    out_str(count);
+    if (query_col > 0) {
+        snprintf(count, sizeof(count), "\033[%dC", query_col);
+        out_str(count);
+    }
+    FILE *stream = rl_outstream ? rl_outstream : stdout;
+    fwrite(out, 1, out_len, stream);
+    fflush(stream);
+}
+
+static void finder_close(bool accept) {
+    FILE *stream = rl_outstream ? rl_outstream : stdout;
+    if (shown) {
+        fputs("\r\033[J", stream);
+        fflush(stream);
+    }
+    if (accept && nresults > 0) {
+        size_t len;
+        const char *text = fuzzy_text(searched, results[selected].index, &len);
+        char *choice = strndup(text, len);
+        if (choice && mode == FIND_HISTORY) {
+            rl_replace_line(choice, 0);
+            rl_point = rl_end;
+        } else if (choice) {
+            rl_delete_text(replace_start, rl_point);
+            rl_point = replace_start;
+            rl_insert_text(choice);
+            if (len > 0 && choice[len - 1] != '/') rl_insert_text(" ");
+        }
+        free(choice);
+    }
+    active = shown = false;
+    fuzzy_free(completion_index);
+    completion_index = NULL;
+    rl_on_new_line();
+    (*rl_redisplay_function)();
+}
+
+static void finder_open(FuzzyIndex *target, int how, const char *initial, size_t len) {
+    searched = target;
+    mode = how;
+    if (len >= FINDER_QUERY_MAX) len = FINDER_QUERY_MAX - 1;
+    memcpy(query, initial, len);
+    query_len = len;
+    active = true;
+    shown = false;
+    search();
+}
+
+static int find_history(int count, int key) {
+    (void)count;
+    (void)key;
+    if (history_index == NULL) return 0;
+    finder_open(history_index, FIND_HISTORY, rl_line_buffer, (size_t)rl_end);
+    return 0;
+}
+
+static void add_entry(const char *entry, bool is_dir, void *ctx) {
+    (void)ctx;
+    char name[ASH_MAX_PATH];
+    int len = snprintf(name, sizeof(name), "%s%s", entry, is_dir ? "/" : "");
+    if (len > 0 && len < (int)sizeof(name)) fuzzy_add(completion_index, name, (size_t)len);
+}
+
+static int find_completion(int count, int key) {
+    (void)count;
+    (void)key;
+    int start = rl_point;
+    while (start > 0 && !isspace((unsigned char)rl_line_buffer[start - 1])) start--;
+    // A command name comes first on the line or after an operator
+    int before = start;
+    while (before > 0 && isspace((unsigned char)rl_line_buffer[before - 1])) before--;
+    bool command = before == 0 || strchr("|&;(", rl_line_buffer[before - 1]);
+
+    char word[ASH_MAX_PATH];
+    int len = rl_point - start;
+    if (len >= (int)sizeof(word)) return 0;
+    memcpy(word, rl_line_buffer + start, (size_t)len);
+    word[len] = '\0';
+    char *slash = strrchr(word, '/');
+
+    completion_index = fuzzy_create(true);
+    if (completion_index == NULL) return 0;
+    if (command && slash == NULL) {
+        for (size_t i = 0; i < commands_count; i++) {
+            fuzzy_add(completion_index, commands[i], strlen(commands[i]));
+        }
+        for (int i = 0; i < alias_count; i++) {
+            fuzzy_add(completion_index, aliases[i], strlen(aliases[i]));
+        }
+        replace_start = start;
+        finder_open(completion_index, FIND_COMPLETION, word, (size_t)len);
+        return 0;
+    }
+    char dir[ASH_MAX_PATH] = "";
+    const char *base = word;
+    if (slash) {
+        const char *home = getenv("HOME");
+        if (word[0] == '~' && word[1] == '/' && home) {
+            snprintf(dir, sizeof(dir), "%s%.*s", home, (int)(slash - word), word + 1);
+            strncat(dir, "/", sizeof(dir) - strlen(dir) - 1);
+        } else {
+            snprintf(dir, sizeof(dir), "%.*s", (int)(slash - word) + 1, word);
+        }
+        base = slash + 1;
+    }
+    complete_dir_entries(dir, "", base[0] == '.' ? COMPLETE_HIDDEN : 0, add_entry, NULL);
+    replace_start = start + (int)(base - word);
+    finder_open(completion_index, FIND_COMPLETION, base, strlen(base));
+    return 0;
+}
+
+bool finder_active(void) {
+    return active;
+}
+
+void finder_input(void) {
+    char buf[256];
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n <= 0) {
+        finder_close(false);
+        return;
+    }
+    bool changed = false;
+    for (ssize_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)buf[i];
+        if (c == '\033') {
+            if (i + 1 < n && (buf[i + 1] == '[' || buf[i + 1] == 'O')) {
+                // Arrow keys, possibly with modifiers as in \033[1;5A
+                ssize_t j = i + 2;
+                while (j < n && (isdigit((unsigned char)buf[j]) || buf[j] == ';')) j++;
+                if (j < n && buf[j] == 'A' && selected > 0) selected--;
+                if (j < n && buf[j] == 'B' && selected + 1 < nresults) selected++;
+                i = j;
+                continue;
+            }
+            finder_close(false);
+            return;
+        }
+        switch (c) {
+        case '\r':
+        case '\n':
+        case '\t':
+            finder_close(true);
+            return;
+        case CTRL('G'):
+        case CTRL('C'):
+        case CTRL('D'):
+            finder_close(false);
+            return;
+        case CTRL('P'):
+            if (selected > 0) selected--;
+            break;
+        case CTRL('N'):
+        case CTRL('R'):
+        case CTRL('T'):
+            if (selected + 1 < nresults) selected++;
+            break;
+        case CTRL('U'):
+            query_len = 0;
+            changed = true;
+            break;
+        case CTRL('W'):
+            while (query_len > 0 && query[query_len - 1] == ' ') query_len--;
+            while (query_len > 0 && query[query_len - 1] != ' ') query_len--;
+            changed = true;
+            break;
+        case 0x7f:
+        case '\b':
+            while (query_len > 0 && ((unsigned char)query[query_len - 1] & 0xc0) == 0x80) query_len--;
+            if (query_len > 0) query_len--;
+            changed = true;
+            break;
+        default:
+            if (c >= 0x20 && query_len + 1 < FINDER_QUERY_MAX) {
+                query[query_len++] = (char)c;
+                changed = true;
+            }
+        }
+    }
+    if (changed) search();
+    finder_draw();
+}
+
+void finder_init(void) {
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) return;
+    TRACE_BEGIN("finder_index");
+    history_index = fuzzy_create(true);
+    HIST_ENTRY **hist = history_list();
+    for (int i = 0; history_index && hist && hist[i]; i++) {
+        fuzzy_add(history_index, hist[i]->line, strlen(hist[i]->line));
+    }
+    rl_bind_key(CTRL('R'), find_history);
+    rl_bind_key(CTRL('T'), find_completion);
+    TRACE_END("finder_index");
+}
+
+void finder_add(const char *line) {
+    if (history_index) fuzzy_add(history_index, line, strlen(line));
+}
+
+void finder_free(void) {
+    fuzzy_free(history_index);
+    fuzzy_free(completion_index);
+    history_index = completion_index = NULL;
+    free(hit);
+    free(out);
+    hit = NULL;
+    out = NULL;
+    hit_cap = out_cap = out_len = 0;
+}
@@ -0,0 +1,439 @@
+// frecency.c - Directory frecency index and the z builtin for ash shell
+// ~/.ashdirs holds one record per directory cd has entered: a rank that
+// grows by one on each visit, the time of the last visit, and the path.
+// The file is mapped shared, so a repeat visit, the usual case, updates
+// its record in place without a system call and every running shell sees
+// it. A new directory is appended under flock(). Once the ranks add up to
+// more than FRECENCY_MAX_TOTAL they are all scaled down and directories
+// left below one are dropped, by writing a new file and renaming it over
+// the old one; other shells notice the new inode and map it instead.
+//
+// A query is one pass over the records, which sit back to back in the
+// mapping, weighing each matching rank by how recent the last visit was.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../include/ash.h"
+#include "../include/frecency.h"
+
+#define FRECENCY_MAGIC "ASHZ"
+#define FRECENCY_VERSION 1
+#define FRECENCY_MAX_TOTAL 10000.0
+#define FRECENCY_HOUR 3600
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t reserved;
+} DirsHeader;
+
+typedef struct {
+    double rank;   // 0 once removed
+    int64_t last;  // Time of the last visit
+    uint32_t len;  // Bytes of the path, not counting its NUL
+    uint32_t size; // Bytes of the whole record, a multiple of 8
+    char path[];
+} DirsRecord;
+
+typedef struct {
+    double score;
+    const char *path;
+} DirsMatch;
+
+static char dirs_path[ASH_MAX_PATH];
+static char home[ASH_MAX_PATH];
+static int dirs_fd = -1;
+static char *map = NULL;
+static size_t map_size = 0; // Bytes mapped
+static size_t map_end = 0;  // End of the last whole record
+static dev_t map_dev;
+static ino_t map_ino;
+static double total = 0;    // Sum of the ranks
+static bool ready = false;
+
+#define FOR_EACH_RECORD(rec) \
+    for (DirsRecord *rec = (DirsRecord *)(map + sizeof(DirsHeader)); \
+         (char *)rec < map + map_end; rec = (DirsRecord *)((char *)rec + rec->size))
+
+static void unmap(void) {
+    if (map) munmap(map, map_size);
+    map = NULL;
+    map_size = map_end = 0;
+    map_ino = 0;
+}
+
+// Maps the open file at its current size, writing the header if it is
+// new. A record cut short by a crash ends the index.
+static bool remap(void) {
+    unmap();
+    struct stat st;
+    if (fstat(dirs_fd, &st) != 0) return false;
+    if (st.st_size == 0) {
+        DirsHeader header = { FRECENCY_MAGIC, FRECENCY_VERSION, 0 };
+        if (pwrite(dirs_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) return false;
+        st.st_size = sizeof(header);
+    }
+    if ((size_t)st.st_size < sizeof(DirsHeader)) return false;
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, dirs_fd, 0);
+    if (p == MAP_FAILED) return false;
+    map = p;
+    map_size = (size_t)st.st_size;
+    const DirsHeader *header = (const DirsHeader *)map;
+    if (memcmp(header->magic, FRECENCY_MAGIC, 4) != 0 || header->version != FRECENCY_VERSION) {
+        unmap();
+        return false;
+    }
+    map_dev = st.st_dev;
+    map_ino = st.st_ino;
+    total = 0;
+    size_t off = sizeof(DirsHeader);
+    while (off + sizeof(DirsRecord) <= map_size) {
+        const DirsRecord *rec = (const DirsRecord *)(map + off);
+        if (rec->size % 8 != 0 || rec->size < sizeof(DirsRecord) + rec->len + 1 ||
+            rec->size > map_size - off || rec->path[rec->len] != '\0') {
+            break;
+        }
+        total += rec->rank;
+        off += rec->size;
+    }
+    map_end = off;
+    return true;
+}
+
+static bool open_file(void) {
+    unmap();
+    if (dirs_fd >= 0) close(dirs_fd);
+    dirs_fd = open(dirs_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    return dirs_fd >= 0 && remap();
+}
+
+// Maps the file again if another shell has replaced or extended it.
+static bool refresh(void) {
+    struct stat st;
+    if (map && stat(dirs_path, &st) == 0 && st.st_dev == map_dev && st.st_ino == map_ino) {
+        return (size_t)st.st_size == map_size || remap();
+    }
+    return open_file();
+}
+
+// Takes the file lock, following the file if it is replaced meanwhile,
+// and maps it at its size once locked.
+static bool lock_file(void) {
+    for (;;) {
+        if (!refresh() || flock(dirs_fd, LOCK_EX) != 0) return false;
+        struct stat st;
+        if (stat(dirs_path, &st) == 0 && st.st_dev == map_dev && st.st_ino == map_ino) {
+            if ((size_t)st.st_size == map_size || remap()) return true;
+            flock(dirs_fd, LOCK_UN);
+            return false;
+        }
+        flock(dirs_fd, LOCK_UN);
+    }
+}
+
+static DirsRecord *find_record(const char *dir, size_t len) {
+    FOR_EACH_RECORD(rec) {
+        if (rec->len == len && memcmp(rec->path, dir, len) == 0) return rec;
+    }
+    return NULL;
+}
+
+// Scales the ranks down to 90% of the limit and drops the directories
+// left below one, in a new file that replaces the old one.
+static void age(void) {
+    if (!lock_file()) return;
+    char *buf = total > FRECENCY_MAX_TOTAL ? malloc(map_end) : NULL;
+    if (buf == NULL) {
+        flock(dirs_fd, LOCK_UN);
+        return;
+    }
+    double scale = 0.9 * FRECENCY_MAX_TOTAL / total;
+    memcpy(buf, map, sizeof(DirsHeader));
+    size_t n = sizeof(DirsHeader);
+    FOR_EACH_RECORD(rec) {
+        double rank = rec->rank * scale;
+        if (rank < 1) continue;
+        memcpy(buf + n, rec, rec->size);
+        ((DirsRecord *)(buf + n))->rank = rank;
+        n += rec->size;
+    }
+    char tmp[ASH_MAX_PATH + 16];
+    snprintf(tmp, sizeof(tmp), "%s.%d", dirs_path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    bool ok = fd >= 0 && write(fd, buf, n) == (ssize_t)n;
+    if (fd >= 0 && close(fd) != 0) ok = false;
+    if (!ok || rename(tmp, dirs_path) != 0) unlink(tmp);
+    free(buf);
+    flock(dirs_fd, LOCK_UN);
+    open_file();
+}
+
+static void append_record(const char *dir, size_t len, time_t now) {
+    uint32_t size = (uint32_t)((sizeof(DirsRecord) + len + 1 + 7) & ~(size_t)7);
+    DirsRecord *rec = calloc(1, size);
+    if (rec == NULL || !lock_file()) {
+        free(rec);
+        return;
+    }
+    // Another shell may have added it while this one waited
+    DirsRecord *found = find_record(dir, len);
+    if (found) {
+        found->rank += 1;
+        found->last = now;
+        total += 1;
+    } else {
+        rec->rank = 1;
+        rec->last = now;
+        rec->len = (uint32_t)len;
+        rec->size = size;
+        memcpy(rec->path, dir, len);
+        // Overwrites any torn record at the end
+        if ((map_end == map_size || ftruncate(dirs_fd, (off_t)map_end) == 0) &&
+            pwrite(dirs_fd, rec, size, (off_t)map_end) == (ssize_t)size) {
+            total += 1;
+        }
+    }
+    flock(dirs_fd, LOCK_UN);
+    free(rec);
+}
+
+void frecency_init(const char *homedir) {
+    snprintf(home, sizeof(home), "%s", homedir ? homedir : "");
+    snprintf(dirs_path, sizeof(dirs_path), "%s/.ashdirs", homedir ? homedir : ".");
+    ready = open_file();
+    if (!ready) fprintf(stderr, "ash: %s: cannot use as a directory index\n", dirs_path);
+}
+
+void frecency_free(void) {
+    unmap();
+    if (dirs_fd >= 0) close(dirs_fd);
+    dirs_fd = -1;
+    ready = false;
+}
+
+void frecency_add(const char *dir) {
+    char cwd[ASH_MAX_PATH];
+    if (!ready || (dir == NULL && (dir = getcwd(cwd, sizeof(cwd))) == NULL)) return;
+    // Home is only ever a `cd` away
+    if (strcmp(dir, home) == 0 || !refresh()) return;
+    size_t len = strlen(dir);
+    time_t now = time(NULL);
+    DirsRecord *rec = find_record(dir, len);
+    if (rec) {
+        rec->rank += 1;
+        rec->last = now;
+        total += 1;
+    } else {
+        append_record(dir, len, now);
+    }
+    if (total > FRECENCY_MAX_TOTAL) age();
+}
+
+static bool remove_dir(const char *dir) {
+    if (!ready || !refresh()) return false;
+    DirsRecord *rec = find_record(dir, strlen(dir));
+    if (rec == NULL) return false;
+    total -= rec->rank;
+    rec->rank = 0;
+    return true;
+}
+
+static double frecency(const DirsRecord *rec, time_t now) {
+    time_t age = now - (time_t)rec->last;
+    if (age < FRECENCY_HOUR) return rec->rank * 4;
+    if (age < 24 * FRECENCY_HOUR) return rec->rank * 2;
+    if (age < 7 * 24 * FRECENCY_HOUR) return rec->rank / 2;
+    return rec->rank / 4;
+}
+
+// Returns the offset of the first occurrence of frag in s at or after
+// from, or -1. With icase, frag is lowercase. Candidates are found with
+// memchr() on one byte of frag, so only those are compared: a byte
+// without case if frag has one, such as the digit in "repo17", else the
+// first byte, looked for in both cases with icase.
+static long find_fragment(const char *s, size_t len, size_t from, const char *frag, size_t flen, bool icase) {
+    if (flen == 0) return (long)from;
+    if (flen > len) return -1;
+    size_t a = 0;
+    if (icase) {
+        while (a < flen && frag[a] >= 'a' && frag[a] <= 'z') a++;
+        if (a == flen) a = 0;
+    }
+    char lower = frag[a];
+    char upper = icase && lower >= 'a' && lower <= 'z' ? (char)(lower - 32) : lower;
+    size_t stop = len - flen + 1; // One past the last possible start
+    for (size_t i = from; i < stop; i++) {
+        const char *p = memchr(s + i + a, lower, stop - i);
+        if (upper != lower) {
+            const char *q = memchr(s + i + a, upper, (p ? (size_t)(p - s) - a : stop) - i);
+            if (q) p = q;
+        }
+        if (p == NULL) return -1;
+        i = (size_t)(p - s) - a;
+        size_t k = 0;
+        if (icase) {
+            while (k < flen && (s[i + k] >= 'A' && s[i + k] <= 'Z' ? s[i + k] + 32 : s[i + k]) == frag[k]) k++;
+        } else {
+            while (k < flen && s[i + k] == frag[k]) k++;
+        }
+        if (k == flen) return (long)i;
+    }
+    return -1;
+}
+
+static bool path_matches(const DirsRecord *rec, char **fragments, const size_t *lens, int count, bool icase) {
+    if (count == 0) return true;
+    // The last fragment has to reach into the final component, which is
+    // short, so it is looked for first and rules out most directories
+    int last = count - 1;
+    const char *slash = memrchr(rec->path, '/', rec->len);
+    size_t base = slash ? (size_t)(slash - rec->path) + 1 : 0;
+    size_t tail = base + 1 > lens[last] ? base + 1 - lens[last] : 0;
+    long at = find_fragment(rec->path, rec->len, tail, fragments[last], lens[last], icase);
+    if (at < 0) return false;
+    size_t pos = 0;
+    for (int k = 0; k < last; k++) {
+        long found = find_fragment(rec->path, rec->len, pos, fragments[k], lens[k], icase);
+        if (found < 0) return false;
+        pos = (size_t)found + lens[k];
+    }
+    return (size_t)at >= pos || find_fragment(rec->path, rec->len, pos, fragments[last], lens[last], icase) >= 0;
+}
+
+// Collects the live directories matching the fragments, other than
+// exclude, into out if it is given, and returns the best one.
+static const DirsRecord *match_dirs(char **fragments, int count, const char *exclude, DirsMatch *out, size_t *nout) {
+    size_t lens[count > 0 ? count : 1];
+    bool icase = true;
+    for (int k = 0; k < count; k++) {
+        lens[k] = strlen(fragments[k]);
+        for (const char *c = fragments[k]; *c; c++) {
+            if (isupper((unsigned char)*c)) icase = false;
+        }
+    }
+    time_t now = time(NULL);
+    const DirsRecord *best = NULL;
+    double best_score = 0;
+    FOR_EACH_RECORD(rec) {
+        if (rec->rank <= 0 || !path_matches(rec, fragments, lens, count, icase)) continue;
+        if (exclude && strcmp(rec->path, exclude) == 0) continue;
+        double score = frecency(rec, now);
+        if (out) out[(*nout)++] = (DirsMatch){ score, rec->path };
+        if (score > best_score) {
+            best = rec;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+const char *frecency_best(char **fragments, int count, const char *exclude) {
+    if (!ready || !refresh()) return NULL;
+    const DirsRecord *best = match_dirs(fragments, count, exclude, NULL, NULL);
+    return best ? best->path : NULL;
+}
+
+static int by_score(const void *a, const void *b) {
+    double x = ((const DirsMatch *)a)->score, y = ((const DirsMatch *)b)->score;
+    return (x > y) - (x < y);
+}
+
+// Prints the matches with their scores, best last, next to the prompt.
+static int list_matches(char **fragments, int count) {
+    size_t n = 0;
+    DirsMatch *matches = malloc((map_end / sizeof(DirsRecord) + 1) * sizeof(DirsMatch));
+    if (matches == NULL) {
+        perror("ash: malloc");
+        return 1;
+    }
+    match_dirs(fragments, count, NULL, matches, &n);
+    qsort(matches, n, sizeof(DirsMatch), by_score);
+    for (size_t i = 0; i < n; i++) {
+        printf("%10.1f  %s\n", matches[i].score, matches[i].path);
+    }
+    free(matches);
+    return n > 0 ? 0 : 1;
+}
+
+/**
+ * @brief Runs `z [-l] [-x] [fragments...]`.
+ *
+ * Changes to the best-ranked directory matching the fragments, skipping
+ * the current one. A single argument naming a directory is entered as
+ * with cd. `-l` lists the matches instead, and `-x` drops the current
+ * directory from the index.
+ */
+int builtin_z(char **argv) {
+    bool list = false, remove = false;
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(argv[i], "-l") == 0) {
+            list = true;
+        } else if (strcmp(argv[i], "-x") == 0) {
+            remove = true;
+        } else {
+            fprintf(stderr, "z: usage: z [-l] [-x] [fragments...]\n");
+            return 2;
+        }
+    }
+    char **fragments = argv + i;
+    int count = 0;
+    while (fragments[count]) count++;
+
+    struct stat st;
+    if (!list && !remove && count == 1 && stat(fragments[0], &st) == 0 && S_ISDIR(st.st_mode)) {
+        return handle_cd(fragments[0]) == 0 ? 0 : 1;
+    }
+    if (!ready || !refresh()) {
+        fprintf(stderr, "z: no directory index\n");
+        return 1;
+    }
+    char cwd[ASH_MAX_PATH];
+    const char *here = getcwd(cwd, sizeof(cwd));
+    if (remove) {
+        if (here == NULL || !remove_dir(here)) {
+            fprintf(stderr, "z: current directory is not in the index\n");
+            return 1;
+        }
+        return 0;
+    }
+    if (list || count == 0) return list_matches(fragments, count);
+
+    for (;;) {
+        const char *best = frecency_best(fragments, count, here);
+        if (best == NULL) {
+            fprintf(stderr, "z: no match\n");
+            return 1;
+        }
+        char dir[ASH_MAX_PATH];
+        snprintf(dir, sizeof(dir), "%s", best);
+        int found = stat(dir, &st);
+        if (found == 0 && S_ISDIR(st.st_mode)) {
+            return handle_cd(dir) == 0 ? 0 : 1;
+        }
+        if (found != 0 && errno != ENOENT && errno != ENOTDIR) {
+            fprintf(stderr, "z: %s: %s\n", dir, strerror(errno));
+            return 1;
+        }
+        // Gone since the last visit
+        if (!remove_dir(dir)) return 1;
+    }
+}
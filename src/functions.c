@@ -0,0 +1,303 @@
+// functions.c - Shell functions, positional parameters and `local`
+// A definition such as `greet() { echo hi $1; }` is parsed once into a
+// FuncDef; running it stores the definition in a hash table keyed by name.
+// A call pushes a frame with the call's arguments as $1..$N and runs the
+// parsed body directly. Variables declared `local` in the call are saved in
+// the frame and put back when it is popped.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "../include/functions.h"
+#include "../include/executor.h"
+#include "../include/vars.h"
+#include "../include/trace.h"
+
+#define FUNC_BUCKETS 64
+#define FUNC_MAX_DEPTH 1000
+
+typedef struct FuncEntry {
+    FuncDef *def;
+    struct FuncEntry *next;
+} FuncEntry;
+
+// The value a `local` variable had before the call, restored when it returns.
+typedef struct {
+    char *name;
+    char *value; // NULL if the variable was unset
+} SavedVar;
+
+typedef struct Frame {
+    char **args;
+    int count;
+    bool function;   // A function call, as opposed to `source file args`
+    SavedVar *locals;
+    int nlocals;
+    int cap;
+    struct Frame *prev;
+} Frame;
+
+static FuncEntry *buckets[FUNC_BUCKETS];
+static Frame script_frame;
+static Frame *top = &script_frame;
+static int call_depth = 0;
+static int scope_depth = 0;
+static bool returning = false;
+static int return_status = 0;
+
+static unsigned hash_name(const char *name) {
+    unsigned h = 2166136261u;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    }
+    return h % FUNC_BUCKETS;
+}
+
+static char **copy_args(int count, char **args) {
+    char **copy = malloc((size_t)(count + 1) * sizeof(char *));
+    if (copy == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        copy[i] = strdup(args[i]);
+    }
+    copy[count] = NULL;
+    return copy;
+}
+
+static void free_args(char **args, int count) {
+    for (int i = 0; i < count; i++) {
+        free(args[i]);
+    }
+    free(args);
+}
+
+// Stores a definition, replacing any earlier one with the same name. The
+// table holds a reference, so the definition outlives the line it came from.
+void define_function(FuncDef *def) {
+    FuncEntry **slot = &buckets[hash_name(def->name)];
+    for (FuncEntry *e = *slot; e != NULL; e = e->next) {
+        if (strcmp(e->def->name, def->name) == 0) {
+            def->refs++;
+            funcdef_release(e->def);
+            e->def = def;
+            return;
+        }
+    }
+    FuncEntry *e = malloc(sizeof(FuncEntry));
+    if (e == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    def->refs++;
+    e->def = def;
+    e->next = *slot;
+    *slot = e;
+}
+
+FuncDef *find_function(const char *name) {
+    for (FuncEntry *e = buckets[hash_name(name)]; e != NULL; e = e->next) {
+        if (strcmp(e->def->name, name) == 0) {
+            return e->def;
+        }
+    }
+    return NULL;
+}
+
+void set_positional(int count, char **args) {
+    free_args(script_frame.args, script_frame.count);
+    script_frame.args = copy_args(count, args);
+    script_frame.count = count;
+}
+
+static void push_frame(int count, char **args, bool function) {
+    Frame *frame = calloc(1, sizeof(Frame));
+    if (frame == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    // Copied: the caller's argv belongs to a command that a recursive call
+    // expands again
+    frame->args = copy_args(count, args);
+    frame->count = count;
+    frame->function = function;
+    frame->prev = top;
+    top = frame;
+}
+
+void push_positional(int count, char **args) {
+    push_frame(count, args, false);
+}
+
+// Pops the innermost frame, restoring its local variables newest first.
+void pop_positional(void) {
+    Frame *frame = top;
+    if (frame == &script_frame) return;
+    for (int i = frame->nlocals - 1; i >= 0; i--) {
+        SavedVar *var = &frame->locals[i];
+        if (var->value) {
+            set_variable(var->name, var->value);
+            setenv(var->name, var->value, 1);
+        } else {
+            unset_variable(var->name);
+            unsetenv(var->name);
+        }
+        free(var->name);
+        free(var->value);
+    }
+    free(frame->locals);
+    free_args(frame->args, frame->count);
+    top = frame->prev;
+    free(frame);
+}
+
+int positional_count(void) {
+    return top->count;
+}
+
+const char *positional(int n) {
+    return (n >= 1 && n <= top->count) ? top->args[n - 1] : NULL;
+}
+
+void scope_enter(void) {
+    scope_depth++;
+}
+
+// Ends a function call or sourced file; a pending `return` sets the status.
+int scope_leave(int status) {
+    scope_depth--;
+    if (returning) {
+        returning = false;
+        status = return_status;
+    }
+    return status;
+}
+
+bool function_returning(void) {
+    return returning;
+}
+
+/**
+ * @brief Runs a function with argv[1..] as its positional parameters.
+ * @return The status of the last command run, or the value of `return`.
+ */
+int call_function(FuncDef *def, char **argv) {
+    if (call_depth >= FUNC_MAX_DEPTH) {
+        fprintf(stderr, "ash: %s: maximum function nesting level exceeded\n", def->name);
+        return 1;
+    }
+    int argc = 0;
+    while (argv[argc]) argc++;
+
+    TRACE_BEGIN_DETAIL("function", def->name);
+    // Held for the call: the body may redefine the function it is running
+    def->refs++;
+    push_frame(argc - 1, argv + 1, true);
+    call_depth++;
+    scope_enter();
+    int status = def->body ? execute_commands(def->body, def->name) : 0;
+    status = scope_leave(status);
+    call_depth--;
+    pop_positional();
+    funcdef_release(def);
+    TRACE_END("function");
+    return status;
+}
+
+// Remembers the current value of a variable in the innermost function call.
+static void save_local(Frame *frame, const char *name) {
+    if (frame->nlocals == frame->cap) {
+        frame->cap = frame->cap ? frame->cap * 2 : 4;
+        SavedVar *locals = realloc(frame->locals, (size_t)frame->cap * sizeof(SavedVar));
+        if (locals == NULL) {
+            perror("ash: memory allocation failed");
+            exit(1);
+        }
+        frame->locals = locals;
+    }
+    const char *value = getenv(name);
+    frame->locals[frame->nlocals].name = strdup(name);
+    frame->locals[frame->nlocals].value = value ? strdup(value) : NULL;
+    frame->nlocals++;
+}
+
+// Runs `local NAME[=value]...`: the variables get their old values back when
+// the function returns. A NAME without a value starts out unset.
+int builtin_local(char **argv) {
+    Frame *frame = top;
+    while (frame != &script_frame && !frame->function) frame = frame->prev;
+    if (frame == &script_frame) {
+        fprintf(stderr, "ash: local: can only be used in a function\n");
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = 1; argv[i]; i++) {
+        const char *eq = strchr(argv[i], '=');
+        size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        bool valid = len > 0 && (isalpha((unsigned char)argv[i][0]) || argv[i][0] == '_');
+        for (size_t k = 1; valid && k < len; k++) {
+            valid = isalnum((unsigned char)argv[i][k]) || argv[i][k] == '_';
+        }
+        if (!valid) {
+            fprintf(stderr, "ash: local: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+
+        char *name = strndup(argv[i], len);
+        save_local(frame, name);
+        if (eq) {
+            set_variable(name, eq + 1);
+            setenv(name, eq + 1, 1);
+        } else {
+            unset_variable(name);
+            unsetenv(name);
+        }
+        free(name);
+    }
+    return status;
+}
+
+// Runs `return [n]`; without n the status is 0.
+int builtin_return(char **argv) {
+    if (scope_depth == 0) {
+        fprintf(stderr, "ash: return: can only `return' from a function or sourced script\n");
+        return 1;
+    }
+    int status = 0;
+    if (argv[1]) {
+        char *end;
+        long value = strtol(argv[1], &end, 10);
+        if (*argv[1] == '\0' || *end != '\0') {
+            fprintf(stderr, "ash: return: %s: numeric argument required\n", argv[1]);
+            value = 2;
+        }
+        status = (int)(value & 0xff);
+    }
+    returning = true;
+    return_status = status;
+    return status;
+}
+
+void free_functions(void) {
+    for (int i = 0; i < FUNC_BUCKETS; i++) {
+        FuncEntry *e = buckets[i];
+        while (e != NULL) {
+            FuncEntry *next = e->next;
+            funcdef_release(e->def);
+            free(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+    free_args(script_frame.args, script_frame.count);
+    script_frame.args = NULL;
+    script_frame.count = 0;
+}
@@ -0,0 +1,457 @@
+// fuzzy.c - Fuzzy matching for the finder
+// Strings live back to back in one arena, with a lowercased copy for
+// matching and a 64-bit mask per string of the characters it contains. A
+// search first checks the query's mask against the masks, one word per
+// string in a branchless loop over a contiguous array, which rules out most
+// strings without touching their text. The rest are matched term by term
+// with memchr(), which glibc implements with vector instructions. As the
+// query is typed, each keystroke only searches the strings that matched
+// the one before, from where their last term ended.
+//
+// Scoring is what costs: a short query matches most of a large history.
+// Strings are searched newest first, so once the list is full a string
+// can only make it with a higher score than the last entry, or the same
+// score and a shorter length. The best score a query can earn is known up
+// front, so when the list is full of those, a string is skipped unless it
+// is shorter and every term sits at a word start. Scoring itself jumps
+// from one matched character to the next with memchr().
+//
+// Scoring follows fzf's first algorithm: the first occurrence of the term
+// as a subsequence is found left to right, then shortened by matching it
+// again right to left from where it ended. Each matched character earns
+// points, with bonuses at word starts and for runs, and gaps cost points.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "../include/fuzzy.h"
+
+#define FUZZY_LIVE (1ULL << 63) // Not replaced by a newer copy
+#define FUZZY_MAX_TERMS 16
+
+#define SCORE_MATCH 16
+#define SCORE_GAP_START -3
+#define SCORE_GAP_EXTENSION -1
+#define BONUS_WHITE 10
+#define BONUS_DELIMITER 9
+#define BONUS_BOUNDARY 8
+#define BONUS_CAMEL 7
+#define BONUS_CONSECUTIVE 4
+
+struct FuzzyIndex {
+    char *text;      // Every string, back to back
+    char *fold;      // The same, with ASCII letters lowercased
+    size_t text_len, text_cap;
+    size_t *offset;
+    size_t *length;
+    uint64_t *mask;
+    size_t count, cap;
+    size_t live;
+
+    bool dedup;
+    size_t *table;   // String index + 1 by hash, for dedup
+    size_t table_size;
+
+    // The last search, which a longer query narrows instead of redoing
+    char *last_query;
+    size_t *survivors;
+    size_t *survivor_end; // Where the last term ended in each
+    size_t nsurvivors;
+    bool survivors_valid;
+    size_t *candidates;
+    size_t *candidate_end;
+};
+
+typedef struct {
+    const char *s;
+    size_t len;
+} Term;
+
+enum { CHAR_WHITE, CHAR_DELIMITER, CHAR_NONWORD, CHAR_LOWER, CHAR_UPPER, CHAR_DIGIT };
+
+static void *grow(void *p, size_t size) {
+    void *q = realloc(p, size);
+    if (q == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    return q;
+}
+
+static uint64_t char_bit(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return 1ULL << (c - 'a');
+    if (c >= '0' && c <= '9') return 1ULL << (26 + c - '0');
+    if (c >= 0x80) return 1ULL << 62;
+    return 1ULL << (36 + c % 26);
+}
+
+static unsigned hash_text(const char *s, size_t len) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+FuzzyIndex *fuzzy_create(bool dedup) {
+    FuzzyIndex *index = calloc(1, sizeof(FuzzyIndex));
+    if (index == NULL) {
+        perror("ash: memory allocation failed");
+        return NULL;
+    }
+    index->dedup = dedup;
+    return index;
+}
+
+void fuzzy_free(FuzzyIndex *index) {
+    if (index == NULL) return;
+    free(index->text);
+    free(index->fold);
+    free(index->offset);
+    free(index->length);
+    free(index->mask);
+    free(index->table);
+    free(index->last_query);
+    free(index->survivors);
+    free(index->survivor_end);
+    free(index->candidates);
+    free(index->candidate_end);
+    free(index);
+}
+
+// Returns the table slot holding s, or the free slot where it would go.
+static size_t *table_slot(FuzzyIndex *index, const char *s, size_t len) {
+    size_t i = hash_text(s, len) & (index->table_size - 1);
+    for (;; i = (i + 1) & (index->table_size - 1)) {
+        size_t *slot = &index->table[i];
+        if (*slot == 0) return slot;
+        size_t k = *slot - 1;
+        if (index->length[k] == len && memcmp(index->text + index->offset[k], s, len) == 0) {
+            return slot;
+        }
+    }
+}
+
+static void table_grow(FuzzyIndex *index) {
+    size_t *old = index->table;
+    size_t old_size = index->table_size;
+    index->table_size = old_size ? old_size * 2 : 1024;
+    index->table = calloc(index->table_size, sizeof(size_t));
+    if (index->table == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i] == 0) continue;
+        size_t k = old[i] - 1;
+        *table_slot(index, index->text + index->offset[k], index->length[k]) = old[i];
+    }
+    free(old);
+}
+
+size_t fuzzy_add(FuzzyIndex *index, const char *s, size_t len) {
+    if (index->count == index->cap) {
+        index->cap = index->cap ? index->cap * 2 : 256;
+        index->offset = grow(index->offset, index->cap * sizeof(size_t));
+        index->length = grow(index->length, index->cap * sizeof(size_t));
+        index->mask = grow(index->mask, index->cap * sizeof(uint64_t));
+    }
+    if (index->text_len + len > index->text_cap) {
+        size_t cap = index->text_cap ? index->text_cap : 4096;
+        while (cap < index->text_len + len) cap *= 2;
+        index->text = grow(index->text, cap);
+        index->fold = grow(index->fold, cap);
+        index->text_cap = cap;
+    }
+    size_t i = index->count++;
+    index->offset[i] = index->text_len;
+    index->length[i] = len;
+    char *text = index->text + index->text_len;
+    char *fold = index->fold + index->text_len;
+    uint64_t mask = FUZZY_LIVE;
+    memcpy(text, s, len);
+    for (size_t k = 0; k < len; k++) {
+        fold[k] = (char)tolower((unsigned char)s[k]);
+        mask |= char_bit((unsigned char)fold[k]);
+    }
+    index->mask[i] = mask;
+    index->text_len += len;
+    index->live++;
+    index->survivors_valid = false;
+
+    if (index->dedup) {
+        if ((index->live + 1) * 2 > index->table_size) table_grow(index);
+        size_t *slot = table_slot(index, s, len);
+        if (*slot) {
+            // The older copy stops matching
+            index->mask[*slot - 1] &= ~FUZZY_LIVE;
+            index->live--;
+        }
+        *slot = i + 1;
+    }
+    return i;
+}
+
+const char *fuzzy_text(const FuzzyIndex *index, size_t i, size_t *len) {
+    *len = index->length[i];
+    return index->text + index->offset[i];
+}
+
+size_t fuzzy_size(const FuzzyIndex *index) {
+    return index->live;
+}
+
+static int char_class(unsigned char c) {
+    if (c == ' ' || c == '\t' || c == '\n') return CHAR_WHITE;
+    if (c == '/' || c == ',' || c == ':' || c == ';' || c == '|' || c == '=') return CHAR_DELIMITER;
+    if (c >= 'a' && c <= 'z') return CHAR_LOWER;
+    if (c >= 'A' && c <= 'Z') return CHAR_UPPER;
+    if (c >= '0' && c <= '9') return CHAR_DIGIT;
+    return c >= 0x80 ? CHAR_LOWER : CHAR_NONWORD;
+}
+
+static int char_bonus(int prev, int cls) {
+    if (cls >= CHAR_LOWER) {
+        if (prev == CHAR_WHITE) return BONUS_WHITE;
+        if (prev == CHAR_DELIMITER) return BONUS_DELIMITER;
+        if (prev == CHAR_NONWORD) return BONUS_BOUNDARY;
+        if ((prev == CHAR_LOWER && cls == CHAR_UPPER) || (prev != CHAR_DIGIT && cls == CHAR_DIGIT)) {
+            return BONUS_CAMEL;
+        }
+        return 0;
+    }
+    return cls == CHAR_WHITE ? BONUS_WHITE : BONUS_BOUNDARY;
+}
+
+#define NO_MATCH ((size_t)-1)
+
+// Finds chars[0..n) as a subsequence of fold[pos..len), leftmost first.
+// Returns the offset after the last one, or NO_MATCH.
+static size_t match_forward(const char *fold, size_t len, const char *chars, size_t n, size_t pos) {
+    for (size_t k = 0; k < n; k++) {
+        const char *p = memchr(fold + pos, chars[k], len - pos);
+        if (p == NULL) return NO_MATCH;
+        pos = (size_t)(p - fold) + 1;
+    }
+    return pos;
+}
+
+// Adds the score of a term known to match to *score, marking the matched
+// bytes in hit if it is given.
+static void score_term(const char *text, const char *fold, size_t len, Term term, int *score, bool *hit) {
+    size_t end = match_forward(fold, len, term.s, term.len, 0);
+    size_t start = end;
+    for (size_t k = term.len; k > 0; ) {
+        start--;
+        if (fold[start] == term.s[k - 1]) k--;
+    }
+
+    // Matches the term left to right within the span, skipping from one
+    // matched character to the next
+    int total = 0, run_bonus = 0;
+    size_t i = start;
+    for (size_t k = 0; k < term.len; k++) {
+        size_t at = (size_t)((const char *)memchr(fold + i, term.s[k], end - i) - fold);
+        bool run = k > 0 && at == i;
+        if (at > i) total += SCORE_GAP_START + (int)(at - i - 1) * SCORE_GAP_EXTENSION;
+        int prev = at > 0 ? char_class((unsigned char)text[at - 1]) : CHAR_WHITE;
+        int bonus = char_bonus(prev, char_class((unsigned char)text[at]));
+        if (run) {
+            if (bonus < run_bonus) bonus = run_bonus;
+            if (bonus < BONUS_CONSECUTIVE) bonus = BONUS_CONSECUTIVE;
+        } else {
+            run_bonus = bonus;
+        }
+        total += SCORE_MATCH + (k == 0 ? bonus * 2 : bonus);
+        if (hit) hit[at] = true;
+        i = at + 1;
+    }
+    *score += total;
+}
+
+// Splits the lowercased query into blank-separated terms and returns how
+// many there are.
+static size_t parse_terms(char *query, Term *terms) {
+    size_t n = 0;
+    for (char *p = query; *p && n < FUZZY_MAX_TERMS; ) {
+        while (*p == ' ') p++;
+        if (*p == '\0') break;
+        terms[n].s = p;
+        while (*p && *p != ' ') {
+            *p = (char)tolower((unsigned char)*p);
+            p++;
+        }
+        terms[n].len = (size_t)(p - terms[n].s);
+        n++;
+    }
+    return n;
+}
+
+// Checks that every term matches string i. Returns where the last one
+// ends, or NO_MATCH.
+static size_t match_all(const FuzzyIndex *index, size_t i, const Term *terms, size_t nterms) {
+    const char *fold = index->fold + index->offset[i];
+    size_t end = 0;
+    for (size_t t = 0; t < nterms; t++) {
+        end = match_forward(fold, index->length[i], terms[t].s, terms[t].len, 0);
+        if (end == NO_MATCH) break;
+    }
+    return end;
+}
+
+static int score_all(const FuzzyIndex *index, size_t i, const Term *terms, size_t nterms, bool *hit) {
+    const char *text = index->text + index->offset[i];
+    const char *fold = index->fold + index->offset[i];
+    int score = 0;
+    for (size_t t = 0; t < nterms; t++) {
+        score_term(text, fold, index->length[i], terms[t], &score, hit);
+    }
+    return score;
+}
+
+// Whether every term appears whole at the start of a word in string i,
+// which it takes to score best_possible.
+static bool could_score_best(const FuzzyIndex *index, size_t i, const Term *terms, size_t nterms) {
+    const char *fold = index->fold + index->offset[i];
+    size_t len = index->length[i];
+    for (size_t t = 0; t < nterms; t++) {
+        const char *s = terms[t].s;
+        size_t n = terms[t].len;
+        // A blank earns the full bonus wherever it is
+        if (char_class((unsigned char)s[0]) == CHAR_WHITE) continue;
+        bool found = false;
+        for (size_t pos = 0; !found && pos + n <= len; pos++) {
+            const char *p = memchr(fold + pos, s[0], len - n + 1 - pos);
+            if (p == NULL) break;
+            pos = (size_t)(p - fold);
+            found = (pos == 0 || char_class((unsigned char)fold[pos - 1]) == CHAR_WHITE) && memcmp(p, s, n) == 0;
+        }
+        if (!found) return false;
+    }
+    return true;
+}
+
+static bool ranks_before(const FuzzyIndex *index, FuzzyMatch a, FuzzyMatch b) {
+    if (a.score != b.score) return a.score > b.score;
+    if (index->length[a.index] != index->length[b.index]) {
+        return index->length[a.index] < index->length[b.index];
+    }
+    return a.index > b.index;
+}
+
+size_t fuzzy_search(FuzzyIndex *index, const char *query, FuzzyMatch *out, size_t max, size_t *found) {
+    char *folded = strdup(query);
+    if (folded == NULL) return *found = 0;
+    Term terms[FUZZY_MAX_TERMS];
+    size_t nterms = parse_terms(folded, terms);
+    size_t n = 0;
+
+    if (nterms == 0) {
+        for (size_t i = index->count; i-- > 0 && n < max; ) {
+            if (index->mask[i] & FUZZY_LIVE) out[n++] = (FuzzyMatch){ i, 0 };
+        }
+        *found = index->live;
+        index->survivors_valid = false;
+        free(folded);
+        return n;
+    }
+
+    // Every character at a word start, with the first one counted twice
+    uint64_t qmask = FUZZY_LIVE;
+    int best_possible = 0;
+    for (size_t t = 0; t < nterms; t++) {
+        for (size_t k = 0; k < terms[t].len; k++) qmask |= char_bit((unsigned char)terms[t].s[k]);
+        best_possible += (int)terms[t].len * (SCORE_MATCH + BONUS_WHITE) + BONUS_WHITE;
+    }
+
+    size_t last_len = index->last_query ? strlen(index->last_query) : 0;
+    bool narrow = index->survivors_valid && index->last_query &&
+                  strncmp(query, index->last_query, last_len) == 0;
+    // When only the last term grew, or a term was started, the survivors
+    // already match everything before, so only the new characters are
+    // looked for, from where the last term ended
+    const char *added = narrow ? folded + last_len : "";
+    size_t nadded = strlen(added);
+    bool resume = narrow && nterms < FUZZY_MAX_TERMS && memchr(added, ' ', nadded) == NULL;
+    bool new_term = resume && nadded > 0 && last_len > 0 && query[last_len - 1] == ' ';
+    if (!narrow) {
+        index->survivors = grow(index->survivors, (index->count + 1) * sizeof(size_t));
+        index->survivor_end = grow(index->survivor_end, (index->count + 1) * sizeof(size_t));
+        index->candidates = grow(index->candidates, (index->count + 1) * sizeof(size_t));
+        index->candidate_end = grow(index->candidate_end, (index->count + 1) * sizeof(size_t));
+    }
+
+    // Prefilter on the masks alone
+    size_t ncand = 0;
+    size_t *cand = index->candidates;
+    size_t *cand_end = index->candidate_end;
+    const uint64_t *mask = index->mask;
+    if (narrow) {
+        const size_t *from = index->survivors;
+        const size_t *from_end = index->survivor_end;
+        for (size_t j = 0; j < index->nsurvivors; j++) {
+            size_t i = from[j];
+            cand[ncand] = i;
+            cand_end[ncand] = new_term ? 0 : from_end[j];
+            ncand += (mask[i] & qmask) == qmask;
+        }
+    } else {
+        // Newest first, so a string can only beat the ones already ranked
+        // by scoring higher or being shorter
+        for (size_t i = index->count; i-- > 0; ) {
+            cand[ncand] = i;
+            ncand += (mask[i] & qmask) == qmask;
+        }
+    }
+
+    size_t matched = 0;
+    for (size_t j = 0; j < ncand; j++) {
+        size_t i = cand[j];
+        size_t last_end = resume ? match_forward(index->fold + index->offset[i], index->length[i], added, nadded, cand_end[j])
+                                 : match_all(index, i, terms, nterms);
+        if (last_end == NO_MATCH) continue;
+        index->survivors[matched] = i;
+        index->survivor_end[matched++] = last_end;
+        // Once the list is full, a string needs a higher score than its
+        // last entry, or the same one and a shorter length
+        if (n == max) {
+            const FuzzyMatch *worst = &out[n - 1];
+            if (max == 0 || worst->score > best_possible) continue;
+            if (worst->score == best_possible && (index->length[i] >= index->length[worst->index] ||
+                                                   !could_score_best(index, i, terms, nterms))) {
+                continue;
+            }
+        }
+        FuzzyMatch m = { i, score_all(index, i, terms, nterms, NULL) };
+        if (n == max && !ranks_before(index, m, out[n - 1])) continue;
+        size_t at = n < max ? n++ : n - 1;
+        while (at > 0 && ranks_before(index, m, out[at - 1])) {
+            out[at] = out[at - 1];
+            at--;
+        }
+        out[at] = m;
+    }
+    index->nsurvivors = matched;
+    index->survivors_valid = true;
+    free(index->last_query);
+    index->last_query = strdup(query);
+    *found = matched;
+    free(folded);
+    return n;
+}
+
+void fuzzy_positions(const FuzzyIndex *index, size_t i, const char *query, bool *hit) {
+    memset(hit, 0, index->length[i] * sizeof(bool));
+    char *folded = strdup(query);
+    if (folded == NULL) return;
+    Term terms[FUZZY_MAX_TERMS];
+    size_t nterms = parse_terms(folded, terms);
+    if (match_all(index, i, terms, nterms) != NO_MATCH) score_all(index, i, terms, nterms, hit);
+    free(folded);
+}
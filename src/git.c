@@ -1,11 +1,33 @@
+#define _GNU_SOURCE
 
 #include "../include/git.h"
+#include "../include/trace.h"
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <dirent.h>
+#include <time.h>
+
+// Something whose change means the ref names have to be read again: a
+// directory under refs/ or the packed-refs file
+typedef struct {
+    char *path;
+    bool exists;
+    ino_t ino;
+    struct timespec mtime;
+} RefStamp;
+
+// Short names of the refs of the repository last completed in, sorted
+static char refs_dir[ASH_MAX_PATH];
+static char **ref_names = NULL;
+static size_t ref_count = 0, ref_cap = 0;
+static RefStamp *ref_stamps = NULL;
+static size_t stamp_count = 0, stamp_cap = 0;
+static bool refs_racy = false;
 
 /**
  * @brief Checks if the current directory is a git repository.
@@ -37,10 +59,12 @@ void get_git_branch(const char *path, char *buffer, size_t buffer_size) {
         return;
     }
 
+    TRACE_BEGIN("get_git_branch");
     int pipefd[2];
-    if (pipe(pipefd) == -1) {
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
         perror("ash: pipe failed");
         buffer[0] = '\0';
+        TRACE_END("get_git_branch");
         return;
     }
 
@@ -48,11 +72,13 @@ void get_git_branch(const char *path, char *buffer, size_t buffer_size) {
     if (pid == -1) {
         perror("ash: fork failed");
         buffer[0] = '\0';
+        TRACE_END("get_git_branch");
         return;
     }
 
     if (pid == 0) {
         // Child process
+        TRACE_AFTER_FORK();
         close(pipefd[0]); // Close read end
         dup2(pipefd[1], STDOUT_FILENO);
         close(pipefd[1]);
@@ -83,4 +109,233 @@ void get_git_branch(const char *path, char *buffer, size_t buffer_size) {
         close(pipefd[0]);
         waitpid(pid, NULL, 0); // Wait for the child process to finish
     }
-}
\ No newline at end of file
+    TRACE_END("get_git_branch");
+}
+
+/**
+ * @brief Finds the git directory holding the refs of the repository that
+ * contains path.
+ *
+ * Looks for `.git` in path and each parent. A `.git` file, as in a worktree
+ * or submodule, names the real directory with a `gitdir:` line, and a
+ * worktree's `commondir` file points at the directory its refs live in.
+ *
+ * @return True if a repository was found; its directory is in gitdir.
+ */
+bool git_find_dir(const char *path, char *gitdir, size_t size) {
+    char dir[ASH_MAX_PATH];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (;;) {
+        char candidate[ASH_MAX_PATH + 8];
+        snprintf(candidate, sizeof(candidate), "%s/.git", strcmp(dir, "/") == 0 ? "" : dir);
+        struct stat st;
+        if (stat(candidate, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                snprintf(gitdir, size, "%s", candidate);
+                break;
+            }
+            char line[ASH_MAX_PATH];
+            FILE *f = fopen(candidate, "re");
+            bool ok = f && fgets(line, sizeof(line), f) && strncmp(line, "gitdir: ", 8) == 0;
+            if (f) fclose(f);
+            if (!ok) return false;
+            line[strcspn(line, "\n")] = '\0';
+            if (line[8] == '/') snprintf(gitdir, size, "%s", line + 8);
+            else snprintf(gitdir, size, "%s/%s", dir, line + 8);
+            break;
+        }
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL || strcmp(dir, "/") == 0) return false;
+        if (slash == dir) slash[1] = '\0';
+        else *slash = '\0';
+    }
+
+    char common[ASH_MAX_PATH + 16];
+    snprintf(common, sizeof(common), "%s/commondir", gitdir);
+    FILE *f = fopen(common, "re");
+    if (f) {
+        char line[ASH_MAX_PATH];
+        if (fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\n")] = '\0';
+            char joined[2 * ASH_MAX_PATH];
+            if (line[0] == '/') snprintf(joined, sizeof(joined), "%s", line);
+            else snprintf(joined, sizeof(joined), "%s/%s", gitdir, line);
+            snprintf(gitdir, size, "%s", joined);
+        }
+        fclose(f);
+    }
+    return true;
+}
+
+static void *grow(void *p, size_t size) {
+    void *q = realloc(p, size);
+    if (q == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    return q;
+}
+
+static void add_stamp(const char *path) {
+    if (stamp_count == stamp_cap) {
+        stamp_cap = stamp_cap ? stamp_cap * 2 : 16;
+        ref_stamps = grow(ref_stamps, stamp_cap * sizeof(RefStamp));
+    }
+    RefStamp *stamp = &ref_stamps[stamp_count++];
+    struct stat st;
+    stamp->path = strdup(path);
+    stamp->exists = stat(path, &st) == 0;
+    stamp->ino = stamp->exists ? st.st_ino : 0;
+    stamp->mtime = stamp->exists ? st.st_mtim : (struct timespec){ 0, 0 };
+}
+
+static void add_ref(const char *name) {
+    if (ref_count == ref_cap) {
+        ref_cap = ref_cap ? ref_cap * 2 : 64;
+        ref_names = grow(ref_names, ref_cap * sizeof(char *));
+    }
+    ref_names[ref_count] = strdup(name);
+    if (ref_names[ref_count]) ref_count++;
+}
+
+// Adds the refs under dir, a directory of loose refs, named by what
+// follows the refs/<kind>/ part of their path.
+static void read_loose_refs(const char *dir, const char *prefix) {
+    add_stamp(dir);
+    DIR *d = opendir(dir);
+    if (d == NULL) return;
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        const char *n = entry->d_name;
+        size_t len = strlen(n);
+        if (n[0] == '.' || (len > 5 && strcmp(n + len - 5, ".lock") == 0)) continue;
+        char path[ASH_MAX_PATH], name[ASH_MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", dir, n);
+        snprintf(name, sizeof(name), "%s%s", prefix, n);
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir) {
+            strncat(name, "/", sizeof(name) - strlen(name) - 1);
+            read_loose_refs(path, name);
+        } else {
+            add_ref(name);
+        }
+    }
+    closedir(d);
+}
+
+static void clear_refs(void) {
+    for (size_t i = 0; i < ref_count; i++) free(ref_names[i]);
+    for (size_t i = 0; i < stamp_count; i++) free(ref_stamps[i].path);
+    ref_count = stamp_count = 0;
+    refs_dir[0] = '\0';
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Reads the branch, remote branch and tag names of the repository at
+// gitdir, from its loose refs and packed-refs.
+static void read_refs(const char *gitdir) {
+    static const char *const kinds[] = { "refs/heads/", "refs/remotes/", "refs/tags/" };
+    struct timespec started;
+    clock_gettime(CLOCK_REALTIME, &started);
+    clear_refs();
+    char path[ASH_MAX_PATH + 32];
+    // A kind's directory appearing shows in refs/
+    snprintf(path, sizeof(path), "%s/refs", gitdir);
+    add_stamp(path);
+    for (int k = 0; k < 3; k++) {
+        snprintf(path, sizeof(path), "%s/%.*s", gitdir, (int)strlen(kinds[k]) - 1, kinds[k]);
+        read_loose_refs(path, "");
+    }
+    snprintf(path, sizeof(path), "%s/packed-refs", gitdir);
+    add_stamp(path);
+    FILE *f = fopen(path, "re");
+    if (f) {
+        char line[ASH_MAX_PATH];
+        while (fgets(line, sizeof(line), f)) {
+            // "<object> <refname>", with '#' for the header and '^' for
+            // peeled tags
+            char *ref = strchr(line, ' ');
+            if (line[0] == '#' || line[0] == '^' || ref == NULL) continue;
+            ref++;
+            ref[strcspn(ref, "\n")] = '\0';
+            for (int k = 0; k < 3; k++) {
+                if (strncmp(ref, kinds[k], strlen(kinds[k])) == 0) add_ref(ref + strlen(kinds[k]));
+            }
+        }
+        fclose(f);
+    }
+
+    // A branch and a tag may share a name, and packed refs can also be loose
+    qsort(ref_names, ref_count, sizeof(char *), by_name);
+    size_t kept = 0;
+    for (size_t i = 0; i < ref_count; i++) {
+        if (kept > 0 && strcmp(ref_names[kept - 1], ref_names[i]) == 0) free(ref_names[i]);
+        else ref_names[kept++] = ref_names[i];
+    }
+    ref_count = kept;
+    snprintf(refs_dir, sizeof(refs_dir), "%s", gitdir);
+    // A change within the same second as the read may not move an mtime
+    refs_racy = false;
+    for (size_t i = 0; i < stamp_count; i++) {
+        if (ref_stamps[i].mtime.tv_sec >= started.tv_sec - 1) refs_racy = true;
+    }
+}
+
+static bool refs_unchanged(void) {
+    for (size_t i = 0; i < stamp_count; i++) {
+        const RefStamp *stamp = &ref_stamps[i];
+        struct stat st;
+        bool exists = stat(stamp->path, &st) == 0;
+        if (exists != stamp->exists) return false;
+        if (exists && (st.st_ino != stamp->ino || st.st_mtim.tv_sec != stamp->mtime.tv_sec ||
+                       st.st_mtim.tv_nsec != stamp->mtime.tv_nsec)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Lists the refs of the repository containing path that start with
+ * prefix, without running git.
+ *
+ * Names are short, as git accepts them: `main`, `origin/main`, `v1.0`.
+ * They are read from the loose refs under refs/heads, refs/remotes and
+ * refs/tags and from packed-refs, and kept until one of those directories
+ * or the packed-refs file changes its mtime.
+ */
+void git_refs(const char *path, const char *prefix, GitRefFn fn, void *ctx) {
+    char gitdir[ASH_MAX_PATH];
+    if (!git_find_dir(path, gitdir, sizeof(gitdir))) return;
+    if (strcmp(gitdir, refs_dir) != 0 || refs_racy || !refs_unchanged()) {
+        TRACE_BEGIN("git_read_refs");
+        read_refs(gitdir);
+        TRACE_END("git_read_refs");
+    }
+    size_t len = strlen(prefix);
+    size_t lo = 0, hi = ref_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(ref_names[mid], prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    for (size_t i = lo; i < ref_count && strncmp(ref_names[i], prefix, len) == 0; i++) {
+        fn(ref_names[i], ctx);
+    }
+}
+
+void git_refs_free(void) {
+    clear_refs();
+    free(ref_names);
+    free(ref_stamps);
+    ref_names = NULL;
+    ref_stamps = NULL;
+    ref_cap = stamp_cap = 0;
+}
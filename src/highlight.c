@@ -0,0 +1,716 @@
+// highlight.c - Syntax highlighting of the line being edited
+// Readline's own redisplay is replaced by one that draws the prompt and the
+// line with colors: commands found in $PATH or the command list, builtins,
+// functions and aliases, unknown commands, quoted strings, variables,
+// operators, redirections and comments. The history suggestion for the line
+// (suggest.c) is drawn after it in grey.
+//
+// Command names are looked up in a hash set built once from the command
+// list and the $PATH directories. When $PATH changes, the set is rebuilt
+// from a timer in the prompt's event loop, so the prompt is drawn at once
+// with the old set and recolored when the new one is ready. The line
+// is lexed incrementally: the result of the last pass is kept with a
+// checkpoint (offset and lexer state) at every token start. After an edit,
+// lexing restarts at the last checkpoint before the first changed byte and
+// stops as soon as it reaches a token start in the unchanged tail with the
+// same state as before, so a keystroke costs about one token's work however
+// long the line is.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+
+#include "../include/ash.h"
+#include "../include/highlight.h"
+#include "../include/suggest.h"
+#include "../include/executor.h"
+#include "../include/functions.h"
+#include "../include/eventloop.h"
+#include "../include/finder.h"
+#include "../include/trace.h"
+
+// Color classes, one per byte of the line
+enum {
+    HL_PLAIN,
+    HL_COMMAND,
+    HL_BUILTIN,   // Builtins, functions, aliases and keywords
+    HL_UNKNOWN,
+    HL_STRING,
+    HL_VARIABLE,
+    HL_OPERATOR,
+    HL_REDIRECT,
+    HL_COMMENT
+};
+
+static const char *const hl_colors[] = {
+    [HL_PLAIN] = "\033[0m",
+    [HL_COMMAND] = "\033[1;38;5;76m",  // Green
+    [HL_BUILTIN] = "\033[1;38;5;81m",  // Cyan
+    [HL_UNKNOWN] = "\033[1;38;5;196m", // Red
+    [HL_STRING] = "\033[0;38;5;220m",  // Yellow
+    [HL_VARIABLE] = "\033[0;38;5;45m", // Teal
+    [HL_OPERATOR] = "\033[1;38;5;177m", // Magenta
+    [HL_REDIRECT] = "\033[0;38;5;39m", // Blue
+    [HL_COMMENT] = "\033[0;38;5;244m", // Grey
+};
+
+#define SUGGEST_COLOR "\033[0;38;5;242m"
+
+// Lexer state at a token start
+enum {
+    ST_COMMAND = 1,  // The next word is a command name
+    ST_TARGET = 2,   // The next word is the target of a redirection
+    ST_FUNCNAME = 4  // The next word names a function (after `function`)
+};
+
+typedef struct {
+    int offset;
+    unsigned char state;
+} Checkpoint;
+
+// The line as last lexed
+typedef struct {
+    char *text;
+    int len;
+    unsigned char *cls;
+    Checkpoint *cps;
+    int ncps;
+    int cap;
+    int cps_cap;
+    bool valid;
+} Lexed;
+
+bool highlight_enabled = false;
+
+static Lexed lexed[2];
+static Lexed *last = &lexed[0];
+static Lexed *next = &lexed[1];
+
+static char **cmd_set = NULL;
+static size_t cmd_set_size = 0; // A power of two
+static size_t cmd_set_count = 0;
+static char *cmd_set_path = NULL;
+static int rebuild_timer = -1; // Pending rebuild after a $PATH change
+
+static char *out = NULL;
+static size_t out_len = 0, out_cap = 0;
+
+static bool colors = false;
+static bool suggestions = false;
+static bool hide_suggestion = false;
+static bool drawn_hint = false;
+
+static int drawn_row = 0;     // Rows from the prompt's first row to the cursor
+static int drawn_end_row = 0; // Rows from the prompt's first row to the end
+
+static unsigned hash_text(const char *s, size_t len) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static bool set_contains(const char *s, size_t len) {
+    if (cmd_set_size == 0) return false;
+    for (size_t i = hash_text(s, len) & (cmd_set_size - 1); cmd_set[i]; i = (i + 1) & (cmd_set_size - 1)) {
+        if (strncmp(cmd_set[i], s, len) == 0 && cmd_set[i][len] == '\0') return true;
+    }
+    return false;
+}
+
+static void set_insert(const char *name) {
+    size_t len = strlen(name);
+    if (set_contains(name, len)) return;
+    if ((cmd_set_count + 1) * 2 > cmd_set_size) {
+        // Keep the load under one half
+        size_t size = cmd_set_size ? cmd_set_size * 2 : 1024;
+        char **table = calloc(size, sizeof(char *));
+        if (table == NULL) return;
+        for (size_t i = 0; i < cmd_set_size; i++) {
+            if (cmd_set[i] == NULL) continue;
+            size_t k = hash_text(cmd_set[i], strlen(cmd_set[i])) & (size - 1);
+            while (table[k]) k = (k + 1) & (size - 1);
+            table[k] = cmd_set[i];
+        }
+        free(cmd_set);
+        cmd_set = table;
+        cmd_set_size = size;
+    }
+    size_t k = hash_text(name, len) & (cmd_set_size - 1);
+    while (cmd_set[k]) k = (k + 1) & (cmd_set_size - 1);
+    cmd_set[k] = strdup(name);
+    if (cmd_set[k]) cmd_set_count++;
+}
+
+static void set_clear(void) {
+    for (size_t i = 0; i < cmd_set_size; i++) {
+        free(cmd_set[i]);
+    }
+    free(cmd_set);
+    cmd_set = NULL;
+    cmd_set_size = cmd_set_count = 0;
+    free(cmd_set_path);
+    cmd_set_path = NULL;
+}
+
+static void build_command_set(void) {
+    TRACE_BEGIN("highlight_index");
+    set_clear();
+    for (size_t i = 0; i < commands_count; i++) {
+        set_insert(commands[i]);
+    }
+    const char *path = getenv("PATH");
+    cmd_set_path = strdup(path ? path : "");
+    char *dirs = strdup(path ? path : "");
+    char *saveptr = NULL;
+    for (char *dir = dirs ? strtok_r(dirs, ":", &saveptr) : NULL; dir; dir = strtok_r(NULL, ":", &saveptr)) {
+        DIR *d = opendir(dir);
+        if (d == NULL) continue;
+        struct dirent *entry;
+        while ((entry = readdir(d))) {
+            if (entry->d_name[0] != '.' &&
+                (entry->d_type == DT_REG || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)) {
+                set_insert(entry->d_name);
+            }
+        }
+        closedir(d);
+    }
+    free(dirs);
+    // Lexed classes depend on the set
+    last->valid = false;
+    TRACE_END("highlight_index");
+}
+
+// Rebuilds the command set for a new $PATH, then redraws the line in the
+// new colors unless the finder covers it.
+static void rebuild_command_set(void *ctx) {
+    (void)ctx;
+    rebuild_timer = -1;
+    build_command_set();
+    if (!finder_active()) highlight_redisplay();
+}
+
+void highlight_init(bool enable_colors, bool enable_suggestions) {
+    highlight_enabled = (enable_colors || enable_suggestions) && isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+    colors = highlight_enabled && enable_colors;
+    suggestions = highlight_enabled && enable_suggestions;
+    if (colors) build_command_set();
+}
+
+void highlight_free(void) {
+    event_timer_remove(rebuild_timer);
+    rebuild_timer = -1;
+    set_clear();
+    for (int i = 0; i < 2; i++) {
+        free(lexed[i].text);
+        free(lexed[i].cls);
+        free(lexed[i].cps);
+        memset(&lexed[i], 0, sizeof(Lexed));
+    }
+    free(out);
+    out = NULL;
+    out_len = out_cap = 0;
+}
+
+// --- Lexing ---
+
+static bool is_operator_char(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>' || c == '(' || c == ')';
+}
+
+// Returns the index after the ')' matching the '(' at s[i].
+static int skip_parens(const char *s, int len, int i) {
+    int depth = 0;
+    for (; i < len; i++) {
+        if (s[i] == '\\') {
+            i++;
+        } else if (s[i] == '\'') {
+            while (i + 1 < len && s[i + 1] != '\'') i++;
+            i++;
+        } else if (s[i] == '(') {
+            depth++;
+        } else if (s[i] == ')' && --depth == 0) {
+            return i + 1;
+        }
+    }
+    return len;
+}
+
+// Length of the redirection operator at s[i], such as ">", "2>>", "&>" or
+// "2>&1", or 0. *has_target is cleared for forms that name no file.
+static int redirect_length(const char *s, int len, int i, bool *has_target) {
+    int j = i;
+    *has_target = true;
+    if (j + 1 < len && s[j] == '&' && s[j + 1] == '>') {
+        j += 2;
+        if (j < len && s[j] == '>') j++;
+        return j - i;
+    }
+    while (j < len && isdigit((unsigned char)s[j])) j++;
+    if (j >= len || (s[j] != '<' && s[j] != '>')) return 0;
+    char c = s[j];
+    for (int run = 0; j < len && s[j] == c && run < 3; run++) j++;
+    if (j < len && s[j] == '&') {
+        int k = j + 1;
+        while (k < len && (isdigit((unsigned char)s[k]) || s[k] == '-')) k++;
+        if (k > j + 1) {
+            *has_target = false;
+            return k - i;
+        }
+    }
+    return j - i;
+}
+
+static int operator_length(const char *s, int len, int i) {
+    if (s[i] == '|' || s[i] == '&') {
+        return (i + 1 < len && s[i + 1] == s[i]) ? 2 : 1;
+    }
+    return (s[i] == ';' || s[i] == '(' || s[i] == ')') ? 1 : 0;
+}
+
+// Returns the end of the word starting at s[i]. Quotes and substitutions
+// may hold blanks and operator characters; an unterminated one runs to the
+// end of the line.
+static int word_end(const char *s, int len, int i) {
+    while (i < len && !isspace((unsigned char)s[i]) && !is_operator_char(s[i])) {
+        if (s[i] == '\\') {
+            i += 2;
+        } else if (s[i] == '\'') {
+            i++;
+            while (i < len && s[i] != '\'') i++;
+            i++;
+        } else if (s[i] == '"') {
+            i++;
+            while (i < len && s[i] != '"') i += (s[i] == '\\') ? 2 : 1;
+            i++;
+        } else if (s[i] == '`') {
+            i++;
+            while (i < len && s[i] != '`') i++;
+            i++;
+        } else if (s[i] == '$' && i + 1 < len && s[i + 1] == '(') {
+            i = skip_parens(s, len, i + 1);
+        } else {
+            i++;
+        }
+    }
+    return i < len ? i : len;
+}
+
+static void fill(unsigned char *cls, int from, int to, unsigned char c) {
+    memset(cls + from, c, (size_t)(to - from));
+}
+
+// Colors a word: quoted parts as strings, expansions as variables, the rest
+// with word_cls.
+static void mark_word(const char *s, int start, int end, unsigned char *cls, unsigned char word_cls) {
+    int i = start;
+    while (i < end) {
+        int j = i + 1;
+        if (s[i] == '\\') {
+            j = i + 2 < end ? i + 2 : end;
+            fill(cls, i, j, word_cls);
+        } else if (s[i] == '\'' || s[i] == '"' || s[i] == '`') {
+            while (j < end && s[j] != s[i]) j += (s[i] == '"' && s[j] == '\\') ? 2 : 1;
+            j = j + 1 < end ? j + 1 : end;
+            fill(cls, i, j, HL_STRING);
+        } else if (s[i] == '$' && j < end) {
+            if (s[j] == '(') {
+                j = skip_parens(s, end, j);
+            } else if (s[j] == '{') {
+                while (j < end && s[j] != '}') j++;
+                j = j < end ? j + 1 : end;
+            } else if (strchr("?#@*!$0123456789", s[j])) {
+                j++;
+            } else {
+                while (j < end && (isalnum((unsigned char)s[j]) || s[j] == '_')) j++;
+            }
+            fill(cls, i, j, j > i + 1 ? HL_VARIABLE : word_cls);
+        } else {
+            cls[i] = word_cls;
+        }
+        i = j;
+    }
+}
+
+static bool is_assignment(const char *word, int len) {
+    if (len == 0 || (!isalpha((unsigned char)word[0]) && word[0] != '_')) return false;
+    for (int i = 1; i < len; i++) {
+        if (word[i] == '=') return true;
+        if (!isalnum((unsigned char)word[i]) && word[i] != '_') return false;
+    }
+    return false;
+}
+
+static bool is_alias(const char *name) {
+    for (int i = 0; i < alias_count; i++) {
+        if (strcmp(aliases[i], name) == 0) return true;
+    }
+    return false;
+}
+
+// Classifies a word in command position.
+static unsigned char command_class(const char *word, int len) {
+    char name[256];
+    if (len <= 0 || len >= (int)sizeof(name)) return HL_UNKNOWN;
+    memcpy(name, word, (size_t)len);
+    name[len] = '\0';
+    if (strchr(name, '/')) {
+        char path[ASH_MAX_PATH];
+        const char *home = getenv("HOME");
+        if (name[0] == '~' && name[1] == '/' && home) {
+            snprintf(path, sizeof(path), "%s%s", home, name + 1);
+        } else {
+            snprintf(path, sizeof(path), "%s", name);
+        }
+        struct stat st;
+        return (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0)
+                   ? HL_COMMAND : HL_UNKNOWN;
+    }
+    if (is_builtin(name) || find_function(name) || is_alias(name)) return HL_BUILTIN;
+    return set_contains(name, (size_t)len) ? HL_COMMAND : HL_UNKNOWN;
+}
+
+// Colors the word s[i..end) and updates the lexer state.
+static unsigned char word_class(const char *s, int len, int i, int end, unsigned char *st) {
+    const char *word = s + i;
+    int n = end - i;
+    if (*st & ST_TARGET) {
+        *st &= ~ST_TARGET;
+        return HL_PLAIN;
+    }
+    if (*st & ST_FUNCNAME) {
+        *st = 0;
+        return HL_BUILTIN;
+    }
+    if (!(*st & ST_COMMAND)) return HL_PLAIN;
+    if (n == 1 && (word[0] == '{' || word[0] == '}')) {
+        *st = ST_COMMAND;
+        return HL_OPERATOR;
+    }
+    if (is_assignment(word, n)) return HL_PLAIN; // Still in command position
+    if (n == 4 && memcmp(word, "time", 4) == 0) return HL_BUILTIN;
+    *st = 0;
+    if (n == 8 && memcmp(word, "function", 8) == 0) {
+        *st = ST_FUNCNAME;
+        return HL_BUILTIN;
+    }
+    // name() starts a function definition
+    if (end + 1 < len && s[end] == '(' && s[end + 1] == ')') return HL_BUILTIN;
+    return command_class(word, n);
+}
+
+// Lexes the token at s[i], which is not a blank, and returns its end.
+static int lex_token(const char *s, int len, int i, unsigned char *st, unsigned char *cls) {
+    if (s[i] == '#') {
+        fill(cls, i, len, HL_COMMENT);
+        return len;
+    }
+    bool has_target;
+    int n = redirect_length(s, len, i, &has_target);
+    if (n > 0) {
+        fill(cls, i, i + n, HL_REDIRECT);
+        if (has_target) *st |= ST_TARGET;
+        return i + n;
+    }
+    n = operator_length(s, len, i);
+    if (n > 0) {
+        fill(cls, i, i + n, HL_OPERATOR);
+        *st = ST_COMMAND;
+        return i + n;
+    }
+    int end = word_end(s, len, i);
+    if (end == i) end = i + 1; // A lone operator character such as '<'
+    mark_word(s, i, end, cls, word_class(s, len, i, end, st));
+    return end;
+}
+
+static void reserve(Lexed *lx, int len) {
+    if (len + 1 > lx->cap) {
+        int cap = lx->cap ? lx->cap : 256;
+        while (cap < len + 1) cap *= 2;
+        char *text = realloc(lx->text, (size_t)cap);
+        unsigned char *cls = realloc(lx->cls, (size_t)cap);
+        if (text) lx->text = text;
+        if (cls) lx->cls = cls;
+        if (text == NULL || cls == NULL) {
+            perror("ash: memory allocation failed");
+            exit(1);
+        }
+        lx->cap = cap;
+    }
+}
+
+static void add_checkpoint(Lexed *lx, int offset, unsigned char state) {
+    if (lx->ncps == lx->cps_cap) {
+        int cap = lx->cps_cap ? lx->cps_cap * 2 : 64;
+        Checkpoint *cps = realloc(lx->cps, (size_t)cap * sizeof(Checkpoint));
+        if (cps == NULL) {
+            perror("ash: memory allocation failed");
+            exit(1);
+        }
+        lx->cps = cps;
+        lx->cps_cap = cap;
+    }
+    lx->cps[lx->ncps++] = (Checkpoint){ offset, state };
+}
+
+// Lexes text into next, reusing what it can of last, then swaps them.
+static void relex(const char *text, int len) {
+    if (last->valid && last->len == len && memcmp(last->text, text, (size_t)len) == 0) {
+        return;
+    }
+    reserve(next, len);
+    memcpy(next->text, text, (size_t)len);
+    next->len = len;
+    next->ncps = 0;
+    unsigned char *cls = next->cls;
+
+    int restart = 0, kept = 0, suffix = 0;
+    unsigned char st = ST_COMMAND;
+    if (last->valid) {
+        int prefix = 0, common = len < last->len ? len : last->len;
+        while (prefix < common && text[prefix] == last->text[prefix]) prefix++;
+        while (suffix < common - prefix && text[len - 1 - suffix] == last->text[last->len - 1 - suffix]) {
+            suffix++;
+        }
+        // Restart one token early: a word is colored with a look at the
+        // characters after it, as in "name()"
+        while (kept < last->ncps && last->cps[kept].offset < prefix) kept++;
+        kept = kept >= 2 ? kept - 2 : 0;
+        if (kept < last->ncps && last->cps[kept].offset < prefix) {
+            restart = last->cps[kept].offset;
+            st = last->cps[kept].state;
+        }
+        memcpy(cls, last->cls, (size_t)restart);
+        for (int k = 0; k < kept; k++) add_checkpoint(next, last->cps[k].offset, last->cps[k].state);
+    }
+
+    int delta = len - (last->valid ? last->len : 0);
+    int old_k = kept;
+    int i = restart;
+    while (i < len) {
+        if (isspace((unsigned char)text[i])) {
+            cls[i++] = HL_PLAIN;
+            continue;
+        }
+        if (last->valid && i >= len - suffix) {
+            // In the unchanged tail: once a token starts where one started
+            // before, in the same state, the rest lexes as it did then
+            int old = i - delta;
+            while (old_k < last->ncps && last->cps[old_k].offset < old) old_k++;
+            if (old_k < last->ncps && last->cps[old_k].offset == old && last->cps[old_k].state == st) {
+                memcpy(cls + i, last->cls + old, (size_t)(len - i));
+                for (; old_k < last->ncps; old_k++) {
+                    add_checkpoint(next, last->cps[old_k].offset + delta, last->cps[old_k].state);
+                }
+                break;
+            }
+        }
+        add_checkpoint(next, i, st);
+        i = lex_token(text, len, i, &st, cls);
+    }
+
+    next->valid = true;
+    Lexed *swap = last;
+    last = next;
+    next = swap;
+}
+
+// --- Drawing ---
+
+static void out_append(const char *s, size_t n) {
+    if (out_len + n > out_cap) {
+        size_t cap = out_cap ? out_cap : 1024;
+        while (cap < out_len + n) cap *= 2;
+        char *grown = realloc(out, cap);
+        if (grown == NULL) return;
+        out = grown;
+        out_cap = cap;
+    }
+    memcpy(out + out_len, s, n);
+    out_len += n;
+}
+
+static void out_printf(const char *fmt, int value) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), fmt, value);
+    out_append(buf, (size_t)n);
+}
+
+// Appends the prompt and returns its width on screen. Escape sequences and
+// the parts readline is told to ignore (\001...\002) take no room.
+static int draw_prompt(const char *prompt) {
+    int width = 0;
+    bool hidden = false;
+    mbstate_t mbs;
+    memset(&mbs, 0, sizeof(mbs));
+    for (const char *p = prompt; *p; ) {
+        if (*p == RL_PROMPT_START_IGNORE || *p == RL_PROMPT_END_IGNORE) {
+            hidden = *p++ == RL_PROMPT_START_IGNORE;
+            continue;
+        }
+        if (*p == '\033') {
+            const char *q = p + 1;
+            if (*q == '[') {
+                q++;
+                while (*q && !(*q >= 0x40 && *q <= 0x7e)) q++;
+                if (*q) q++;
+            }
+            out_append(p, (size_t)(q - p));
+            p = q;
+            continue;
+        }
+        wchar_t wc;
+        size_t n = mbrtowc(&wc, p, MB_CUR_MAX, &mbs);
+        if (n == (size_t)-1 || n == (size_t)-2 || n == 0) {
+            memset(&mbs, 0, sizeof(mbs));
+            n = 1;
+            wc = (unsigned char)*p;
+        }
+        out_append(p, n);
+        if (!hidden) {
+            int w = wcwidth(wc);
+            width += w < 0 ? 1 : w;
+        }
+        p += n;
+    }
+    return width;
+}
+
+// Appends s[0..n), colored by cls if given, advancing *col. Returns the
+// column of byte `point`, or -1 if it is not in s.
+static int draw_text(const char *s, int n, const unsigned char *cls, int point, int *col, int cols) {
+    int point_col = -1;
+    int current = HL_PLAIN;
+    mbstate_t mbs;
+    memset(&mbs, 0, sizeof(mbs));
+    for (int p = 0; p < n; ) {
+        if (p == point) point_col = *col;
+        if (cls && cls[p] != current) {
+            current = cls[p];
+            out_append(hl_colors[current], strlen(hl_colors[current]));
+        }
+        unsigned char c = (unsigned char)s[p];
+        if (c == '\t') {
+            int spaces = 8 - *col % 8;
+            for (int k = 0; k < spaces; k++) out_append(" ", 1);
+            *col += spaces;
+            p++;
+            continue;
+        }
+        if (c < 0x20 || c == 0x7f) {
+            // Shown as ^X, like readline does
+            char caret[2] = { '^', (char)(c ^ 0x40) };
+            out_append(caret, 2);
+            *col += 2;
+            p++;
+            continue;
+        }
+        wchar_t wc;
+        size_t len = mbrtowc(&wc, s + p, (size_t)(n - p), &mbs);
+        if (len == (size_t)-1 || len == (size_t)-2 || len == 0) {
+            memset(&mbs, 0, sizeof(mbs));
+            len = 1;
+            wc = c;
+        }
+        int w = wcwidth(wc);
+        if (w < 0) w = 1;
+        // A double-width character does not start in the last column
+        if (w == 2 && *col % cols == cols - 1) (*col)++;
+        out_append(s + p, len);
+        *col += w;
+        p += (int)len;
+    }
+    return point_col;
+}
+
+// Draws the prompt, the colored line and the suggestion in one write, then
+// puts the cursor at rl_point. The cursor starts drawn_row rows below where
+// the prompt did.
+void highlight_redisplay(void) {
+    TRACE_BEGIN("highlight");
+    if (colors) {
+        const char *path = getenv("PATH");
+        if (rebuild_timer < 0 && (cmd_set_path == NULL || strcmp(cmd_set_path, path ? path : "") != 0)) {
+            rebuild_timer = event_timer_add(1, false, rebuild_command_set, NULL);
+            if (rebuild_timer < 0) build_command_set();
+        }
+        relex(rl_line_buffer, rl_end);
+    }
+
+    int rows, cols;
+    rl_get_screen_size(&rows, &cols);
+    if (cols <= 0) cols = 80;
+
+    out_len = 0;
+    if (drawn_row > 0) out_printf("\033[%dA", drawn_row);
+    out_append("\r", 1);
+    int col = draw_prompt(rl_display_prompt ? rl_display_prompt : "");
+    out_append("\033[0m", 4);
+
+    int point_col = draw_text(rl_line_buffer, rl_end, colors ? last->cls : NULL, rl_point, &col, cols);
+    if (point_col < 0) point_col = col;
+
+    // The suggestion follows the cursor, so it is only offered at the end
+    const char *hint = NULL;
+    if (suggestions && !hide_suggestion && rl_point == rl_end &&
+        !RL_ISSTATE(RL_STATE_ISEARCH | RL_STATE_NSEARCH)) {
+        hint = suggest_lookup(rl_line_buffer, rl_end);
+    }
+    drawn_hint = hint != NULL;
+    if (hint) {
+        out_append(SUGGEST_COLOR, strlen(SUGGEST_COLOR));
+        draw_text(hint + rl_end, (int)strlen(hint + rl_end), NULL, -1, &col, cols);
+    }
+    out_append("\033[0m", 4);
+
+    // With the line ending at the right margin, the terminal keeps the
+    // cursor on the last column; print a blank to move it to the next row
+    if (col > 0 && col % cols == 0) out_append(" \r", 2);
+    out_append("\033[J", 3);
+
+    int end_row = col / cols;
+    int point_row = point_col / cols;
+    if (end_row > point_row) out_printf("\033[%dA", end_row - point_row);
+    out_append("\r", 1);
+    if (point_col % cols) out_printf("\033[%dC", point_col % cols);
+    drawn_row = point_row;
+    drawn_end_row = end_row;
+
+    FILE *stream = rl_outstream ? rl_outstream : stdout;
+    fwrite(out, 1, out_len, stream);
+    fflush(stream);
+    TRACE_END("highlight");
+}
+
+void highlight_clear(void) {
+    FILE *stream = rl_outstream ? rl_outstream : stdout;
+    if (drawn_row > 0) fprintf(stream, "\033[%dA", drawn_row);
+    fputs("\r\033[J", stream);
+    fflush(stream);
+    drawn_row = drawn_end_row = 0;
+}
+
+void highlight_finish(void) {
+    if (drawn_hint) {
+        // The accepted line is left on screen without its suggestion
+        hide_suggestion = true;
+        highlight_redisplay();
+        hide_suggestion = false;
+    }
+    FILE *stream = rl_outstream ? rl_outstream : stdout;
+    if (drawn_end_row > drawn_row) fprintf(stream, "\033[%dB", drawn_end_row - drawn_row);
+    fputs("\r\n", stream);
+    fflush(stream);
+    drawn_row = drawn_end_row = 0;
+}
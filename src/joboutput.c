@@ -0,0 +1,149 @@
+// joboutput.c - Ring buffers for the captured output of background jobs
+// With ASH_JOB_OUTPUT set, a background job writes its stdout and stderr to
+// a pipe that the shell drains into one of these buffers instead of the
+// terminal, where it would run over the prompt. The buffer starts small and
+// grows with the output up to its cap, so thousands of quiet jobs cost
+// little, and a chatty one never holds more than the cap.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "../include/joboutput.h"
+#include "../include/vars.h"
+
+#define RING_MIN_SIZE 4096
+
+struct OutputRing {
+    char *data;
+    size_t size;    // Bytes allocated
+    size_t cap;     // Most bytes the buffer may grow to
+    size_t start;   // Offset of the oldest byte kept
+    size_t len;     // Bytes kept
+    size_t dropped; // Older bytes overwritten
+};
+
+size_t job_output_cap(void) {
+    const char *value = get_variable("ASH_JOB_OUTPUT");
+    if (value == NULL || *value == '\0') return 0;
+    char *end;
+    unsigned long long cap = strtoull(value, &end, 10);
+    if (end == value) return 0;
+    switch (toupper((unsigned char)*end)) {
+    case 'K': cap <<= 10; end++; break;
+    case 'M': cap <<= 20; end++; break;
+    case 'G': cap <<= 30; end++; break;
+    }
+    if (*end != '\0') {
+        fprintf(stderr, "ash: ASH_JOB_OUTPUT: invalid size: %s\n", value);
+        return 0;
+    }
+    return (size_t)cap;
+}
+
+OutputRing *ring_create(size_t cap) {
+    OutputRing *ring = calloc(1, sizeof(OutputRing));
+    if (ring == NULL) {
+        perror("ash: memory allocation failed");
+        return NULL;
+    }
+    ring->cap = cap;
+    return ring;
+}
+
+// Reallocates the buffer to new_size bytes with the kept bytes moved to the
+// front. Returns false if the memory is not available.
+static bool ring_resize(OutputRing *ring, size_t new_size) {
+    char *data = malloc(new_size);
+    if (data == NULL) return false;
+    size_t first = ring->size - ring->start;
+    if (first > ring->len) first = ring->len;
+    if (ring->len) {
+        memcpy(data, ring->data + ring->start, first);
+        memcpy(data + first, ring->data, ring->len - first);
+    }
+    free(ring->data);
+    ring->data = data;
+    ring->size = new_size;
+    ring->start = 0;
+    return true;
+}
+
+void ring_append(OutputRing *ring, const char *data, size_t len) {
+    if (ring->cap == 0) {
+        ring->dropped += len;
+        return;
+    }
+    if (len >= ring->cap) {
+        // Only the tail of this chunk fits
+        ring->dropped += ring->len + len - ring->cap;
+        data += len - ring->cap;
+        len = ring->cap;
+        ring->len = 0;
+        ring->start = 0;
+    }
+    if (ring->len + len > ring->size && ring->size < ring->cap) {
+        size_t want = ring->size ? ring->size : RING_MIN_SIZE;
+        while (want < ring->len + len) want *= 2;
+        if (want > ring->cap) want = ring->cap;
+        if (!ring_resize(ring, want) && ring->size == 0) {
+            ring->dropped += len;
+            return;
+        }
+    }
+    if (len > ring->size) {
+        // The buffer could not grow enough for this chunk
+        ring->dropped += ring->len + len - ring->size;
+        data += len - ring->size;
+        len = ring->size;
+        ring->len = 0;
+        ring->start = 0;
+    }
+    if (ring->len + len > ring->size) {
+        // Full: overwrite the oldest bytes
+        size_t over = ring->len + len - ring->size;
+        ring->start = (ring->start + over) % ring->size;
+        ring->len -= over;
+        ring->dropped += over;
+    }
+    size_t end = (ring->start + ring->len) % ring->size;
+    size_t first = ring->size - end;
+    if (first > len) first = len;
+    memcpy(ring->data + end, data, first);
+    memcpy(ring->data, data + first, len - first);
+    ring->len += len;
+}
+
+void ring_print(const OutputRing *ring, FILE *out) {
+    if (ring->dropped) {
+        fprintf(out, "[... %zu earlier bytes dropped]\n", ring->dropped);
+    }
+    if (ring->len == 0) return;
+    size_t skip = 0;
+    if (ring->dropped) {
+        // Start at a line boundary rather than in the middle of a line
+        while (skip < ring->len && ring->data[(ring->start + skip) % ring->size] != '\n') skip++;
+        skip = skip < ring->len ? skip + 1 : 0;
+    }
+    size_t start = (ring->start + skip) % ring->size;
+    size_t len = ring->len - skip;
+    size_t first = ring->size - start;
+    if (first > len) first = len;
+    fwrite(ring->data + start, 1, first, out);
+    fwrite(ring->data, 1, len - first, out);
+    size_t last = (ring->start + ring->len - 1) % ring->size;
+    if (ring->data[last] != '\n') fputc('\n', out);
+}
+
+size_t ring_length(const OutputRing *ring) {
+    return ring->len;
+}
+
+void ring_free(OutputRing *ring) {
+    if (ring) {
+        free(ring->data);
+        free(ring);
+    }
+}
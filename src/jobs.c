@@ -0,0 +1,1138 @@
+// jobs.c - Background job table and job control builtins for ash shell
+// Tracks jobs started with '&' and implements `jobs`, `fg`, `bg`, `wait` and
+// `joblimit`.
+//
+// The SIGCHLD handler does the reaping: it collects the exit status of every
+// process of a job and marks the job done, using system calls only. The rest
+// of the shell blocks SIGCHLD while it changes the table, reports and removes
+// done jobs at safe points, and waits for jobs with sigsuspend() instead of
+// polling.
+//
+// In an interactive shell on a terminal every job, foreground or background,
+// runs in a process group of its own, led by its first process. The
+// terminal is handed to a foreground job's group while it runs, so Ctrl-Z
+// and Ctrl-C reach every stage of the pipeline and nothing else; `fg`, `bg`
+// and `kill %n` signal the whole group.
+//
+// With ASH_JOB_OUTPUT set, a background job's stdout and stderr go to a pipe
+// instead of the terminal. The shell drains these pipes into per-job ring
+// buffers (see joboutput.c) whenever it waits: for a key at the prompt, for
+// a foreground command, or in `wait`. `jobs -o N` prints what job N wrote;
+// the output of the last few finished jobs is kept as well.
+//
+// With a job limit set, a background job that finds every slot taken is
+// not started: the table keeps a copy of its pipeline as parsed, and the job
+// has no processes until it runs. Forking cannot happen in the SIGCHLD
+// handler, so the oldest queued jobs are expanded and started at the next
+// safe point after slots free up: reap_jobs() at the prompt, the start of
+// the next command, or `wait`. A script starts whatever is still queued
+// before it exits.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sched.h>
+#include <ctype.h>
+#include <strings.h>
+#include <termios.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../include/jobs.h"
+#include "../include/executor.h"
+
+// Global variables for job control.
+Job jobs[MAX_JOBS];
+int job_count = 0;
+int next_job_id = 1;
+
+// Placement policies for background job processes
+typedef enum {
+    PLACE_NONE,   // Inherit the shell's CPU set
+    PLACE_SPREAD, // One CPU per process, round-robin over the CPU set
+    PLACE_PIN     // Every process gets the whole CPU set
+} Placement;
+
+static int job_limit = 0; // Maximum running background jobs, 0 for none
+static Placement placement = PLACE_NONE;
+static cpu_set_t place_cpus;
+static bool place_cpus_set = false;
+static int place_next = 0;
+static unsigned long done_clock = 0; // Orders finished jobs for `wait -n`
+static bool starting_jobs = false;   // start_queued_jobs() is running
+
+#define FINISHED_OUTPUTS 16
+#define DRAIN_CHUNK 65536
+#define DRAIN_READS 16
+
+// Captured output of jobs already removed from the table, oldest first
+// overwritten.
+static struct {
+    int job_id;
+    char *command_line;
+    OutputRing *out;
+} finished[FINISHED_OUTPUTS];
+static int finished_next = 0;
+pid_t last_background_pid = 0;
+bool job_control = false;
+static pid_t shell_pgid = 0;
+
+/**
+ * @brief Enables job control if the shell reads from a terminal.
+ *
+ * Waits until the shell is in the foreground, puts it in a process group of
+ * its own and takes the terminal. The shell itself ignores the stop signals
+ * from the terminal; its children get them back in job_setpgid(), or in
+ * exec_command() for `exec`.
+ */
+void job_control_init(void) {
+    if (!isatty(STDIN_FILENO)) return;
+    pid_t pgrp;
+    while ((pgrp = tcgetpgrp(STDIN_FILENO)) != -1 && pgrp != getpgrp()) {
+        kill(-getpgrp(), SIGTTIN);
+    }
+    job_signals(true);
+    shell_pgid = getpid();
+    // A session leader already leads its group and may not call setpgid()
+    if (getpgrp() != shell_pgid && setpgid(0, shell_pgid) < 0) {
+        perror("ash: setpgid");
+        job_signals(false);
+        return;
+    }
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    job_control = true;
+}
+
+// Ignores the terminal's job control signals (in the shell) or restores
+// their defaults (in a command it runs).
+void job_signals(bool ignore) {
+    void (*handler)(int) = ignore ? SIG_IGN : SIG_DFL;
+    signal(SIGTSTP, handler);
+    signal(SIGTTIN, handler);
+    signal(SIGTTOU, handler);
+    signal(SIGQUIT, handler);
+}
+
+/**
+ * @brief Puts a freshly forked process of a job into the job's group.
+ *
+ * Called in both the child and the parent, so the group exists whichever
+ * runs first. pgid is 0 for the first process, which then leads the group.
+ * In the child, a foreground job also takes the terminal; that happens
+ * before the stop signals are restored, since a process outside the
+ * foreground group that changes it gets SIGTTOU.
+ */
+void job_setpgid(pid_t pid, pid_t pgid, bool foreground, bool child) {
+    if (job_control) {
+        setpgid(pid, pgid);
+        if (child && foreground) {
+            tcsetpgrp(STDIN_FILENO, getpgrp());
+        }
+    }
+    if (child) {
+        job_signals(false);
+    }
+}
+
+// Hands the terminal to a job's process group, or back to the shell with
+// pgid 0.
+void job_terminal(pid_t pgid) {
+    if (job_control) {
+        tcsetpgrp(STDIN_FILENO, pgid ? pgid : shell_pgid);
+    }
+}
+
+// Sends a signal to every process of a job: to its group if it has one,
+// else to each process not reaped yet.
+static int signal_job(Job *job, int sig) {
+    if (job->pgid > 0) {
+        return kill(-job->pgid, sig);
+    }
+    int result = -1;
+    for (int i = 0; i < job->npids; i++) {
+        if (job->pids[i] > 0 && kill(job->pids[i], sig) == 0) result = 0;
+    }
+    return result;
+}
+
+static void block_sigchld(sigset_t *old) {
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, old);
+}
+
+static void restore_sigmask(const sigset_t *old) {
+    sigprocmask(SIG_SETMASK, old, NULL);
+}
+
+// Sleeps until a signal arrives, with SIGCHLD unblocked, draining captured
+// job output meanwhile, then starts queued jobs in the slots that freed.
+// The caller holds SIGCHLD blocked, so a child that ends between its check
+// and this call still wakes it.
+static void wait_for_sigchld(const sigset_t *old) {
+    sigset_t mask = *old;
+    sigdelset(&mask, SIGCHLD);
+    job_events_poll(-1, &mask);
+    start_queued_jobs();
+}
+
+static int count_jobs(int status) {
+    int n = 0;
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].status == status) n++;
+    }
+    return n;
+}
+
+// True if a new background job has to wait for a slot: the limit is reached
+// or older jobs are already waiting.
+bool job_must_queue(void) {
+    return job_limit > 0 &&
+           (count_jobs(JOB_RUNNING) >= job_limit || count_jobs(JOB_QUEUED) > 0);
+}
+
+static void place_cpus_init(void) {
+    if (!place_cpus_set) {
+        CPU_ZERO(&place_cpus);
+        if (sched_getaffinity(0, sizeof(place_cpus), &place_cpus) != 0) {
+            CPU_SET(0, &place_cpus);
+        }
+        place_cpus_set = true;
+    }
+}
+
+// Applies the placement policy to the processes of a job. Only uses system
+// calls, so it is safe from the SIGCHLD handler.
+static void place_job(Job *job) {
+    if (placement == PLACE_NONE) return;
+    int ncpus = CPU_COUNT(&place_cpus);
+    if (ncpus == 0) return;
+    for (int i = 0; i < job->npids; i++) {
+        cpu_set_t set;
+        if (placement == PLACE_PIN) {
+            set = place_cpus;
+        } else {
+            // The place_next-th CPU of the set, counting around
+            int want = place_next++ % ncpus;
+            CPU_ZERO(&set);
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &place_cpus) && want-- == 0) {
+                    CPU_SET(cpu, &set);
+                    break;
+                }
+            }
+        }
+        sched_setaffinity(job->pids[i], sizeof(set), &set);
+    }
+}
+
+static void collect_children(void);
+
+// Takes the next entry of the table for a job, first forgetting the oldest
+// finished job whose status nobody waited for if the table is full. SIGCHLD
+// must be blocked. Returns NULL if the table is full.
+static Job *new_job(const char *command_line) {
+    if (job_count >= MAX_JOBS) {
+        for (int i = 0; i < job_count; i++) {
+            if (jobs[i].status == JOB_DONE) {
+                remove_job(jobs[i].job_id);
+                break;
+            }
+        }
+    }
+    if (job_count >= MAX_JOBS) {
+        fprintf(stderr, "ash: too many background jobs\n");
+        return NULL;
+    }
+    Job *job = &jobs[job_count++];
+    *job = (Job){ .command_line = strdup(command_line), .job_id = next_job_id++,
+                  .status = JOB_RUNNING, .out_fd = -1 };
+    return job;
+}
+
+// Gives a job its processes and marks it running. A pipeline with a
+// process that exited before it was in the table is reaped here.
+static bool set_job_processes(Job *job, const pid_t *pids, int npids, pid_t pgid) {
+    job->pids = malloc((size_t)npids * sizeof(pid_t));
+    if (job->pids == NULL) {
+        perror("ash: memory allocation failed");
+        return false;
+    }
+    memcpy(job->pids, pids, (size_t)npids * sizeof(pid_t));
+    job->npids = npids;
+    job->pid = pids[npids - 1];
+    job->pgid = pgid;
+    job->alive = npids;
+    job->status = JOB_RUNNING;
+    place_job(job);
+    collect_children();
+    return true;
+}
+
+/**
+ * @brief Adds a background job to the jobs list.
+ * @param pids The processes of the pipeline, the last one being the job's pid.
+ * @param pgid The job's process group, or 0 without job control.
+ * @return 0, or -1 if the table is full.
+ */
+int add_job(const pid_t *pids, int npids, pid_t pgid, const char *command_line) {
+    sigset_t old;
+    block_sigchld(&old);
+    Job *job = new_job(command_line);
+    if (job && !set_job_processes(job, pids, npids, pgid)) {
+        remove_job(job->job_id);
+        job = NULL;
+    }
+    if (job) last_background_pid = job->pid;
+    restore_sigmask(&old);
+    return job ? 0 : -1;
+}
+
+/**
+ * @brief Adds a background job that waits for a slot before it starts.
+ * @param pipeline The job's pipeline, from copy_pipeline(); the job table
+ *        owns it afterwards.
+ * @return 0, or -1 if the table is full.
+ */
+int queue_job(struct Command *pipeline, const char *command_line) {
+    sigset_t old;
+    block_sigchld(&old);
+    Job *job = new_job(command_line);
+    if (job) {
+        job->status = JOB_QUEUED;
+        job->queued = pipeline;
+    } else {
+        free_command(pipeline);
+    }
+    restore_sigmask(&old);
+    return job ? 0 : -1;
+}
+
+/**
+ * @brief Records the processes of a queued job that start_queued_job() just
+ * forked.
+ */
+void job_started(int job_id, const pid_t *pids, int npids, pid_t pgid) {
+    sigset_t old;
+    block_sigchld(&old);
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].job_id == job_id && !set_job_processes(&jobs[i], pids, npids, pgid)) {
+            // The processes run untracked
+            jobs[i].status = JOB_DONE;
+            jobs[i].done_seq = ++done_clock;
+        }
+    }
+    restore_sigmask(&old);
+}
+
+// Expands and forks a queued job, past the limit. A job that could not be
+// started is done, with the status its pipeline got.
+static void start_job(Job *job) {
+    struct Command *pipeline = job->queued;
+    job->queued = NULL;
+    job->status = JOB_RUNNING;
+    // Starting only forks and fills in this entry, so job stays valid
+    int status = start_queued_job(pipeline, job->job_id);
+    free_command(pipeline);
+    if (job->npids == 0 && job->status == JOB_RUNNING) {
+        job->exit_status = status;
+        job->status = JOB_DONE;
+        job->done_seq = ++done_clock;
+    }
+}
+
+/**
+ * @brief Starts queued jobs, oldest first, while slots are free.
+ *
+ * Forks and expands words, so it is called at safe points and never from
+ * the SIGCHLD handler.
+ */
+void start_queued_jobs(void) {
+    if (starting_jobs) return;
+    starting_jobs = true;
+    sigset_t old;
+    block_sigchld(&old);
+    collect_children();
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].status != JOB_QUEUED) continue;
+        if (job_limit > 0 && count_jobs(JOB_RUNNING) >= job_limit) break;
+        start_job(&jobs[i]);
+    }
+    restore_sigmask(&old);
+    starting_jobs = false;
+}
+
+/**
+ * @brief Empties the table in a child that runs shell code, such as a
+ * command substitution.
+ *
+ * The shell's jobs are not the child's children, so waitpid() would take
+ * them for finished and the child would start the shell's queued jobs.
+ */
+void job_table_clear(void) {
+    for (int i = 0; i < job_count; i++) {
+        free_command(jobs[i].queued);
+        free(jobs[i].pids);
+        free(jobs[i].command_line);
+    }
+    job_count = 0;
+}
+
+// Starts every queued job as slots free up, for a script about to exit.
+// The jobs themselves are not waited for.
+void drain_job_queue(void) {
+    sigset_t old;
+    block_sigchld(&old);
+    start_queued_jobs();
+    while (count_jobs(JOB_QUEUED) > 0) {
+        wait_for_sigchld(&old);
+    }
+    restore_sigmask(&old);
+}
+
+// Adds a foreground pipeline stopped from the terminal (Ctrl-Z) to the
+// table as a stopped job. pids are the processes not reaped yet.
+void add_stopped_job(const pid_t *pids, int npids, pid_t pgid, const char *command_line) {
+    if (add_job(pids, npids, pgid, command_line) != 0) return;
+    sigset_t old;
+    block_sigchld(&old);
+    Job *job = &jobs[job_count - 1];
+    last_background_pid = job->pid;
+    if (job->status == JOB_RUNNING) {
+        job->status = JOB_STOPPED;
+    }
+    job->notified = true;
+    printf("\n[%d] Stopped %s\n", job->job_id, job->command_line);
+    restore_sigmask(&old);
+}
+
+void (*job_output_closing)(int fd) = NULL;
+
+static void close_job_output(Job *job) {
+    // An event loop watching the pipe stops first: a copy of the descriptor
+    // inherited by another job would keep it in an epoll set after close()
+    if (job_output_closing) job_output_closing(job->out_fd);
+    close(job->out_fd);
+    job->out_fd = -1;
+}
+
+// Reads what a job wrote since the last call into its buffer. A chatty job
+// gets a bounded number of reads, so it cannot keep the shell busy; closes
+// the pipe at end of file.
+static void drain_job_output(Job *job) {
+    static char buf[DRAIN_CHUNK];
+    for (int reads = 0; job->out_fd >= 0 && reads < DRAIN_READS; reads++) {
+        ssize_t n = read(job->out_fd, buf, sizeof(buf));
+        if (n > 0) {
+            ring_append(job->out, buf, (size_t)n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0 || errno != EAGAIN) {
+            close_job_output(job);
+        }
+        break;
+    }
+}
+
+// Moves the output of a job being removed to the finished list.
+static void keep_finished_output(Job *job) {
+    drain_job_output(job);
+    if (job->out_fd >= 0) {
+        close_job_output(job);
+    }
+    int slot = finished_next++ % FINISHED_OUTPUTS;
+    free(finished[slot].command_line);
+    ring_free(finished[slot].out);
+    finished[slot].job_id = job->job_id;
+    finished[slot].command_line = strdup(job->command_line);
+    finished[slot].out = job->out;
+    job->out = NULL;
+}
+
+/**
+ * @brief Captures a job's output from the read end of its output pipe.
+ * @param cap Most bytes of output kept for the job.
+ */
+void job_attach_output(int job_id, int fd, size_t cap) {
+    Job *job = NULL;
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].job_id == job_id) job = &jobs[i];
+    }
+    OutputRing *ring = job ? ring_create(cap) : NULL;
+    if (ring == NULL) {
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    job->out_fd = fd;
+    job->out = ring;
+}
+
+// True if some job's output pipe is still open.
+bool job_output_active(void) {
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].out_fd >= 0) return true;
+    }
+    return false;
+}
+
+// Stores the open output pipes of jobs in fds, for an event loop to watch.
+int job_output_fds(int *fds, int max) {
+    int n = 0;
+    for (int i = 0; i < job_count && n < max; i++) {
+        if (jobs[i].out_fd >= 0) fds[n++] = jobs[i].out_fd;
+    }
+    return n;
+}
+
+// Drains the output pipe fd, which an event loop found readable.
+void job_output_ready(int fd) {
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].out_fd == fd) {
+            drain_job_output(&jobs[i]);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief The shell's wait primitive: waits for input on fd, for a signal,
+ * or for output from a captured job, which is drained meanwhile.
+ * @param fd Descriptor to wait for, or -1.
+ * @param mask Signal mask to wait with, as for sigsuspend(), or NULL to
+ *        keep the current one.
+ * @return 1 if fd is readable, else 0: the caller checks what it is waiting
+ *         for and calls again.
+ */
+int job_events_poll(int fd, const sigset_t *mask) {
+    struct pollfd fds[MAX_JOBS + 1];
+    int n = 0;
+    if (fd >= 0) {
+        fds[n++] = (struct pollfd){ .fd = fd, .events = POLLIN };
+    }
+    int first_job = n;
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].out_fd >= 0) {
+            fds[n++] = (struct pollfd){ .fd = jobs[i].out_fd, .events = POLLIN };
+        }
+    }
+    if (n == first_job) {
+        // No output to drain: a plain wait
+        if (fd >= 0) return 1;
+        if (mask) sigsuspend(mask);
+        else pause();
+        return 0;
+    }
+    if (ppoll(fds, (nfds_t)n, NULL, mask) <= 0) {
+        return 0;
+    }
+    for (int k = first_job; k < n; k++) {
+        if (fds[k].revents == 0) continue;
+        for (int i = 0; i < job_count; i++) {
+            if (jobs[i].out_fd == fds[k].fd) {
+                drain_job_output(&jobs[i]);
+                break;
+            }
+        }
+    }
+    return fd >= 0 && fds[0].revents != 0;
+}
+
+// Function to remove a job from the jobs list
+void remove_job(int job_id) {
+    sigset_t old;
+    block_sigchld(&old);
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].job_id == job_id) {
+            if (jobs[i].out) {
+                keep_finished_output(&jobs[i]);
+            }
+            free(jobs[i].command_line);
+            free(jobs[i].pids);
+            free_command(jobs[i].queued);
+            for (int j = i; j < job_count - 1; j++) {
+                jobs[j] = jobs[j+1];
+            }
+            job_count--;
+            break;
+        }
+    }
+    restore_sigmask(&old);
+}
+
+static int decode_status(int status) {
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Reaps whatever job processes have changed state. A reaped pid is kept
+// negated in job->pids. The job's status is that of its last process, as
+// for a foreground pipeline. Only uses system calls: this is the body of
+// the SIGCHLD handler.
+static void collect_children(void) {
+    for (int i = 0; i < job_count; i++) {
+        Job *job = &jobs[i];
+        if (job->status == JOB_QUEUED || job->status == JOB_DONE) continue;
+        for (int k = 0; k < job->npids; k++) {
+            if (job->pids[k] <= 0) continue;
+            int status;
+            pid_t pid = waitpid(job->pids[k], &status, WNOHANG | WUNTRACED);
+            if (pid == 0 || (pid < 0 && errno != ECHILD)) continue;
+            if (pid > 0 && WIFSTOPPED(status)) {
+                if (job->status != JOB_STOPPED) job->notified = false;
+                job->status = JOB_STOPPED;
+                continue;
+            }
+            if (pid > 0 && k == job->npids - 1) {
+                job->exit_status = decode_status(status);
+            }
+            job->pids[k] = -job->pids[k];
+            if (--job->alive == 0) {
+                job->status = JOB_DONE;
+                job->done_seq = ++done_clock;
+            }
+        }
+    }
+}
+
+// Announces finished and newly stopped jobs if report is set, removes the
+// finished ones from the table and starts queued jobs in the slots they
+// leave.
+void reap_jobs(bool report) {
+    sigset_t old;
+    block_sigchld(&old);
+    collect_children();
+    int i = 0;
+    while (i < job_count) {
+        Job *job = &jobs[i];
+        if (job->status == JOB_DONE) {
+            if (report) printf("[%d] Done %s\n", job->job_id, job->command_line);
+            remove_job(job->job_id);
+            continue;
+        }
+        if (job->status == JOB_STOPPED && !job->notified) {
+            if (report) printf("[%d] Stopped %s\n", job->job_id, job->command_line);
+            job->notified = true;
+        }
+        i++;
+    }
+    start_queued_jobs();
+    restore_sigmask(&old);
+}
+
+// True if a job finished or stopped since it was last reported, that is,
+// if reap_jobs(true) has something to print.
+bool jobs_changed(void) {
+    sigset_t old;
+    block_sigchld(&old);
+    collect_children();
+    bool changed = false;
+    for (int i = 0; i < job_count && !changed; i++) {
+        changed = jobs[i].status == JOB_DONE ||
+                  (jobs[i].status == JOB_STOPPED && !jobs[i].notified);
+    }
+    restore_sigmask(&old);
+    return changed;
+}
+
+// Function to update the status of jobs.
+// Called before each prompt of an interactive shell.
+void update_jobs_status(void) {
+    reap_jobs(true);
+}
+
+// Number of jobs that have not finished yet.
+int active_jobs(void) {
+    sigset_t old;
+    block_sigchld(&old);
+    collect_children();
+    int n = job_count - count_jobs(JOB_DONE);
+    restore_sigmask(&old);
+    return n;
+}
+
+// Signal handler for SIGCHLD: reaps job processes as they end, so `wait`
+// and the prompt see them finish right away.
+void handle_sigchld(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    collect_children();
+    errno = saved_errno;
+}
+
+// Prints the captured output of job N, or of every job if arg is NULL.
+static int print_job_output(const char *arg) {
+    char *end;
+    long id = arg ? strtol(arg + (*arg == '%'), &end, 10) : 0;
+    if (arg && (end == arg + (*arg == '%') || *end != '\0')) {
+        fprintf(stderr, "jobs: usage: jobs [-o [%%N]]\n");
+        return 2;
+    }
+    bool found = false;
+    for (int i = 0; i < FINISHED_OUTPUTS; i++) {
+        int slot = (finished_next + i) % FINISHED_OUTPUTS;
+        if (finished[slot].out && (arg == NULL || finished[slot].job_id == id)) {
+            if (arg == NULL) printf("[%d] %s\n", finished[slot].job_id, finished[slot].command_line);
+            ring_print(finished[slot].out, stdout);
+            found = true;
+        }
+    }
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].out && (arg == NULL || jobs[i].job_id == id)) {
+            drain_job_output(&jobs[i]);
+            if (arg == NULL) printf("[%d] %s\n", jobs[i].job_id, jobs[i].command_line);
+            ring_print(jobs[i].out, stdout);
+            found = true;
+        }
+    }
+    if (!found && arg) {
+        fprintf(stderr, "ash: jobs: %s: no captured output\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
+// Runs `jobs`, or `jobs -o [N]` to print captured output.
+int builtin_jobs(char **argv) {
+    if (argv[1] && strcmp(argv[1], "-o") == 0) {
+        return print_job_output(argv[2]);
+    }
+    for (int i = 0; i < job_count; i++) {
+        const char *status_str = (jobs[i].status == JOB_RUNNING) ? "Running" :
+                                 (jobs[i].status == JOB_QUEUED) ? "Queued" :
+                                 (jobs[i].status == JOB_DONE) ? "Done" : "Stopped";
+        printf("[%d] %s %s", jobs[i].job_id, status_str, jobs[i].command_line);
+        if (jobs[i].out && ring_length(jobs[i].out) > 0) {
+            printf("  (%zu bytes of output)", ring_length(jobs[i].out));
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+static Job *find_job(int job_id) {
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].job_id == job_id) return &jobs[i];
+    }
+    return NULL;
+}
+
+// Waits with SIGCHLD blocked until a job finishes or stops. A finished job
+// is removed from the table. Returns its status, or 128+SIGTSTP if stopped.
+static int wait_for_job(Job *job, const sigset_t *old) {
+    while (job->status == JOB_RUNNING || job->status == JOB_QUEUED) {
+        wait_for_sigchld(old);
+    }
+    if (job->status == JOB_STOPPED) {
+        return 128 + SIGTSTP;
+    }
+    int status = job->exit_status;
+    remove_job(job->job_id);
+    return status;
+}
+
+// Finds the job named by a `fg`/`bg` argument, %N or N, or the most recent
+// unfinished job if there is none.
+static Job *find_job_arg(const char *name, const char *arg) {
+    if (arg == NULL) {
+        for (int i = job_count - 1; i >= 0; i--) {
+            if (jobs[i].status != JOB_DONE) return &jobs[i];
+        }
+        fprintf(stderr, "ash: %s: no current job\n", name);
+        return NULL;
+    }
+    char *end;
+    const char *digits = arg + (*arg == '%');
+    long id = strtol(digits, &end, 10);
+    Job *job = (*digits && *end == '\0') ? find_job((int)id) : NULL;
+    if (job == NULL) {
+        fprintf(stderr, "ash: %s: %s: no such job\n", name, arg);
+    }
+    return job;
+}
+
+/**
+ * @brief Runs `fg [%job]`: continues a job in the foreground and waits for
+ * it to finish or stop again.
+ *
+ * The terminal belongs to the job's group until then. A queued job starts
+ * right away, past the limit.
+ */
+int builtin_fg(char **argv) {
+    sigset_t old;
+    block_sigchld(&old);
+    Job *job = find_job_arg("fg", argv[1]);
+    if (job == NULL) {
+        restore_sigmask(&old);
+        return 1;
+    }
+    printf("%s\n", job->command_line);
+    fflush(stdout);
+    if (job->status == JOB_QUEUED) {
+        start_job(job);
+    }
+    job_terminal(job->pgid);
+    if (job->status == JOB_STOPPED) {
+        if (signal_job(job, SIGCONT) < 0) {
+            job_terminal(0);
+            restore_sigmask(&old);
+            perror("ash: fg");
+            return 1;
+        }
+        job->status = JOB_RUNNING;
+    }
+    int status = wait_for_job(job, &old);
+    job_terminal(0);
+    if (status == 128 + SIGTSTP) {
+        printf("\n[%d] Stopped %s\n", job->job_id, job->command_line);
+        job->notified = true;
+    }
+    restore_sigmask(&old);
+    return status;
+}
+
+// Runs `bg [%job]`: continues a stopped job in the background.
+int builtin_bg(char **argv) {
+    sigset_t old;
+    block_sigchld(&old);
+    Job *job = find_job_arg("bg", argv[1]);
+    if (job == NULL) {
+        restore_sigmask(&old);
+        return 1;
+    }
+    int status = 0;
+    if (job->status == JOB_QUEUED) {
+        start_job(job);
+        printf("[%d] %s\n", job->job_id, job->command_line);
+    } else if (job->status == JOB_STOPPED) {
+        if (signal_job(job, SIGCONT) < 0) {
+            perror("ash: bg");
+            status = 1;
+        } else {
+            job->status = JOB_RUNNING; // Mark as running
+            printf("[%d] %s\n", job->job_id, job->command_line);
+        }
+    }
+    restore_sigmask(&old);
+    return status;
+}
+
+// Finds the job named by a `wait` argument: %N is a job number, anything
+// else the pid of one of the job's processes.
+static Job *find_job_spec(const char *spec) {
+    char *end;
+    long n = strtol(spec + (*spec == '%'), &end, 10);
+    if (*end != '\0' || end == spec + (*spec == '%')) return NULL;
+    if (*spec == '%') return find_job((int)n);
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].pid == n && n > 0) return &jobs[i];
+        for (int k = 0; k < jobs[i].npids; k++) {
+            if (jobs[i].pids[k] == n || jobs[i].pids[k] == -n) return &jobs[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs `wait [-n] [%job|pid...]`.
+ *
+ * Without arguments, waits until every background job has finished,
+ * including the queued ones, which start as slots free up, and returns 0.
+ * With jobs or pids, waits for each in turn and returns the status of the
+ * last one, or 127 if it is unknown. With -n, returns as soon as any job
+ * finishes, with that job's status; a job that finished earlier and was not
+ * waited for yet counts, oldest first. 127 if there is no job at all.
+ *
+ * SIGCHLD stays blocked except inside sigsuspend(), where the handler reaps
+ * the processes; nothing here polls. Stopped jobs are not waited for.
+ */
+int builtin_wait(char **argv) {
+    bool any = false;
+    int first = 1;
+    if (argv[1] && strcmp(argv[1], "-n") == 0) {
+        any = true;
+        first = 2;
+    }
+
+    sigset_t old;
+    block_sigchld(&old);
+    start_queued_jobs();
+    int status = 0;
+
+    if (argv[first] != NULL) {
+        // -n with arguments: whichever of them finishes first
+        for (int i = first; argv[i]; i++) {
+            Job *job = find_job_spec(argv[i]);
+            if (job == NULL) {
+                fprintf(stderr, "ash: wait: %s: no such job\n", argv[i]);
+                status = 127;
+                continue;
+            }
+            if (!any) status = wait_for_job(job, &old);
+        }
+        while (any) {
+            Job *done = NULL;
+            bool pending = false;
+            for (int i = first; argv[i]; i++) {
+                Job *job = find_job_spec(argv[i]);
+                if (job == NULL) continue;
+                if (job->status == JOB_DONE) {
+                    if (done == NULL || job->done_seq < done->done_seq) done = job;
+                } else if (job->status != JOB_STOPPED) {
+                    pending = true;
+                }
+            }
+            if (done) {
+                status = done->exit_status;
+                remove_job(done->job_id);
+                break;
+            }
+            if (!pending) {
+                status = 127;
+                break;
+            }
+            wait_for_sigchld(&old);
+        }
+    } else if (any) {
+        for (;;) {
+            Job *done = NULL;
+            for (int i = 0; i < job_count; i++) {
+                if (jobs[i].status == JOB_DONE &&
+                    (done == NULL || jobs[i].done_seq < done->done_seq)) {
+                    done = &jobs[i];
+                }
+            }
+            if (done) {
+                status = done->exit_status;
+                remove_job(done->job_id);
+                break;
+            }
+            if (count_jobs(JOB_RUNNING) + count_jobs(JOB_QUEUED) == 0) {
+                status = 127;
+                break;
+            }
+            wait_for_sigchld(&old);
+        }
+    } else {
+        while (count_jobs(JOB_RUNNING) + count_jobs(JOB_QUEUED) > 0) {
+            wait_for_sigchld(&old);
+        }
+        for (int i = job_count - 1; i >= 0; i--) {
+            if (jobs[i].status == JOB_DONE) remove_job(jobs[i].job_id);
+        }
+    }
+
+    restore_sigmask(&old);
+    return status;
+}
+
+static const struct {
+    const char *name;
+    int sig;
+} signal_names[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM},
+    {"TERM", SIGTERM}, {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+    {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU}, {"WINCH", SIGWINCH},
+};
+
+// Parses a signal given as a number or a name, with or without "SIG".
+static int parse_signal(const char *text) {
+    char *end;
+    long n = strtol(text, &end, 10);
+    if (*text && *end == '\0') {
+        return (n >= 0 && n < NSIG) ? (int)n : -1;
+    }
+    if (strncasecmp(text, "SIG", 3) == 0) text += 3;
+    for (size_t i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); i++) {
+        if (strcasecmp(text, signal_names[i].name) == 0) return signal_names[i].sig;
+    }
+    return -1;
+}
+
+// True for a signal that neither stops nor continues a job, and is not 0.
+static bool ends_job(int sig) {
+    return sig != 0 && sig != SIGCONT && sig != SIGSTOP && sig != SIGTSTP &&
+           sig != SIGTTIN && sig != SIGTTOU;
+}
+
+/**
+ * @brief Runs `kill [-SIG | -s SIG | -n NUM] %job|pid...` and `kill -l`.
+ *
+ * A %job target signals every process of the job (its whole group under job
+ * control). A stopped job is continued after a terminating signal, so the
+ * signal is acted on right away.
+ */
+int builtin_kill(char **argv) {
+    int sig = SIGTERM;
+    int i = 1;
+    if (argv[i] && strcmp(argv[i], "-l") == 0) {
+        for (size_t k = 0; k < sizeof(signal_names) / sizeof(signal_names[0]); k++) {
+            printf("%2d) SIG%s\n", signal_names[k].sig, signal_names[k].name);
+        }
+        return 0;
+    }
+    if (argv[i] && (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "-n") == 0) && argv[i + 1]) {
+        sig = parse_signal(argv[i + 1]);
+        i += 2;
+    } else if (argv[i] && argv[i][0] == '-' && strcmp(argv[i], "--") != 0) {
+        sig = parse_signal(argv[i] + 1);
+        i++;
+    }
+    // A process group is given as "-- -pgid"
+    if (argv[i] && strcmp(argv[i], "--") == 0) i++;
+    if (sig < 0 || argv[i] == NULL) {
+        fprintf(stderr, "kill: usage: kill [-s sigspec | -n signum | -sigspec] pid | %%job ...\n");
+        return 2;
+    }
+
+    int status = 0;
+    sigset_t old;
+    block_sigchld(&old);
+    for (; argv[i]; i++) {
+        if (argv[i][0] == '%') {
+            Job *job = find_job_spec(argv[i]);
+            if (job == NULL || job->status == JOB_DONE) {
+                fprintf(stderr, "ash: kill: %s: no such job\n", argv[i]);
+                status = 1;
+                continue;
+            }
+            if (job->status == JOB_QUEUED) {
+                // Nothing runs yet: SIGCONT starts the job, and a signal
+                // that would end it takes it off the queue
+                if (sig == SIGCONT) {
+                    start_job(job);
+                } else if (ends_job(sig)) {
+                    free_command(job->queued);
+                    job->queued = NULL;
+                    job->exit_status = 128 + sig;
+                    job->status = JOB_DONE;
+                    job->done_seq = ++done_clock;
+                }
+            } else if (signal_job(job, sig) < 0) {
+                fprintf(stderr, "ash: kill: %s: %s\n", argv[i], strerror(errno));
+                status = 1;
+            } else if (job->status == JOB_STOPPED && ends_job(sig)) {
+                signal_job(job, SIGCONT);
+            }
+            continue;
+        }
+        char *end;
+        long pid = strtol(argv[i], &end, 10);
+        if (*end != '\0' || end == argv[i]) {
+            fprintf(stderr, "ash: kill: %s: arguments must be process or job IDs\n", argv[i]);
+            status = 1;
+        } else if (kill((pid_t)pid, sig) < 0) {
+            fprintf(stderr, "ash: kill: (%ld) - %s\n", pid, strerror(errno));
+            status = 1;
+        }
+    }
+    restore_sigmask(&old);
+    return status;
+}
+
+// Parses a CPU list such as "0-3,8,10-11".
+static bool parse_cpu_list(const char *text, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = text;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE) return false;
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE) return false;
+        }
+        for (long cpu = first; cpu <= last; cpu++) CPU_SET((int)cpu, set);
+        if (*end == ',') end++;
+        else if (*end != '\0') return false;
+        p = end;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+static void print_cpu_list(FILE *out, const cpu_set_t *set) {
+    bool first = true;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, set)) continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) last++;
+        fprintf(out, first ? "%d" : ",%d", cpu);
+        if (last > cpu) fprintf(out, "-%d", last);
+        first = false;
+        cpu = last;
+    }
+}
+
+static int joblimit_usage(void) {
+    fprintf(stderr, "joblimit: usage: joblimit [N] [-a none|spread|pin] [-c cpu-list]\n");
+    return 2;
+}
+
+/**
+ * @brief Runs `joblimit [N] [-a none|spread|pin] [-c cpu-list]`.
+ *
+ * N caps the number of background jobs running at once (0 removes the cap).
+ * -a spread gives each job process one CPU, round-robin over the CPU set;
+ * -a pin restricts every process to the whole set. The set is the CPUs the
+ * shell may run on, or the -c list, which alone implies pin. Without
+ * arguments the current settings are printed.
+ */
+int builtin_joblimit(char **argv) {
+    place_cpus_init();
+    if (argv[1] == NULL) {
+        printf("limit: ");
+        if (job_limit > 0) printf("%d", job_limit);
+        else printf("none");
+        printf("  running: %d  queued: %d  placement: %s  cpus: ",
+               count_jobs(JOB_RUNNING), count_jobs(JOB_QUEUED),
+               placement == PLACE_SPREAD ? "spread" : placement == PLACE_PIN ? "pin" : "none");
+        print_cpu_list(stdout, &place_cpus);
+        printf("\n");
+        return 0;
+    }
+
+    int limit = job_limit;
+    Placement mode = placement;
+    bool mode_given = false;
+    cpu_set_t cpus = place_cpus;
+    for (int i = 1; argv[i]; i++) {
+        if (strcmp(argv[i], "-a") == 0 && argv[i + 1]) {
+            const char *name = argv[++i];
+            if (strcmp(name, "none") == 0) mode = PLACE_NONE;
+            else if (strcmp(name, "spread") == 0) mode = PLACE_SPREAD;
+            else if (strcmp(name, "pin") == 0) mode = PLACE_PIN;
+            else return joblimit_usage();
+            mode_given = true;
+        } else if (strcmp(argv[i], "-c") == 0 && argv[i + 1]) {
+            if (!parse_cpu_list(argv[++i], &cpus)) {
+                fprintf(stderr, "joblimit: invalid CPU list: %s\n", argv[i]);
+                return 1;
+            }
+            if (!mode_given && mode == PLACE_NONE) mode = PLACE_PIN;
+        } else {
+            char *end;
+            long n = strtol(argv[i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n < 0) return joblimit_usage();
+            limit = (int)n;
+        }
+    }
+
+    job_limit = limit;
+    placement = mode;
+    place_cpus = cpus;
+    place_next = 0;
+    // A higher limit may let queued jobs start now
+    start_queued_jobs();
+    return 0;
+}
@@ -0,0 +1,429 @@
+// parallel.c - Built-in `parallel` executor for ash shell
+// Fans a command template out over many arguments using a fixed number of
+// worker slots. Each slot owns a deque of pending jobs; an idle slot with an
+// empty deque steals from the back of the busiest one, so slow jobs never
+// leave the other slots idle. Job output is buffered per job and printed
+// either as jobs finish or in argument order (-k).
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../include/parallel.h"
+#include "../include/parser.h"
+#include "../include/executor.h"
+#include "../include/jobs.h"
+#include "../include/trace.h"
+
+#define PAR_READ_CHUNK 65536
+#define PAR_MAX_STATUS 101
+
+// A growable output buffer for one stream of one job.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} ParBuffer;
+
+// One invocation of the command template with a single argument.
+typedef struct {
+    const char *arg;
+    pid_t pid;
+    int out_fd;           // Read end of the job's stdout pipe, -1 when closed
+    int err_fd;           // Read end of the job's stderr pipe, -1 when closed
+    ParBuffer out;
+    ParBuffer err;
+    int status;
+    bool done;
+} ParJob;
+
+// A worker slot: a deque of job indices [head, tail) and the running job.
+typedef struct {
+    size_t *items;
+    size_t head;
+    size_t tail;
+    long running;         // Index of the running job, -1 if idle
+} ParSlot;
+
+static void par_buffer_append(ParBuffer *buf, const char *data, size_t len) {
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len) cap *= 2;
+        char *tmp = realloc(buf->data, cap);
+        if (!tmp) {
+            perror("ash: parallel");
+            return;
+        }
+        buf->data = tmp;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void par_buffer_free(ParBuffer *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+}
+
+/**
+ * @brief Reads the argument list from standard input, one argument per line.
+ * @param buf_out Receives the buffer backing the returned strings.
+ * @param count_out Receives the number of arguments.
+ * @return A newly allocated array of pointers into *buf_out.
+ */
+static const char **par_read_stdin_args(char **buf_out, size_t *count_out) {
+    ParBuffer in = {0};
+    char chunk[PAR_READ_CHUNK];
+    ssize_t n;
+    for (;;) {
+        n = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        par_buffer_append(&in, chunk, (size_t)n);
+    }
+    par_buffer_append(&in, "", 1);
+
+    size_t cap = 64, count = 0;
+    const char **args = malloc(cap * sizeof(char *));
+    if (!args) {
+        perror("ash: parallel");
+        exit(1);
+    }
+    char *line = in.data;
+    while (line && *line) {
+        char *nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+        if (*line) {
+            if (count == cap) {
+                cap *= 2;
+                const char **tmp = realloc(args, cap * sizeof(char *));
+                if (!tmp) {
+                    perror("ash: parallel");
+                    exit(1);
+                }
+                args = tmp;
+            }
+            args[count++] = line;
+        }
+        line = nl ? nl + 1 : NULL;
+    }
+    *buf_out = in.data;
+    *count_out = count;
+    return args;
+}
+
+/**
+ * @brief Replaces every "{}" in a template word with the job argument.
+ * @return A newly allocated string.
+ */
+static char *par_substitute(const char *word, const char *arg) {
+    size_t arg_len = strlen(arg);
+    size_t len = 0;
+    for (const char *p = word; *p; ) {
+        if (p[0] == '{' && p[1] == '}') { len += arg_len; p += 2; }
+        else { len++; p++; }
+    }
+    char *out = malloc(len + 1);
+    if (!out) {
+        perror("ash: parallel");
+        exit(1);
+    }
+    char *w = out;
+    for (const char *p = word; *p; ) {
+        if (p[0] == '{' && p[1] == '}') { memcpy(w, arg, arg_len); w += arg_len; p += 2; }
+        else { *w++ = *p++; }
+    }
+    *w = '\0';
+    return out;
+}
+
+/**
+ * @brief Runs one job inside the forked child. Never returns.
+ *
+ * The template tokens get the argument substituted in place (or appended when
+ * the template has no "{}"), so arguments are never re-tokenized. A single
+ * external command is exec'd directly by execute_commands_and_exit();
+ * anything else (pipelines, builtins, separators) goes through the regular
+ * executor.
+ */
+static void par_run_child(TokenList *tmpl, const char *arg, bool has_placeholder) {
+    TokenList tokens = {NULL, NULL};
+    size_t line_len = 1;
+    for (Token *t = tmpl->head; t; t = t->next) {
+        char *value = par_substitute(t->value, arg);
+        add_token(&tokens, value);
+        line_len += strlen(value) + 1;
+        free(value);
+    }
+    if (!has_placeholder) {
+        add_token(&tokens, arg);
+        line_len += strlen(arg) + 1;
+    }
+
+    char *line = malloc(line_len);
+    if (!line) _exit(1);
+    line[0] = '\0';
+    for (Token *t = tokens.head; t; t = t->next) {
+        strcat(line, t->value);
+        if (t->next) strcat(line, " ");
+    }
+
+    Command *cmd = parse_command(&tokens);
+    if (!cmd) _exit(0);
+    execute_commands_and_exit(cmd, line);
+}
+
+static bool par_spawn(ParJob *job, TokenList *tmpl, bool has_placeholder) {
+    int out_pipe[2], err_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) == -1) {
+        perror("ash: parallel: pipe");
+        return false;
+    }
+    if (pipe2(err_pipe, O_CLOEXEC) == -1) {
+        perror("ash: parallel: pipe");
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return false;
+    }
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("ash: parallel: fork");
+        close(out_pipe[0]); close(out_pipe[1]);
+        close(err_pipe[0]); close(err_pipe[1]);
+        return false;
+    }
+    if (pid == 0) {
+        TRACE_AFTER_FORK();
+        signal(SIGINT, SIG_DFL);
+        // A job is one process of the parallel command, not a job of its own
+        job_signals(false);
+        job_control = false;
+        job_table_clear();
+        dup2(out_pipe[1], STDOUT_FILENO);
+        dup2(err_pipe[1], STDERR_FILENO);
+        int devnull = open("/dev/null", O_RDONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDIN_FILENO);
+            close(devnull);
+        }
+        par_run_child(tmpl, job->arg, has_placeholder);
+    }
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+    job->pid = pid;
+    job->out_fd = out_pipe[0];
+    job->err_fd = err_pipe[0];
+    return true;
+}
+
+/**
+ * @brief Takes the next job for a slot: its own front first, otherwise the
+ * back of the slot with the most pending work.
+ * @return The job index, or -1 when no work is left anywhere.
+ */
+static long par_take_work(ParSlot *slots, int nslots, int self) {
+    ParSlot *own = &slots[self];
+    if (own->head < own->tail) {
+        return (long)own->items[own->head++];
+    }
+    int victim = -1;
+    size_t most = 0;
+    for (int i = 0; i < nslots; i++) {
+        size_t pending = slots[i].tail - slots[i].head;
+        if (pending > most) {
+            most = pending;
+            victim = i;
+        }
+    }
+    if (victim < 0) return -1;
+    return (long)slots[victim].items[--slots[victim].tail];
+}
+
+static void par_emit(ParJob *job) {
+    if (job->out.len) fwrite(job->out.data, 1, job->out.len, stdout);
+    if (job->err.len) fwrite(job->err.data, 1, job->err.len, stderr);
+    fflush(stdout);
+    fflush(stderr);
+    par_buffer_free(&job->out);
+    par_buffer_free(&job->err);
+}
+
+// Drains whatever is readable on one job pipe; closes it at EOF.
+static void par_drain(int *fd, ParBuffer *buf) {
+    char chunk[PAR_READ_CHUNK];
+    ssize_t n = read(*fd, chunk, sizeof(chunk));
+    if (n > 0) {
+        par_buffer_append(buf, chunk, (size_t)n);
+    } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+static void par_usage(void) {
+    fprintf(stderr, "parallel: usage: parallel [-j N] [-k] command [args...] [::: arg...]\n");
+}
+
+int builtin_parallel(char **argv) {
+    long nslots = sysconf(_SC_NPROCESSORS_ONLN);
+    bool keep_order = false;
+    int i = 1;
+
+    while (argv[i] && argv[i][0] == '-') {
+        if (strcmp(argv[i], "--") == 0) { i++; break; }
+        if (strcmp(argv[i], "-k") == 0) {
+            keep_order = true;
+        } else if (strcmp(argv[i], "-j") == 0 && argv[i + 1]) {
+            nslots = atol(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) {
+            nslots = atol(argv[i] + 2);
+        } else {
+            par_usage();
+            return 1;
+        }
+        i++;
+    }
+
+    int tmpl_start = i;
+    while (argv[i] && strcmp(argv[i], ":::") != 0) i++;
+    int tmpl_end = i;
+    if (tmpl_end == tmpl_start) {
+        par_usage();
+        return 1;
+    }
+
+    // Collect the arguments, either after ':::' or from stdin.
+    const char **args;
+    size_t nargs;
+    char *stdin_buf = NULL;
+    if (argv[i]) {
+        args = (const char **)&argv[i + 1];
+        for (nargs = 0; args[nargs]; nargs++) {}
+    } else {
+        args = par_read_stdin_args(&stdin_buf, &nargs);
+    }
+    if (nargs == 0) {
+        if (stdin_buf) { free(args); free(stdin_buf); }
+        return 0;
+    }
+    if (nslots <= 0 || (size_t)nslots > nargs) nslots = (long)nargs;
+
+    // A single template word containing spaces is a full command line
+    // ("gzip {} | wc -c"); otherwise every word is one token.
+    TokenList tmpl = {NULL, NULL};
+    if (tmpl_end - tmpl_start == 1 && strpbrk(argv[tmpl_start], " \t|;&<>")) {
+        tmpl = tokenize(argv[tmpl_start]);
+    } else {
+        for (int w = tmpl_start; w < tmpl_end; w++) add_token(&tmpl, argv[w]);
+    }
+    bool has_placeholder = false;
+    for (Token *t = tmpl.head; t; t = t->next) {
+        if (strstr(t->value, "{}")) has_placeholder = true;
+    }
+
+    ParJob *jobs = calloc(nargs, sizeof(ParJob));
+    ParSlot *slots = calloc((size_t)nslots, sizeof(ParSlot));
+    size_t *items = malloc(nargs * sizeof(size_t));
+    struct pollfd *pfds = malloc((size_t)nslots * 2 * sizeof(struct pollfd));
+    if (!jobs || !slots || !items || !pfds) {
+        perror("ash: parallel");
+        exit(1);
+    }
+
+    // Deal jobs round-robin so the front of every deque stays close to the
+    // front of the argument list, which keeps ordered output flowing.
+    size_t per_slot = (nargs + (size_t)nslots - 1) / (size_t)nslots;
+    for (long s = 0; s < nslots; s++) {
+        slots[s].items = items + (size_t)s * per_slot;
+        slots[s].running = -1;
+    }
+    for (size_t j = 0; j < nargs; j++) {
+        ParSlot *slot = &slots[j % (size_t)nslots];
+        slot->items[slot->tail++] = j;
+        jobs[j].arg = args[j];
+        jobs[j].out_fd = jobs[j].err_fd = -1;
+    }
+
+    size_t completed = 0, next_to_print = 0;
+    int failed = 0;
+    while (completed < nargs) {
+        // Give every idle slot a job, stealing when its own deque is empty.
+        for (long s = 0; s < nslots; s++) {
+            if (slots[s].running >= 0) continue;
+            long idx = par_take_work(slots, (int)nslots, (int)s);
+            if (idx < 0) continue;
+            if (!par_spawn(&jobs[idx], &tmpl, has_placeholder)) {
+                jobs[idx].done = true;
+                jobs[idx].status = 1;
+                failed++;
+                completed++;
+                continue;
+            }
+            slots[s].running = idx;
+        }
+
+        nfds_t npfds = 0;
+        for (long s = 0; s < nslots; s++) {
+            if (slots[s].running < 0) continue;
+            ParJob *job = &jobs[slots[s].running];
+            if (job->out_fd >= 0) pfds[npfds++] = (struct pollfd){job->out_fd, POLLIN, 0};
+            if (job->err_fd >= 0) pfds[npfds++] = (struct pollfd){job->err_fd, POLLIN, 0};
+        }
+        if (npfds > 0 && poll(pfds, npfds, -1) < 0 && errno != EINTR) {
+            perror("ash: parallel: poll");
+            break;
+        }
+
+        for (long s = 0; s < nslots; s++) {
+            if (slots[s].running < 0) continue;
+            ParJob *job = &jobs[slots[s].running];
+            for (nfds_t p = 0; p < npfds; p++) {
+                if (!pfds[p].revents) continue;
+                if (pfds[p].fd == job->out_fd) par_drain(&job->out_fd, &job->out);
+                else if (pfds[p].fd == job->err_fd) par_drain(&job->err_fd, &job->err);
+            }
+            if (job->out_fd >= 0 || job->err_fd >= 0) continue;
+
+            // Both streams hit EOF: reap the job and free the slot.
+            int status = 0;
+            while (waitpid(job->pid, &status, 0) < 0 && errno == EINTR) {}
+            job->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            job->done = true;
+            if (job->status != 0) failed++;
+            completed++;
+            slots[s].running = -1;
+            if (!keep_order) par_emit(job);
+        }
+
+        if (keep_order) {
+            while (next_to_print < nargs && jobs[next_to_print].done) {
+                par_emit(&jobs[next_to_print++]);
+            }
+        }
+    }
+
+    free_tokens(&tmpl);
+    free(pfds);
+    free(items);
+    free(slots);
+    free(jobs);
+    if (stdin_buf) {
+        free(args);
+        free(stdin_buf);
+    }
+    return failed > PAR_MAX_STATUS ? PAR_MAX_STATUS : failed;
+}
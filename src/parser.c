@@ -1,30 +1,56 @@
 // parser.c - Implements the full parsing logic for the shell.
 
 #include "../include/parser.h"
-#include "../include/vars.h"
+#include "../include/trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <fcntl.h>
 
-/**
- * @brief Adds a new token with the given value to the token list.
- * @param list The TokenList to add the token to.
- * @param value The string value for the new token.
- */
-void add_token(TokenList *list, const char *value) {
+// Returns value in single quotes if expansion would otherwise change it.
+static char *quote_word(const char *value) {
+    if (strpbrk(value, "$`'\"\\") == NULL) {
+        return strdup(value);
+    }
+    size_t len = 2;
+    for (const char *p = value; *p; p++) len += (*p == '\'') ? 4 : 1;
+    char *quoted = malloc(len + 1);
+    if (!quoted) return NULL;
+    char *w = quoted;
+    *w++ = '\'';
+    for (const char *p = value; *p; p++) {
+        if (*p == '\'') {
+            memcpy(w, "'\\''", 4);
+            w += 4;
+        } else {
+            *w++ = *p;
+        }
+    }
+    *w++ = '\'';
+    *w = '\0';
+    return quoted;
+}
+
+// Appends a token; raw is taken over, or derived from value when NULL.
+static void append_token(TokenList *list, const char *value, char *raw) {
     Token *new_token = malloc(sizeof(Token));
     if (!new_token) {
         perror("ash: malloc");
+        free(raw);
         return;
     }
     new_token->value = strdup(value);
-    if (!new_token->value) {
+    new_token->raw = raw ? raw : quote_word(value);
+    if (!new_token->value || !new_token->raw) {
         perror("ash: strdup");
+        free(new_token->value);
+        free(new_token->raw);
         free(new_token);
         return;
     }
+    new_token->quoted = false;
     new_token->next = NULL;
 
     if (list->head == NULL) {
@@ -36,6 +62,91 @@ void add_token(TokenList *list, const char *value) {
     }
 }
 
+/**
+ * @brief Adds a new token with the given value to the token list.
+ *
+ * The value is used literally: its raw form is quoted where needed so that
+ * expansion reproduces it unchanged.
+ *
+ * @param list The TokenList to add the token to.
+ * @param value The string value for the new token.
+ */
+void add_token(TokenList *list, const char *value) {
+    append_token(list, value, NULL);
+}
+
+// Adds the buffered characters as a token, remembering whether they were
+// quoted and the word as typed (from word_start up to end).
+static void flush_token(TokenList *list, char *buffer, int *buf_idx, bool *quoted,
+                        const char **word_start, const char *end) {
+    if (*buf_idx > 0 || *quoted) {
+        buffer[*buf_idx] = '\0';
+        char *raw = *word_start ? strndup(*word_start, end - *word_start) : NULL;
+        append_token(list, buffer, raw);
+        if (list->tail) list->tail->quoted = *quoted;
+        *buf_idx = 0;
+    }
+    *quoted = false;
+    *word_start = NULL;
+}
+
+// Returns the position just past the ')' matching the '(' at p. Quotes,
+// escapes and nested substitutions inside are skipped, so a ')' in them
+// does not count; an unterminated group runs to the terminating NUL.
+static const char *skip_parens(const char *p) {
+    int depth = 0;
+    while (*p) {
+        if (*p == '\\' && p[1]) {
+            p += 2;
+        } else if (*p == '\'') {
+            const char *close = strchr(p + 1, '\'');
+            p = close ? close + 1 : p + strlen(p);
+        } else if (*p == '"') {
+            p++;
+            while (*p && *p != '"') {
+                if (*p == '\\' && p[1]) {
+                    p += 2;
+                } else if ((*p == '$' && p[1] == '(') || *p == '`') {
+                    p = skip_substitution(p);
+                } else {
+                    p++;
+                }
+            }
+            if (*p) p++;
+        } else if (*p == '`') {
+            p = skip_substitution(p);
+        } else {
+            if (*p == '(') {
+                depth++;
+            } else if (*p == ')' && --depth == 0) {
+                return p + 1;
+            }
+            p++;
+        }
+    }
+    return p;
+}
+
+/**
+ * @brief Finds the end of a command substitution or arithmetic expansion.
+ *
+ * Quotes, escapes and nested substitutions inside are skipped, so a ')' or
+ * '`' in them does not end the outer one.
+ *
+ * @param p Points at "$(", "$((" or at an opening backtick.
+ * @return Pointer just past the closing ')' or '`', or to the terminating
+ *         NUL if the substitution is unterminated.
+ */
+const char *skip_substitution(const char *p) {
+    if (*p == '`') {
+        for (p++; *p && *p != '`'; p++) {
+            if (*p == '\\' && p[1]) p++;
+        }
+        return *p ? p + 1 : p;
+    }
+    return skip_parens(p + 1);
+}
+
 /**
  * @brief Tokenizes a command line string, respecting single quotes, double quotes, and backslash escapes.
  *
@@ -45,6 +156,9 @@ void add_token(TokenList *list, const char *value) {
  * - STATE_DOUBLE_QUOTE: Characters are literal, except for backslashes that can escape a few specific characters and the dollar sign for variable expansion.
  *
  * This improved version correctly handles command separators like '|', '&', etc., as separate tokens, even without surrounding whitespace.
+ * Command substitutions ("$(...)" and backticks), arithmetic expansions and
+ * ((expression)) commands are kept whole, so the separators and quotes
+ * inside them belong to the inner command or expression.
  *
  * @param input The command line string to tokenize.
  * @return A TokenList containing the parsed tokens.
@@ -55,16 +169,24 @@ TokenList tokenize(const char *input) {
         return list;
     }
     
-    // Create a mutable copy of the input string to work with
+    TRACE_BEGIN("tokenize");
+    // Create a mutable copy of the input string to work with. No word can
+    // be longer than the input, so that also sizes the token buffer.
+    size_t input_len = strlen(input);
     char *str = strdup(input);
-    if (!str) {
+    char *buffer = malloc(input_len + 16);
+    if (!str || !buffer) {
         perror("ash: strdup");
+        free(str);
+        free(buffer);
+        TRACE_END("tokenize");
         return list;
     }
     
     char *p = str;
-    char buffer[1024]; // A temporary buffer for building tokens
     int buf_idx = 0;
+    bool buf_quoted = false;
+    const char *word_start = NULL; // Where the current word starts in str
 
     enum {
         STATE_NORMAL,
@@ -74,62 +196,76 @@ TokenList tokenize(const char *input) {
 
     while (*p) {
         if (state == STATE_NORMAL) {
+            bool is_operator = (*p == '|' || *p == '<' || *p == '>' || *p == '&' || *p == ';');
+            if (!isspace((unsigned char)*p) && !is_operator && word_start == NULL) {
+                word_start = p;
+            }
             // Handle whitespace as a token separator
-            if (isspace(*p)) {
-                if (buf_idx > 0) {
-                    buffer[buf_idx] = '\0';
-                    add_token(&list, buffer);
-                    buf_idx = 0;
-                }
+            if (isspace((unsigned char)*p)) {
+                flush_token(&list, buffer, &buf_idx, &buf_quoted, &word_start, p);
             } else if (*p == '\'') {
                 // Enter single quote state
-                if (buf_idx > 0) {
-                    buffer[buf_idx] = '\0';
-                    add_token(&list, buffer);
-                    buf_idx = 0;
-                }
+                buf_quoted = true;
                 state = STATE_SINGLE_QUOTE;
             } else if (*p == '\"') {
                 // Enter double quote state
-                if (buf_idx > 0) {
-                    buffer[buf_idx] = '\0';
-                    add_token(&list, buffer);
-                    buf_idx = 0;
-                }
+                buf_quoted = true;
                 state = STATE_DOUBLE_QUOTE;
             } else if (*p == '\\') {
                 // Handle backslash escape - append to current buffer
                 p++; // Move past the backslash
+                buf_quoted = true;
                 if (*p) { // If there's a character to escape, add it
-                    if (buf_idx < sizeof(buffer) - 1) {
-                         buffer[buf_idx++] = *p;
-                    }
+                    buffer[buf_idx++] = *p;
+                } else {
+                    break;
                 }
-            } else if (*p == '|' || *p == '<' || *p == '>' || *p == '&' || *p == ';') {
-                // Handle special characters as separate tokens
-                if (buf_idx > 0) {
-                    buffer[buf_idx] = '\0';
-                    add_token(&list, buffer);
+            } else if ((*p == '$' && p[1] == '(') || *p == '`' ||
+                       (p == word_start && p[0] == '(' && p[1] == '(')) {
+                // Copy the whole substitution or ((expression)) command; it
+                // is expanded at run time
+                const char *end = (*p == '(') ? skip_parens(p) : skip_substitution(p);
+                memcpy(buffer + buf_idx, p, end - p);
+                buf_idx += (int)(end - p);
+                p += (end - p) - 1; // The loop advances past the last character
+            } else if (is_operator) {
+                // Handle special characters as separate tokens. Digits directly
+                // in front of '<' or '>' are the fd number of a redirection
+                // ('2>', '3<>'), not a separate word.
+                char op[16];
+                int op_len = 0;
+                buffer[buf_idx] = '\0';
+                if ((*p == '<' || *p == '>') && buf_idx > 0 && buf_idx < 8 && !buf_quoted &&
+                    strspn(buffer, "0123456789") == (size_t)buf_idx) {
+                    memcpy(op, buffer, buf_idx);
+                    op_len = buf_idx;
                     buf_idx = 0;
                 }
-                
-                // Handle multi-character operators like '&&', '||', and '>>'
-                if ((*p == '&' && *(p+1) == '&') || (*p == '|' && *(p+1) == '|') || (*p == '>' && *(p+1) == '>')) {
-                    buffer[0] = *p;
-                    buffer[1] = *(p+1);
-                    buffer[2] = '\0';
-                    add_token(&list, buffer);
-                    p++; // Move past the second character of the operator
-                } else {
-                    buffer[0] = *p;
-                    buffer[1] = '\0';
-                    add_token(&list, buffer);
+                flush_token(&list, buffer, &buf_idx, &buf_quoted, &word_start, p);
+
+                // Operators, longest match first:
+                // '<<<' '<<-' '<<' '<>' '<&' '<'  '>>' '>&' '>|' '>'
+                // '&&' '&>>' '&>' '&'  '||' '|'  ';'
+                static const char *operators[] = {
+                    "<<<", "<<-", "<<", "<>", "<&", "<",
+                    ">>", ">&", ">|", ">",
+                    "&&", "&>>", "&>", "&",
+                    "||", "|", ";", NULL
+                };
+                for (int k = 0; operators[k]; k++) {
+                    size_t len = strlen(operators[k]);
+                    if (strncmp(p, operators[k], len) == 0) {
+                        memcpy(op + op_len, operators[k], len);
+                        op_len += (int)len;
+                        p += len - 1; // The loop advances past the last character
+                        break;
+                    }
                 }
+                op[op_len] = '\0';
+                add_token(&list, op);
             } else {
                 // Append regular characters to the token buffer
-                if (buf_idx < sizeof(buffer) - 1) {
-                    buffer[buf_idx++] = *p;
-                }
+                buffer[buf_idx++] = *p;
             }
         } else if (state == STATE_SINGLE_QUOTE) {
             if (*p == '\'') {
@@ -137,9 +273,7 @@ TokenList tokenize(const char *input) {
                 state = STATE_NORMAL;
             } else {
                 // Add all characters literally
-                if (buf_idx < sizeof(buffer) - 1) {
-                    buffer[buf_idx++] = *p;
-                }
+                buffer[buf_idx++] = *p;
             }
         } else if (state == STATE_DOUBLE_QUOTE) {
             if (*p == '\"') {
@@ -148,14 +282,15 @@ TokenList tokenize(const char *input) {
             } else if (*p == '\\' && (*(p+1) == '\"' || *(p+1) == '$' || *(p+1) == '`' || *(p+1) == '\\')) {
                 // Handle specific backslash escapes within double quotes
                 p++;
-                if (buf_idx < sizeof(buffer) - 1) {
-                    buffer[buf_idx++] = *p;
-                }
+                buffer[buf_idx++] = *p;
+            } else if ((*p == '$' && p[1] == '(') || *p == '`') {
+                const char *end = skip_substitution(p);
+                memcpy(buffer + buf_idx, p, end - p);
+                buf_idx += (int)(end - p);
+                p += (end - p) - 1;
             } else {
                 // Add all other characters
-                if (buf_idx < sizeof(buffer) - 1) {
-                    buffer[buf_idx++] = *p;
-                }
+                buffer[buf_idx++] = *p;
             }
         }
         
@@ -164,12 +299,11 @@ TokenList tokenize(const char *input) {
     }
 
     // Add any remaining characters in the buffer as the final token
-    if (buf_idx > 0) {
-        buffer[buf_idx] = '\0';
-        add_token(&list, buffer);
-    }
+    flush_token(&list, buffer, &buf_idx, &buf_quoted, &word_start, p);
     
+    free(buffer);
     free(str);
+    TRACE_END("tokenize");
     return list;
 }
 
@@ -182,6 +316,7 @@ void free_tokens(TokenList *tokens) {
     while (current != NULL) {
         Token *next = current->next;
         free(current->value);
+        free(current->raw);
         free(current);
         current = next;
     }
@@ -189,177 +324,417 @@ void free_tokens(TokenList *tokens) {
     tokens->tail = NULL;
 }
 
-// Global variable to hold the shell's name (e.g., from argv[0] in main)
-extern char *shell_name;
+// Appends a new redirection to the end of the command's list.
+static Redir *add_redir(Command *cmd, RedirKind kind, int fd) {
+    Redir *redir = calloc(1, sizeof(Redir));
+    if (redir == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    redir->kind = kind;
+    redir->fd = fd;
+    Redir **tail = &cmd->redirs;
+    while (*tail) tail = &(*tail)->next;
+    *tail = redir;
+    return redir;
+}
 
 /**
- * @brief Expands shell variables in a token string.
+ * @brief Parses a redirection operator and its target word, if the token is one.
  *
- * This function handles simple variable expansion in the form of `$VARIABLE`.
- * It now also handles special shell parameters like `$0`.
- * It allocates a new string to hold the expanded value.
+ * Accepts an optional fd number prefix ("2>", "3<>", "4<&") on '<', '>',
+ * '>>', '>|', '<>', '<&', '>&', '<<', '<<-' and '<<<', plus '&>' and '&>>'
+ * for stdout and stderr together. '>&-' closes the fd, '>&N' duplicates fd N.
  *
- * @param token_value The token string to expand.
- * @return A newly allocated string with variables expanded.
+ * @param cmd The command the redirection belongs to.
+ * @param token_ptr Points to the current token; advanced past the target word.
+ * @param error Set after printing a syntax error, such as a missing target.
+ * @return True if the token was a redirection operator.
  */
-char* expand_variables(const char* token_value) {
-    // If the token is NULL or doesn't contain a '$', just return a copy.
-    if (!token_value || !strchr(token_value, '$')) {
-        return strdup(token_value);
+static bool parse_redirection(Command *cmd, Token **token_ptr, bool *error) {
+    Token *token = *token_ptr;
+    if (token->quoted) {
+        return false;
+    }
+    const char *p = token->value;
+    int fd = -1;
+    if (isdigit((unsigned char)*p)) {
+        fd = 0;
+        while (isdigit((unsigned char)*p)) fd = fd * 10 + (*p++ - '0');
+    }
+    if (*p != '<' && *p != '>' && strcmp(p, "&>") != 0 && strcmp(p, "&>>") != 0) {
+        return false;
+    }
+    Token *target = token->next;
+    if (target == NULL || (!target->quoted && strchr("|&;<>", target->value[0]))) {
+        fprintf(stderr, "ash: syntax error near unexpected token `%s'\n", target ? target->value : "newline");
+        *error = true;
+        return true;
     }
+    *token_ptr = target;
 
-    char expanded_buffer[4096] = {0}; // Large buffer for expanded string
-    char *write_ptr = expanded_buffer;
-    const char *read_ptr = token_value;
-    
-    while (*read_ptr) {
-        if (*read_ptr == '$') {
-            read_ptr++; // Move past the '$'
-            
-            // Check for special parameters like $0
-            if (*read_ptr == '0') {
-                read_ptr++;
-                if (shell_name) {
-                    strcpy(write_ptr, shell_name);
-                    write_ptr += strlen(shell_name);
-                }
-            } else {
-                // Find the end of the variable name
-                const char *var_start = read_ptr;
-                while (*read_ptr && (isalnum(*read_ptr) || *read_ptr == '_')) {
-                    read_ptr++;
-                }
-                
-                size_t var_name_len = read_ptr - var_start;
-                if (var_name_len > 0) {
-                    char var_name[var_name_len + 1];
-                    strncpy(var_name, var_start, var_name_len);
-                    var_name[var_name_len] = '\0';
-                    
-                    // Get the value from the environment
-                    char *var_value = getenv(var_name);
-                    
-                    if (var_value) {
-                        strcpy(write_ptr, var_value);
-                        write_ptr += strlen(var_value);
-                    }
-                } else {
-                    // If there's a '$' but no variable name, just copy the '$'
-                    *write_ptr++ = '$';
-                }
-            }
+    if (strcmp(p, "<<") == 0 || strcmp(p, "<<-") == 0) {
+        // The body follows on the next input lines; collect_heredocs() reads it.
+        Redir *redir = add_redir(cmd, REDIR_HEREDOC, fd < 0 ? 0 : fd);
+        redir->delim = strdup(target->value);
+        redir->strip_tabs = (p[2] == '-');
+        redir->expand = !target->quoted;
+    } else if (strcmp(p, "<<<") == 0) {
+        add_redir(cmd, REDIR_HERESTRING, fd < 0 ? 0 : fd)->word = strdup(target->raw);
+    } else if (strcmp(p, "<&") == 0 || strcmp(p, ">&") == 0) {
+        int dst = fd >= 0 ? fd : (*p == '<' ? 0 : 1);
+        if (strcmp(target->value, "-") == 0) {
+            add_redir(cmd, REDIR_CLOSE, dst);
+        } else if (*target->value && strspn(target->value, "0123456789") == strlen(target->value)) {
+            add_redir(cmd, REDIR_DUP, dst)->src_fd = atoi(target->value);
+        } else {
+            fprintf(stderr, "ash: %s: ambiguous redirect\n", target->value);
+            *error = true;
+        }
+    } else if (*p == '&') {
+        // '&>file' and '&>>file': stdout to the file, then stderr to stdout
+        Redir *redir = add_redir(cmd, REDIR_OPEN, 1);
+        redir->word = strdup(target->raw);
+        redir->flags = O_WRONLY | O_CREAT | (p[2] == '>' ? O_APPEND : O_TRUNC);
+        add_redir(cmd, REDIR_DUP, 2)->src_fd = 1;
+    } else {
+        int dst = fd >= 0 ? fd : (*p == '<' ? 0 : 1);
+        Redir *redir = add_redir(cmd, REDIR_OPEN, dst);
+        redir->word = strdup(target->raw);
+        if (strcmp(p, "<") == 0) {
+            redir->flags = O_RDONLY;
+        } else if (strcmp(p, "<>") == 0) {
+            redir->flags = O_RDWR | O_CREAT;
+        } else if (strcmp(p, ">>") == 0) {
+            redir->flags = O_WRONLY | O_CREAT | O_APPEND;
         } else {
-            *write_ptr++ = *read_ptr++;
+            redir->flags = O_WRONLY | O_CREAT | O_TRUNC;
         }
     }
-    
-    *write_ptr = '\0';
-    return strdup(expanded_buffer);
+    return true;
+}
+
+// Sets up an empty argument vector using its inline storage.
+void argv_init(ArgVec *args) {
+    args->v = args->small;
+    args->count = 0;
+    args->cap = ARGV_INLINE;
+    args->v[0] = NULL;
+}
+
+/**
+ * @brief Appends an argument, moving the vector to the heap when the inline
+ * slots run out. Capacity doubles, so n pushes cost O(n) in total.
+ * @param args The vector.
+ * @param arg A malloc'd string, owned by the vector afterwards.
+ */
+void argv_push(ArgVec *args, char *arg) {
+    if (args->count + 1 >= args->cap) {
+        int cap = args->cap * 2;
+        char **v;
+        if (args->v == args->small) {
+            v = malloc(cap * sizeof(char *));
+            if (v) memcpy(v, args->small, args->count * sizeof(char *));
+        } else {
+            v = realloc(args->v, cap * sizeof(char *));
+        }
+        if (v == NULL) {
+            perror("ash: memory allocation failed");
+            exit(1);
+        }
+        args->v = v;
+        args->cap = cap;
+    }
+    args->v[args->count++] = arg;
+    args->v[args->count] = NULL;
+}
+
+// Frees all arguments and any heap storage, leaving an empty vector.
+void argv_clear(ArgVec *args) {
+    for (int i = 0; i < args->count; i++) {
+        free(args->v[i]);
+    }
+    if (args->v != args->small) {
+        free(args->v);
+    }
+    argv_init(args);
+}
+
+/**
+ * @brief Allocates an empty command.
+ * @return The new command; exits if out of memory.
+ */
+Command *new_command(void) {
+    Command *cmd = calloc(1, sizeof(Command));
+    if (cmd == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    argv_init(&cmd->words);
+    argv_init(&cmd->argv);
+    return cmd;
+}
+
+static bool is_operator_token(const Token *token, const char *op) {
+    return token != NULL && !token->quoted && strcmp(token->value, op) == 0;
+}
+
+// True after a token that ends a command, where a new command (or the '}'
+// closing a function body) may start.
+static bool at_command_start(const Token *prev) {
+    return prev == NULL || is_operator_token(prev, ";") || is_operator_token(prev, "&") ||
+           is_operator_token(prev, "&&") || is_operator_token(prev, "||") ||
+           is_operator_token(prev, "|") || is_operator_token(prev, "{") ||
+           (!prev->quoted && strlen(prev->raw) > 3 &&
+            strcmp(prev->raw + strlen(prev->raw) - 3, "(){") == 0);
 }
 
+// Checks a function name; returns its length, or 0 if it is not one.
+static size_t function_name_length(const char *word) {
+    if (!isalpha((unsigned char)*word) && *word != '_') return 0;
+    size_t len = 1;
+    while (isalnum((unsigned char)word[len]) || (word[len] && strchr("_-.", word[len]))) len++;
+    return (word[len] == '\0' || word[len] == '(') ? len : 0;
+}
 
 /**
- * @brief Parses a token list into a command structure, with variable expansion.
+ * @brief Recognizes the header of a function definition at token.
  *
- * This function iterates through tokens, expands any shell variables, and
- * populates the command's argv array. It correctly handles pipelines, background
- * processes, and command separators.
+ * Accepts `name() {`, `name(){`, `name () {` and `function name [()] {`.
  *
- * @param tokens The TokenList to parse.
- * @return A pointer to the parsed Command structure.
+ * @param token The first token of a command.
+ * @param name Receives a malloc'd copy of the function name, or NULL.
+ * @return The token that opens the body, or NULL if this is no header.
  */
-Command *parse_command(TokenList *tokens) {
-    if (tokens->head == NULL) {
+static Token *function_header(Token *token, char **name) {
+    Token *name_tok = token;
+    bool keyword = is_operator_token(token, "function") && token->next != NULL;
+    if (keyword) name_tok = token->next;
+    if (name_tok->quoted) return NULL;
+
+    size_t len = function_name_length(name_tok->raw);
+    if (len == 0) return NULL;
+    Token *next = name_tok->next;
+    if (strcmp(name_tok->raw + len, "(){") == 0) {
+        // `name(){` in one word: the name token opens the body itself
+        next = name_tok;
+    } else if (name_tok->raw[len] == '(') {
+        if (strcmp(name_tok->raw + len, "()") != 0) return NULL;
+        if (!is_operator_token(next, "{")) return NULL;
+    } else if (is_operator_token(next, "()")) {
+        next = next->next;
+        if (!is_operator_token(next, "{")) return NULL;
+    } else if (!keyword || !is_operator_token(next, "{")) {
         return NULL;
     }
 
-    Command *head_cmd = (Command *)malloc(sizeof(Command));
-    if (head_cmd == NULL) {
+    if (name) *name = strndup(name_tok->raw, len);
+    return next;
+}
+
+// Returns the '}' that closes the body opened at open, or NULL
+// if the tokens end first.
+static Token *function_body_end(Token *open) {
+    int depth = 1;
+    Token *prev = open;
+    for (Token *t = open->next; t != NULL; prev = t, t = t->next) {
+        if (at_command_start(prev) && function_header(t, NULL) != NULL) {
+            // A nested definition: skip ahead to its '{'
+            t = function_header(t, NULL);
+            depth++;
+        } else if (at_command_start(prev) && is_operator_token(t, "}") && --depth == 0) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Counts the function bodies that are still open at the end of the
+ * tokens, so callers know to read more lines before parsing.
+ */
+int open_function_bodies(const TokenList *tokens) {
+    int depth = 0;
+    Token *prev = NULL;
+    for (Token *t = tokens->head; t != NULL; prev = t, t = t->next) {
+        if (!at_command_start(prev)) continue;
+        Token *open = function_header(t, NULL);
+        if (open != NULL) {
+            t = open;
+            depth++;
+        } else if (depth > 0 && is_operator_token(t, "}")) {
+            depth--;
+        }
+    }
+    return depth;
+}
+
+void funcdef_release(FuncDef *def) {
+    if (def == NULL || --def->refs > 0) return;
+    free(def->name);
+    free_command(def->body);
+    free(def);
+}
+
+static Command *parse_tokens(Token *current_token, Token *end, bool *error);
+
+/**
+ * @brief Parses `name() { body; }` starting at *token_ptr into cmd.
+ *
+ * The body is parsed once, here; running the function later reuses it.
+ *
+ * @return 1 if a definition was consumed (*token_ptr is left on its '}'),
+ *         0 if the tokens are no function header, -1 on a syntax error.
+ */
+static int parse_function(Command *cmd, Token **token_ptr, Token *end) {
+    char *name = NULL;
+    Token *open = function_header(*token_ptr, &name);
+    if (open == NULL) return 0;
+
+    Token *close = function_body_end(open);
+    if (close == NULL) {
+        fprintf(stderr, "ash: syntax error: missing '}' in function %s\n", name);
+        free(name);
+        return -1;
+    }
+    Token *after = close->next;
+    if (after != end && !is_operator_token(after, ";") && !is_operator_token(after, "&") &&
+        !is_operator_token(after, "&&") && !is_operator_token(after, "||")) {
+        fprintf(stderr, "ash: syntax error near `%s' after function %s\n", after->value, name);
+        free(name);
+        return -1;
+    }
+
+    FuncDef *def = calloc(1, sizeof(FuncDef));
+    if (def == NULL || name == NULL) {
         perror("ash: memory allocation failed");
         exit(1);
     }
-    memset(head_cmd, 0, sizeof(Command));
+    def->name = name;
+    def->refs = 1;
+    bool error = false;
+    def->body = parse_tokens(open->next, close, &error);
+    if (error) {
+        funcdef_release(def);
+        return -1;
+    }
+    cmd->func = def;
+    *token_ptr = close;
+    return 1;
+}
+
+// Parses the tokens from current_token up to (not including) end.
+static Command *parse_tokens(Token *current_token, Token *end, bool *error) {
+    if (current_token == end) {
+        return NULL;
+    }
 
+    Command *head_cmd = new_command();
     Command *current_cmd = head_cmd;
-    Token *current_token = tokens->head;
-    int arg_index = 0;
+    Command *prev_cmd = NULL;
+    bool segment_start = true; // Not after a '|', so `time` may prefix it
 
-    while (current_token != NULL) {
-        if (strcmp(current_token->value, ";") == 0) {
+    while (current_token != end) {
+        bool bare = current_cmd->words.count == 0 && current_cmd->redirs == NULL &&
+                    current_cmd->func == NULL;
+        bool empty = bare && !current_cmd->timed;
+        // Quoted tokens such as '|' or ">" are plain words, never operators.
+        const char *op = current_token->quoted ? "" : current_token->value;
+        if (strcmp(op, ";") == 0 && empty) {
+            // Nothing to separate, as after '{' or a line joined with "; "
+        } else if (strcmp(op, ";") == 0) {
             current_cmd->type = CMD_SEMI;
-            current_cmd->next = (Command *)malloc(sizeof(Command));
-            if (current_cmd->next == NULL) {
-                perror("ash: memory allocation failed");
-                exit(1);
-            }
-            memset(current_cmd->next, 0, sizeof(Command));
+            current_cmd->next = new_command();
+            prev_cmd = current_cmd;
             current_cmd = current_cmd->next;
-            arg_index = 0;
-        } else if (strcmp(current_token->value, "|") == 0) {
+            segment_start = true;
+        } else if (strcmp(op, "|") == 0) {
             current_cmd->type = CMD_PIPE;
-            current_cmd->next = (Command *)malloc(sizeof(Command));
-            if (current_cmd->next == NULL) {
-                perror("ash: memory allocation failed");
-                exit(1);
-            }
-            memset(current_cmd->next, 0, sizeof(Command));
+            current_cmd->next = new_command();
+            prev_cmd = current_cmd;
             current_cmd = current_cmd->next;
-            arg_index = 0;
-        } else if (strcmp(current_token->value, "&") == 0) {
+            segment_start = false;
+        } else if (strcmp(op, "&") == 0) {
             current_cmd->type = CMD_BG;
-            current_cmd->next = (Command *)malloc(sizeof(Command));
-            if (current_cmd->next == NULL) {
-                perror("ash: memory allocation failed");
-                exit(1);
-            }
-            memset(current_cmd->next, 0, sizeof(Command));
+            current_cmd->next = new_command();
+            prev_cmd = current_cmd;
             current_cmd = current_cmd->next;
-            arg_index = 0;
-        } else if (strcmp(current_token->value, "&&") == 0) {
+            segment_start = true;
+        } else if (strcmp(op, "&&") == 0) {
             current_cmd->type = CMD_AND;
-            current_cmd->next = (Command *)malloc(sizeof(Command));
-            if (current_cmd->next == NULL) {
-                perror("ash: memory allocation failed");
-                exit(1);
-            }
-            memset(current_cmd->next, 0, sizeof(Command));
+            current_cmd->next = new_command();
+            prev_cmd = current_cmd;
             current_cmd = current_cmd->next;
-            arg_index = 0;
-        } else if (strcmp(current_token->value, "||") == 0) {
+            segment_start = true;
+        } else if (strcmp(op, "||") == 0) {
             current_cmd->type = CMD_OR;
-            current_cmd->next = (Command *)malloc(sizeof(Command));
-            if (current_cmd->next == NULL) {
-                perror("ash: memory allocation failed");
-                exit(1);
-            }
-            memset(current_cmd->next, 0, sizeof(Command));
+            current_cmd->next = new_command();
+            prev_cmd = current_cmd;
             current_cmd = current_cmd->next;
-            arg_index = 0;
-        } else if (strcmp(current_token->value, "<") == 0) {
-            if (current_token->next != NULL) {
-                current_cmd->redir_in = expand_variables(current_token->next->value);
-                current_token = current_token->next;
-            }
-        } else if (strcmp(current_token->value, ">") == 0) {
-            if (current_token->next != NULL) {
-                current_cmd->redir_out = expand_variables(current_token->next->value);
-                current_token = current_token->next;
-                current_cmd->redir_append = false; // Truncate
-            }
-        } else if (strcmp(current_token->value, ">>") == 0) {
-            if (current_token->next != NULL) {
-                current_cmd->redir_out = expand_variables(current_token->next->value);
-                current_token = current_token->next;
-                current_cmd->redir_append = true; // Append
+            segment_start = true;
+        } else if (parse_redirection(current_cmd, &current_token, error)) {
+            // The operator and its target word were consumed
+            if (*error) {
+                free_command(head_cmd);
+                return NULL;
             }
+        } else if (segment_start && current_cmd->words.count == 0 && !current_token->quoted &&
+                   strcmp(current_token->raw, "time") == 0) {
+            // A keyword rather than a word, so running the command never
+            // has to edit it and parsed lines can be cached and rerun
+            current_cmd->timed = true;
         } else {
-            if (arg_index < MAX_ARGS - 1) {
-                current_cmd->argv[arg_index++] = expand_variables(current_token->value);
+            // `time f() { ...; }` times the definition
+            int defined = (segment_start && bare) ? parse_function(current_cmd, &current_token, end) : 0;
+            if (defined < 0) {
+                *error = true;
+                free_command(head_cmd);
+                return NULL;
+            }
+            if (defined == 0) {
+                char *word = strdup(current_token->raw);
+                if (word == NULL) {
+                    perror("ash: memory allocation failed");
+                    exit(1);
+                }
+                argv_push(&current_cmd->words, word);
             }
         }
         current_token = current_token->next;
     }
     current_cmd->type = CMD_END;
+    if (prev_cmd != NULL && prev_cmd->type != CMD_PIPE && current_cmd->words.count == 0 &&
+        current_cmd->redirs == NULL && current_cmd->func == NULL && !current_cmd->timed) {
+        // Drop the empty command after a trailing ';' or '&', so the status
+        // of `false;` is that of false. '&' stays on the command it runs.
+        free_command(current_cmd);
+        prev_cmd->next = NULL;
+        if (prev_cmd->type == CMD_SEMI) prev_cmd->type = CMD_END;
+    }
+    return head_cmd;
+}
+
+/**
+ * @brief Parses a token list into a command structure.
+ *
+ * This function iterates through tokens and populates the command's words
+ * array; expand_command() turns them into argv when the command runs. It
+ * correctly handles pipelines, background processes, command separators and
+ * function definitions.
+ *
+ * @param tokens The TokenList to parse.
+ * @return A pointer to the parsed Command structure, or NULL if there is
+ *         nothing to run or after a syntax error.
+ */
+Command *parse_command(TokenList *tokens) {
+    if (tokens->head == NULL) {
+        return NULL;
+    }
+
+    TRACE_BEGIN("parse");
+    bool error = false;
+    Command *head_cmd = parse_tokens(tokens->head, NULL, &error);
+    TRACE_END("parse");
     return head_cmd;
 }
 
@@ -372,15 +747,143 @@ void free_command(Command *cmd) {
     while (current != NULL) {
         Command *temp = current;
         current = current->next;
-        for (int i = 0; temp->argv[i] != NULL; i++) {
-            free(temp->argv[i]);
+        argv_clear(&temp->words);
+        argv_clear(&temp->argv);
+        free_redirs(temp->redirs);
+        funcdef_release(temp->func);
+        free(temp);
+    }
+}
+
+// strdup() that passes NULL through and exits if out of memory.
+static char *copy_string(const char *s) {
+    char *copy = s ? strdup(s) : NULL;
+    if (s && copy == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    return copy;
+}
+
+/**
+ * @brief Copies the pipeline starting at head as parsed, to run it after
+ * the command list it belongs to is gone.
+ *
+ * Each stage keeps its words, redirections, separator and `time` prefix;
+ * what expand_command() fills in is left out.
+ * @return The copy; exits if out of memory.
+ */
+Command *copy_pipeline(const Command *head) {
+    Command *copy = NULL;
+    Command **tail = &copy;
+    for (const Command *c = head; c; c = (c->type == CMD_PIPE) ? c->next : NULL) {
+        Command *cmd = new_command();
+        for (int i = 0; i < c->words.count; i++) {
+            argv_push(&cmd->words, copy_string(c->words.v[i]));
+        }
+        for (const Redir *r = c->redirs; r; r = r->next) {
+            Redir *redir = add_redir(cmd, r->kind, r->fd);
+            redir->flags = r->flags;
+            redir->src_fd = r->src_fd;
+            redir->word = copy_string(r->word);
+            redir->delim = copy_string(r->delim);
+            redir->strip_tabs = r->strip_tabs;
+            redir->expand = r->expand;
+        }
+        cmd->type = c->type;
+        cmd->timed = c->timed;
+        *tail = cmd;
+        tail = &cmd->next;
+    }
+    return copy;
+}
+
+// Reads one here-document body up to its delimiter line.
+static int read_heredoc_body(Redir *redir, char *(*read_line)(void *ctx), void *ctx) {
+    size_t len = 0, cap = 256;
+    char *body = malloc(cap);
+    if (body == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    bool terminated = false;
+    char *line;
+    while ((line = read_line(ctx)) != NULL) {
+        char *text = line;
+        if (redir->strip_tabs) {
+            while (*text == '\t') text++;
         }
-        if (temp->redir_in != NULL) {
-            free(temp->redir_in);
+        if (strcmp(text, redir->delim) == 0) {
+            free(line);
+            terminated = true;
+            break;
         }
-        if (temp->redir_out != NULL) {
-            free(temp->redir_out);
+        size_t piece_len = strlen(text);
+        if (len + piece_len + 2 > cap) {
+            while (len + piece_len + 2 > cap) cap *= 2;
+            char *tmp = realloc(body, cap);
+            if (tmp == NULL) {
+                perror("ash: memory allocation failed");
+                exit(1);
+            }
+            body = tmp;
         }
-        free(temp);
+        memcpy(body + len, text, piece_len);
+        len += piece_len;
+        body[len++] = '\n';
+        free(line);
+    }
+    body[len] = '\0';
+    if (!terminated) {
+        fprintf(stderr, "ash: warning: here-document delimited by end-of-file (wanted `%s')\n", redir->delim);
     }
-}
\ No newline at end of file
+    free(redir->word);
+    redir->word = body;
+    free(redir->delim);
+    redir->delim = NULL;
+    return terminated ? 0 : -1;
+}
+
+/**
+ * @brief Reads the bodies of all pending '<<' here-documents in a command list.
+ *
+ * Lines are pulled from read_line() until one matches the delimiter (after
+ * stripping leading tabs for '<<-'). The text is kept as written; unless the
+ * delimiter was quoted, expand_command() expands it each time the command runs.
+ *
+ * @param cmd The head of the Command linked list.
+ * @param read_line Returns the next input line (malloc'd, without '\n') or NULL at EOF.
+ * @param ctx Passed through to read_line.
+ * @return 0 on success, -1 if input ended before a delimiter.
+ */
+int collect_heredocs(Command *cmd, char *(*read_line)(void *ctx), void *ctx) {
+    int result = 0;
+    for (; cmd != NULL; cmd = cmd->next) {
+        if (cmd->func != NULL && collect_heredocs(cmd->func->body, read_line, ctx) != 0) {
+            result = -1;
+        }
+        for (Redir *redir = cmd->redirs; redir != NULL; redir = redir->next) {
+            if (redir->kind == REDIR_HEREDOC && redir->delim != NULL &&
+                read_heredoc_body(redir, read_line, ctx) != 0) {
+                result = -1;
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Frees a list of redirections.
+ * @param redir The head of the Redir linked list.
+ */
+void free_redirs(Redir *redir) {
+    while (redir != NULL) {
+        Redir *next = redir->next;
+        free(redir->word);
+        free(redir->path);
+        free(redir->body);
+        free(redir->delim);
+        free(redir);
+        redir = next;
+    }
+}
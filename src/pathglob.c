@@ -0,0 +1,445 @@
+// pathglob.c - Pathname expansion for ash shell
+// Expands '*', '?', '[...]' and '**' (any number of directories) in words.
+// Every directory is read once per command with getdents64 into a cache of
+// sorted listings, so several patterns over the same directory share one
+// scan, and a literal last component is looked up with a binary search
+// instead of a stat. A backslash in a pattern makes the next character
+// literal; the expander uses that for quoted characters.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "../include/pathglob.h"
+#include "../include/trace.h"
+
+#define DIRCACHE_BUCKETS 64
+#define DIRENT_BUF_SIZE (256 * 1024)
+
+// Record layout returned by the getdents64 system call.
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// One directory entry; the name lives in the listing's name arena.
+typedef struct {
+    size_t name;          // Offset into CachedDir.names
+    unsigned char type;   // d_type, DT_UNKNOWN if the filesystem doesn't say
+} DirEntry;
+
+// The sorted listing of one directory.
+typedef struct CachedDir {
+    char *path;           // As used in the pattern: "", "src/", "/"
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+    DirEntry *entries;
+    size_t count;
+    size_t cap;
+    bool readable;
+    struct CachedDir *next;
+} CachedDir;
+
+struct DirCache {
+    CachedDir *buckets[DIRCACHE_BUCKETS];
+};
+
+// A growable list of paths.
+typedef struct {
+    char **items;
+    size_t count;
+    size_t cap;
+} PathList;
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    return p;
+}
+
+static void path_push(PathList *list, char *path) {
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 16;
+        list->items = xrealloc(list->items, list->cap * sizeof(char *));
+    }
+    list->items[list->count++] = path;
+}
+
+// Returns prefix + name + suffix as a new string.
+static char *path_join(const char *prefix, const char *name, const char *suffix) {
+    size_t a = strlen(prefix), b = strlen(name), c = strlen(suffix);
+    char *path = xrealloc(NULL, a + b + c + 1);
+    memcpy(path, prefix, a);
+    memcpy(path + a, name, b);
+    memcpy(path + a + b, suffix, c + 1);
+    return path;
+}
+
+DirCache *dircache_new(void) {
+    DirCache *cache = calloc(1, sizeof(DirCache));
+    if (!cache) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    return cache;
+}
+
+void dircache_free(DirCache *cache) {
+    if (!cache) return;
+    for (int i = 0; i < DIRCACHE_BUCKETS; i++) {
+        CachedDir *dir = cache->buckets[i];
+        while (dir) {
+            CachedDir *next = dir->next;
+            free(dir->path);
+            free(dir->names);
+            free(dir->entries);
+            free(dir);
+            dir = next;
+        }
+    }
+    free(cache);
+}
+
+static int compare_entries(const void *a, const void *b, void *names) {
+    return strcmp((const char *)names + ((const DirEntry *)a)->name,
+                  (const char *)names + ((const DirEntry *)b)->name);
+}
+
+// Reads a directory with large getdents64 calls and sorts the listing.
+static void read_listing(CachedDir *dir) {
+    int fd = open(*dir->path ? dir->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    TRACE_BEGIN_DETAIL("readdir", dir->path);
+    char *buf = xrealloc(NULL, DIRENT_BUF_SIZE);
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, DIRENT_BUF_SIZE)) > 0) {
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            size_t len = strlen(name) + 1;
+            if (dir->names_len + len > dir->names_cap) {
+                dir->names_cap = dir->names_cap ? dir->names_cap * 2 : 4096;
+                while (dir->names_len + len > dir->names_cap) dir->names_cap *= 2;
+                dir->names = xrealloc(dir->names, dir->names_cap);
+            }
+            if (dir->count == dir->cap) {
+                dir->cap = dir->cap ? dir->cap * 2 : 64;
+                dir->entries = xrealloc(dir->entries, dir->cap * sizeof(DirEntry));
+            }
+            memcpy(dir->names + dir->names_len, name, len);
+            dir->entries[dir->count].name = dir->names_len;
+            dir->entries[dir->count].type = d->d_type;
+            dir->count++;
+            dir->names_len += len;
+        }
+    }
+    free(buf);
+    close(fd);
+    dir->readable = true;
+    if (dir->count > 1) {
+        qsort_r(dir->entries, dir->count, sizeof(DirEntry), compare_entries, dir->names);
+    }
+    TRACE_END("readdir");
+}
+
+// Returns the listing of a directory, reading it on first use.
+static CachedDir *dircache_get(DirCache *cache, const char *path) {
+    unsigned int hash = 2166136261u;
+    for (const char *p = path; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    CachedDir **bucket = &cache->buckets[hash % DIRCACHE_BUCKETS];
+    for (CachedDir *dir = *bucket; dir; dir = dir->next) {
+        if (strcmp(dir->path, path) == 0) return dir;
+    }
+    CachedDir *dir = calloc(1, sizeof(CachedDir));
+    if (!dir) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    dir->path = strdup(path);
+    if (!dir->path) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    read_listing(dir);
+    dir->next = *bucket;
+    *bucket = dir;
+    return dir;
+}
+
+// Checks for an entry with a binary search of the sorted listing.
+static bool listing_contains(const CachedDir *dir, const char *name) {
+    size_t lo = 0, hi = dir->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(dir->names + dir->entries[mid].name, name);
+        if (cmp == 0) return true;
+        if (cmp < 0) lo = mid + 1; else hi = mid;
+    }
+    return false;
+}
+
+// True if the entry is a directory; symlinks count only when follow is set.
+static bool entry_is_dir(const CachedDir *dir, const DirEntry *e, bool follow) {
+    if (e->type == DT_DIR) return true;
+    if (e->type != DT_UNKNOWN && !(follow && e->type == DT_LNK)) return false;
+    char *path = path_join(dir->path, dir->names + e->name, "");
+    struct stat st;
+    int rc = follow ? stat(path, &st) : lstat(path, &st);
+    free(path);
+    return rc == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * @brief Checks whether a pattern has an unescaped '*', '?' or '[...]'.
+ *
+ * A '[' without a closing ']' is literal, so words such as `[` (test) never
+ * cause a directory scan.
+ */
+bool has_glob_chars(const char *pattern) {
+    for (const char *p = pattern; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        } else if (*p == '*' || *p == '?') {
+            return true;
+        } else if (*p == '[' && strchr(p + 1, ']')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Matches c against the bracket expression at *pp ('[' included) and moves
+// *pp past it. Returns -1 if the bracket is not closed (a literal '[').
+static int match_bracket(const char **pp, char c) {
+    const char *p = *pp + 1;
+    bool negate = (*p == '!' || *p == '^');
+    if (negate) p++;
+    bool matched = false;
+    bool first = true;
+    while (*p && (*p != ']' || first)) {
+        first = false;
+        char lo = *p;
+        if (lo == '\\' && p[1]) lo = *++p;
+        char hi = lo;
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+            p += 2;
+            hi = *p;
+            if (hi == '\\' && p[1]) hi = *++p;
+        }
+        if ((unsigned char)c >= (unsigned char)lo && (unsigned char)c <= (unsigned char)hi) {
+            matched = true;
+        }
+        p++;
+    }
+    if (*p != ']') return -1;
+    *pp = p + 1;
+    return matched != negate;
+}
+
+/**
+ * @brief Matches one file name against one pattern component.
+ *
+ * Runs in O(pattern * name) time at worst: a '*' only remembers the last
+ * place to backtrack to, so patterns like "*a*a*a*b" can't go exponential.
+ */
+static bool glob_match(const char *pat, const char *name) {
+    const char *star_pat = NULL, *star_name = NULL;
+    while (*name) {
+        if (*pat == '*') {
+            while (*pat == '*') pat++;
+            if (*pat == '\0') return true;
+            star_pat = pat;
+            star_name = name;
+            continue;
+        }
+        bool ok;
+        const char *p = pat;
+        if (*p == '?') {
+            ok = true;
+            p++;
+        } else if (*p == '[') {
+            int m = match_bracket(&p, *name);
+            if (m < 0) {
+                ok = (*name == '[');
+                p = pat + 1;
+            } else {
+                ok = m;
+            }
+        } else {
+            if (*p == '\\' && p[1]) p++;
+            ok = (*p != '\0' && *p == *name);
+            if (*p) p++;
+        }
+        if (ok) {
+            pat = p;
+            name++;
+        } else if (star_pat) {
+            pat = star_pat;
+            name = ++star_name;
+        } else {
+            return false;
+        }
+    }
+    while (*pat == '*') pat++;
+    return *pat == '\0';
+}
+
+// Removes the escaping backslashes of a literal pattern component.
+static char *unescape(const char *comp) {
+    char *out = xrealloc(NULL, strlen(comp) + 1);
+    char *w = out;
+    for (const char *p = comp; *p; p++) {
+        if (*p == '\\' && p[1]) p++;
+        *w++ = *p;
+    }
+    *w = '\0';
+    return out;
+}
+
+// Adds everything below prefix for '**'. In the middle of a pattern it
+// yields prefix and every directory below it; as the last component, every
+// file and directory below it. Symlinks are listed but not descended into.
+static void add_tree(DirCache *cache, const char *prefix, bool last, PathList *out) {
+    if (!last) path_push(out, strdup(prefix));
+    CachedDir *dir = dircache_get(cache, prefix);
+    for (size_t i = 0; i < dir->count; i++) {
+        const DirEntry *e = &dir->entries[i];
+        const char *name = dir->names + e->name;
+        if (name[0] == '.') continue;
+        bool is_dir = entry_is_dir(dir, e, false);
+        if (last) path_push(out, path_join(prefix, name, ""));
+        if (is_dir) {
+            char *sub = path_join(prefix, name, "/");
+            add_tree(cache, sub, last, out);
+            free(sub);
+        }
+    }
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Expands a pattern into the sorted list of matching paths.
+ *
+ * The pattern is matched one '/'-separated component at a time against the
+ * cached listings of the directories matched so far. Names starting with '.'
+ * only match a component that starts with '.' too.
+ *
+ * @param pattern The pattern, with '\' escaping literal characters.
+ * @param cache Listings shared by the patterns of one command.
+ * @param matches Receives a malloc'd array of malloc'd paths.
+ * @return The number of matches; 0 leaves *matches NULL.
+ */
+int pathglob(const char *pattern, DirCache *cache, char ***matches) {
+    TRACE_BEGIN_DETAIL("glob", pattern);
+    PathList cur = {0};
+    const char *p = pattern;
+    if (*p == '/') {
+        path_push(&cur, strdup("/"));
+        while (*p == '/') p++;
+    } else {
+        path_push(&cur, strdup(""));
+    }
+
+    while (*p && cur.count > 0) {
+        const char *slash = strchr(p, '/');
+        size_t len = slash ? (size_t)(slash - p) : strlen(p);
+        char *comp = strndup(p, len);
+        if (!comp) {
+            perror("ash: memory allocation failed");
+            exit(1);
+        }
+        bool last = (slash == NULL);
+        const char *suffix = last ? "" : "/";
+        PathList next = {0};
+
+        for (size_t i = 0; i < cur.count; i++) {
+            const char *prefix = cur.items[i];
+            if (strcmp(comp, "**") == 0) {
+                add_tree(cache, prefix, last, &next);
+            } else if (!has_glob_chars(comp)) {
+                char *literal = unescape(comp);
+                if (last) {
+                    // Only keep it if it exists
+                    CachedDir *dir = dircache_get(cache, prefix);
+                    bool exists;
+                    if (dir->readable) {
+                        exists = listing_contains(dir, literal);
+                    } else {
+                        struct stat st;
+                        char *path = path_join(prefix, literal, "");
+                        exists = lstat(path, &st) == 0;
+                        free(path);
+                    }
+                    if (exists) path_push(&next, path_join(prefix, literal, ""));
+                } else {
+                    path_push(&next, path_join(prefix, literal, "/"));
+                }
+                free(literal);
+            } else {
+                CachedDir *dir = dircache_get(cache, prefix);
+                bool want_dot = (comp[0] == '.' || (comp[0] == '\\' && comp[1] == '.'));
+                for (size_t j = 0; j < dir->count; j++) {
+                    const DirEntry *e = &dir->entries[j];
+                    const char *name = dir->names + e->name;
+                    if (name[0] == '.' && !want_dot) continue;
+                    if (!glob_match(comp, name)) continue;
+                    if (!last && !entry_is_dir(dir, e, true)) continue;
+                    path_push(&next, path_join(prefix, name, suffix));
+                }
+            }
+        }
+
+        free(comp);
+        for (size_t i = 0; i < cur.count; i++) free(cur.items[i]);
+        free(cur.items);
+        cur = next;
+        p = slash ? slash + 1 : p + len;
+        while (*p == '/') p++;
+    }
+
+    if (cur.count > 1) {
+        qsort(cur.items, cur.count, sizeof(char *), compare_paths);
+    }
+    // A '**' in the middle yields the prefix itself, which can be "" for
+    // a pattern like "**/"; drop such empty paths.
+    size_t kept = 0;
+    for (size_t i = 0; i < cur.count; i++) {
+        if (cur.items[i][0] == '\0') {
+            free(cur.items[i]);
+        } else {
+            cur.items[kept++] = cur.items[i];
+        }
+    }
+    TRACE_END("glob");
+    if (kept == 0) {
+        free(cur.items);
+        *matches = NULL;
+        return 0;
+    }
+    *matches = cur.items;
+    return (int)kept;
+}
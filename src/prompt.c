@@ -1,5 +1,5 @@
-// prompt.c - Prompt and syntax highlighting for ash shell
-// Handles prompt display and command syntax highlighting
+// prompt.c - Prompt for ash shell
+// Builds the prompt string; the line itself is colored by highlight.c
 
 #include "ash.h"
 
@@ -26,20 +26,3 @@ void print_prompt(const char *distro_icon, const char *display_dir, const char *
         "\033[1;38;5;32m$\033[0m ", // Green shell symbol
         distro_icon, getenv("USER"), display_dir, git_prompt);
 }
-
-// Syntax highlight recognized commands
-void syntax_highlight(const char *input) {
-    char cmd[64] = {0};
-    int i = 0;
-    while (input[i] && !isspace(input[i]) && i < 63) {
-        cmd[i] = input[i];
-        i++;
-    }
-    cmd[i] = 0;
-    for (size_t j = 0; commands[j]; ++j) {
-        if (strcmp(cmd, commands[j]) == 0) {
-            printf("\033[1;36m%s\033[0m%s\n", cmd, input + i);
-            break;
-        }
-    }
-}
\ No newline at end of file
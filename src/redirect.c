@@ -0,0 +1,158 @@
+// redirect.c - Redirection engine for ash shell
+// Applies a command's list of redirections (open, dup, close, heredoc) in
+// order, for any fd number. Children apply them right before exec; builtins
+// apply them in the shell and get the original descriptors restored
+// afterwards, and `exec` without a command applies them permanently.
+//
+// Here-documents and here-strings are handed to commands without touching
+// the filesystem or starting extra processes: bodies that fit into a pipe's
+// buffer are written into a pipe, larger ones into an anonymous memfd.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "../include/redirect.h"
+
+// Writes the whole buffer, retrying on short writes.
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns a readable fd positioned at the start of a heredoc body.
+ *
+ * A pipe is used when the body fits into its buffer, so the write cannot
+ * block and no reader process is needed. Larger bodies go into a memfd,
+ * which holds any size in memory and supports seeking back to the start.
+ *
+ * @param body The here-document or here-string contents.
+ * @param len Length of the body in bytes.
+ * @return A file descriptor to read the body from, or -1 on error.
+ */
+int heredoc_open(const char *body, size_t len) {
+    int pipe_fd[2];
+    if (pipe2(pipe_fd, O_CLOEXEC) == 0) {
+        int capacity = fcntl(pipe_fd[1], F_GETPIPE_SZ);
+        if (capacity > 0 && len <= (size_t)capacity) {
+            int rc = write_all(pipe_fd[1], body, len);
+            close(pipe_fd[1]);
+            if (rc == 0) return pipe_fd[0];
+            close(pipe_fd[0]);
+            perror("ash: heredoc");
+            return -1;
+        }
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+    }
+
+    int fd = memfd_create("ash-heredoc", MFD_CLOEXEC);
+    if (fd < 0) {
+        perror("ash: memfd_create");
+        return -1;
+    }
+    if (write_all(fd, body, len) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+        perror("ash: heredoc");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Remembers the current state of fd the first time a redirection touches it.
+static void save_fd(RedirSave *save, int fd) {
+    if (save == NULL || save->count >= REDIR_MAX_SAVED) return;
+    for (int i = 0; i < save->count; i++) {
+        if (save->fds[i].fd == fd) return;
+    }
+    save->fds[save->count].fd = fd;
+    save->fds[save->count].saved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    save->count++;
+}
+
+// Moves newfd onto target, leaving target inheritable by children.
+static int move_fd(int newfd, int target) {
+    if (newfd == target) {
+        return fcntl(target, F_SETFD, 0);
+    }
+    int rc = dup2(newfd, target);
+    close(newfd);
+    return rc < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Applies a list of redirections to the current process, in order.
+ *
+ * Files are opened close-on-exec and then moved onto their target fd, so the
+ * only descriptors a command inherits are the ones it asked for.
+ *
+ * @param redir The head of the Redir linked list.
+ * @param save If not NULL, receives the original descriptors so that
+ *             restore_redirections() can undo the changes.
+ * @return 0 on success, -1 after printing an error.
+ */
+int apply_redirections(Redir *redir, RedirSave *save) {
+    for (; redir != NULL; redir = redir->next) {
+        save_fd(save, redir->fd);
+        switch (redir->kind) {
+        case REDIR_OPEN: {
+            int fd = open(redir->path, redir->flags | O_CLOEXEC, 0666);
+            if (fd < 0 || move_fd(fd, redir->fd) < 0) {
+                fprintf(stderr, "ash: %s: %s\n", redir->path, strerror(errno));
+                return -1;
+            }
+            break;
+        }
+        case REDIR_DUP:
+            if (fcntl(redir->src_fd, F_GETFD) < 0) {
+                fprintf(stderr, "ash: %d: Bad file descriptor\n", redir->src_fd);
+                return -1;
+            }
+            if (redir->src_fd != redir->fd && dup2(redir->src_fd, redir->fd) < 0) {
+                fprintf(stderr, "ash: %d: %s\n", redir->fd, strerror(errno));
+                return -1;
+            }
+            break;
+        case REDIR_CLOSE:
+            close(redir->fd);
+            break;
+        case REDIR_HEREDOC:
+        case REDIR_HERESTRING: {
+            int fd = heredoc_open(redir->body ? redir->body : "", redir->body_len);
+            if (fd < 0 || move_fd(fd, redir->fd) < 0) {
+                return -1;
+            }
+            break;
+        }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Puts back the descriptors recorded by apply_redirections().
+ * @param save The saved state; emptied afterwards.
+ */
+void restore_redirections(RedirSave *save) {
+    for (int i = save->count - 1; i >= 0; i--) {
+        SavedFd *s = &save->fds[i];
+        if (s->saved >= 0) {
+            dup2(s->saved, s->fd);
+            close(s->saved);
+        } else {
+            close(s->fd);
+        }
+    }
+    save->count = 0;
+}
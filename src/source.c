@@ -0,0 +1,332 @@
+// source.c - Script files run inside the current shell
+// Implements `source`/`.`, the script mode of main() and `ash -c`. A script is read and
+// parsed once into a list of command lines; the parsed form is cached by path
+// and validated against the file's inode, size and mtime, so a helper file
+// that is sourced over and over (typically from a loop) is only parsed again
+// after it changes.
+//
+// Parsed commands keep only the words as written: expansion fills in their
+// arguments each time they run, which is what makes rerunning them safe.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include "../include/source.h"
+#include "../include/parser.h"
+#include "../include/executor.h"
+#include "../include/usage.h"
+#include "../include/trace.h"
+#include "../include/functions.h"
+#include "../include/jobs.h"
+
+#define SOURCE_CACHE_SIZE 32
+#define SOURCE_MAX_DEPTH 64
+
+// One non-empty line of a script and the commands parsed from it.
+typedef struct {
+    char *text;    // The line as written, used for job listings
+    Command *cmds;
+} ScriptLine;
+
+typedef struct {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    ScriptLine *lines;
+    int count;
+    int busy;                // Runs of this script in progress
+    bool cached;             // Still owned by the cache
+    unsigned long last_used;
+} ParsedScript;
+
+static ParsedScript *cache[SOURCE_CACHE_SIZE];
+static unsigned long use_clock = 0;
+static int depth = 0;
+
+// Reads the next script line for here-document bodies.
+static char *read_script_line(void *ctx) {
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t read = getline(&line, &len, (FILE *)ctx);
+    if (read == -1) {
+        free(line);
+        return NULL;
+    }
+    if (read > 0 && line[read - 1] == '\n') {
+        line[read - 1] = '\0';
+    }
+    return line;
+}
+
+static void free_script(ParsedScript *script) {
+    for (int i = 0; i < script->count; i++) {
+        free(script->lines[i].text);
+        free_command(script->lines[i].cmds);
+    }
+    free(script->lines);
+    free(script->path);
+    free(script);
+}
+
+// The cache holds a script until it changes on disk or is evicted; a script
+// that is still running when that happens is freed once its last run ends.
+static void release_script(ParsedScript *script) {
+    if (!script->cached && script->busy == 0) {
+        free_script(script);
+    }
+}
+
+static void drop_cached(int slot) {
+    ParsedScript *script = cache[slot];
+    cache[slot] = NULL;
+    script->cached = false;
+    release_script(script);
+}
+
+static bool same_file(const ParsedScript *script, const struct stat *st) {
+    return script->dev == st->st_dev && script->ino == st->st_ino &&
+           script->size == st->st_size &&
+           script->mtime.tv_sec == st->st_mtim.tv_sec &&
+           script->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Reads and parses every line of a script into script->lines. Blank lines
+// and lines that only hold a comment (including a #! line) are left out.
+static void parse_lines(ParsedScript *script, FILE *file) {
+    TRACE_BEGIN("source_parse");
+    int cap = 0;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t read;
+    while ((read = getline(&line, &len, file)) != -1) {
+        if (read > 0 && line[read - 1] == '\n') {
+            line[read - 1] = '\0';
+        }
+        const char *start = line;
+        while (isspace((unsigned char)*start)) start++;
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+
+        TokenList tokens = tokenize(line);
+        // A function body spanning several lines is joined into one
+        // logical line before it is parsed
+        while (open_function_bodies(&tokens) > 0) {
+            char *more = read_script_line(file);
+            if (more == NULL) break;
+            size_t text_len = strlen(line), more_len = strlen(more);
+            if (text_len + more_len + 3 > len) {
+                len = text_len + more_len + 3;
+                char *grown = realloc(line, len);
+                if (grown == NULL) {
+                    perror("ash: memory allocation failed");
+                    exit(1);
+                }
+                line = grown;
+            }
+            memcpy(line + text_len, "; ", 2);
+            memcpy(line + text_len + 2, more, more_len + 1);
+            free(more);
+            free_tokens(&tokens);
+            tokens = tokenize(line);
+        }
+        Command *cmds = parse_command(&tokens);
+        free_tokens(&tokens);
+        if (cmds == NULL) {
+            continue;
+        }
+        // Here-document bodies follow the line in the file
+        collect_heredocs(cmds, read_script_line, file);
+
+        if (script->count == cap) {
+            cap = cap ? cap * 2 : 16;
+            ScriptLine *lines = realloc(script->lines, (size_t)cap * sizeof(ScriptLine));
+            if (lines == NULL) {
+                perror("ash: memory allocation failed");
+                exit(1);
+            }
+            script->lines = lines;
+        }
+        script->lines[script->count].text = strdup(line);
+        script->lines[script->count].cmds = cmds;
+        script->count++;
+    }
+    TRACE_END("source_parse");
+    free(line);
+}
+
+static ParsedScript *parse_script(const char *path) {
+    FILE *file = fopen(path, "re");
+    if (file == NULL) {
+        fprintf(stderr, "ash: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    ParsedScript *script = calloc(1, sizeof(ParsedScript));
+    if (script == NULL || fstat(fileno(file), &st) != 0 || (script->path = strdup(path)) == NULL) {
+        perror("ash: source");
+        free(script);
+        fclose(file);
+        return NULL;
+    }
+    script->dev = st.st_dev;
+    script->ino = st.st_ino;
+    script->size = st.st_size;
+    script->mtime = st.st_mtim;
+    parse_lines(script, file);
+    fclose(file);
+    return script;
+}
+
+// Returns the parsed script for a path, from the cache when the file has not
+// changed since it was parsed.
+static ParsedScript *load_script(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "ash: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "ash: %s: Is a directory\n", path);
+        return NULL;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < SOURCE_CACHE_SIZE; i++) {
+        if (cache[i] && strcmp(cache[i]->path, path) == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0) {
+        ParsedScript *script = cache[slot];
+        if (!same_file(script, &st)) {
+            drop_cached(slot);
+        } else if (script->busy == 0) {
+            script->last_used = ++use_clock;
+            return script;
+        } else {
+            // A script sourcing itself: the running copy's commands are in
+            // use, so the nested run gets a private one
+            return parse_script(path);
+        }
+    }
+
+    ParsedScript *script = parse_script(path);
+    if (script == NULL) {
+        return NULL;
+    }
+
+    // Take a free slot, else evict the least recently used idle script
+    slot = -1;
+    for (int i = 0; i < SOURCE_CACHE_SIZE; i++) {
+        if (cache[i] == NULL) {
+            slot = i;
+            break;
+        }
+        if (cache[i]->busy == 0 && (slot < 0 || cache[i]->last_used < cache[slot]->last_used)) {
+            slot = i;
+        }
+    }
+    if (slot >= 0) {
+        if (cache[slot]) {
+            drop_cached(slot);
+        }
+        script->cached = true;
+        script->last_used = ++use_clock;
+        cache[slot] = script;
+    }
+    return script;
+}
+
+/**
+ * @brief Runs the lines of a parsed script.
+ * @param top_level True if the script is the whole shell session: usage is
+ *        tracked per line, and the last line replaces the shell (see
+ *        execute_commands_and_exit()) when no background job is left that the
+ *        shell would have to account for.
+ */
+static int run_script(ParsedScript *script, bool top_level) {
+    int status = 0;
+    depth++;
+    script->busy++;
+    scope_enter();
+    for (int i = 0; i < script->count && !function_returning(); i++) {
+        ScriptLine *line = &script->lines[i];
+        if (top_level && i == script->count - 1) {
+            // Finished jobs keep their status for `wait`, but nothing is
+            // left to wait for them on the last line
+            if (active_jobs() == 0) {
+                fflush(stdout);
+                execute_commands_and_exit(line->cmds, line->text);
+            }
+        }
+        if (top_level) usage_begin();
+        status = execute_commands(line->cmds, line->text);
+        if (top_level) usage_end(status);
+    }
+    status = scope_leave(status);
+    script->busy--;
+    depth--;
+    release_script(script);
+    return status;
+}
+
+int source_file(const char *path, bool top_level) {
+    if (depth >= SOURCE_MAX_DEPTH) {
+        fprintf(stderr, "ash: %s: scripts nested too deeply\n", path);
+        return 1;
+    }
+    ParsedScript *script = load_script(path);
+    if (script == NULL) {
+        return 1;
+    }
+    return run_script(script, top_level);
+}
+
+int source_string(const char *text) {
+    ParsedScript *script = calloc(1, sizeof(ParsedScript));
+    if (script == NULL) {
+        perror("ash: memory allocation failed");
+        return 1;
+    }
+    // fmemopen() refuses an empty buffer
+    FILE *file = *text ? fmemopen((void *)text, strlen(text), "r") : NULL;
+    if (file) {
+        parse_lines(script, file);
+        fclose(file);
+    }
+    return run_script(script, true);
+}
+
+int builtin_source(char **argv) {
+    if (argv[1] == NULL) {
+        fprintf(stderr, "%s: usage: %s <file> [args...]\n", argv[0], argv[0]);
+        return 2;
+    }
+    // Arguments after the file name become its positional parameters
+    int argc = 0;
+    while (argv[argc]) argc++;
+    if (argc > 2) push_positional(argc - 2, argv + 2);
+    int status = source_file(argv[1], false);
+    if (argc > 2) pop_positional();
+    return status;
+}
+
+void source_cache_free(void) {
+    for (int i = 0; i < SOURCE_CACHE_SIZE; i++) {
+        if (cache[i]) {
+            drop_cached(i);
+        }
+    }
+}
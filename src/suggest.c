@@ -0,0 +1,248 @@
+// suggest.c - History-based autosuggestions for ash shell
+// History entries are indexed in two radix tries: one keyed by the command
+// line, and one keyed by the directory it was run in followed by a NUL and
+// the line. Every node remembers the most recent entry below it, so the
+// suggestion for what has been typed is found by walking down the typed
+// prefix once, first under the current directory, then over all entries.
+// Adding a line walks its key once more and never rebuilds anything.
+//
+// Readline's history file only holds the lines, so the directory of each
+// line is appended to ~/.ashhistory_dirs as "dir<TAB>line".
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+
+#include "../include/ash.h"
+#include "../include/suggest.h"
+#include "../include/trace.h"
+
+typedef struct SuggestNode {
+    char *label;                 // Key bytes on the edge from the parent
+    int label_len;
+    struct SuggestNode *child;   // First child
+    struct SuggestNode *sibling; // Next child of the same parent
+    unsigned long best_seq;      // Most recent entry at or below this node
+    const char *best_line;
+    char *line;                  // The entry ending here, in the line trie
+} SuggestNode;
+
+static SuggestNode lines_root;
+static SuggestNode dirs_root;
+static unsigned long seq = 0;
+static bool ready = false;
+
+static char current_dir[ASH_MAX_PATH];
+static char dirs_path[ASH_MAX_PATH];
+static char *key = NULL;
+static size_t key_cap = 0;
+
+static SuggestNode *new_node(const char *label, int len) {
+    SuggestNode *node = calloc(1, sizeof(SuggestNode));
+    char *copy = malloc((size_t)len);
+    if (node == NULL || copy == NULL) {
+        perror("ash: memory allocation failed");
+        exit(1);
+    }
+    memcpy(copy, label, (size_t)len);
+    node->label = copy;
+    node->label_len = len;
+    return node;
+}
+
+// Returns the child of node whose label starts with c.
+static SuggestNode **child_link(SuggestNode *node, char c) {
+    SuggestNode **link = &node->child;
+    while (*link && (*link)->label[0] != c) link = &(*link)->sibling;
+    return link;
+}
+
+// Returns the node where a key ending partway along an edge, or at its
+// end, leads, or NULL if no key has this prefix.
+static SuggestNode *trie_walk(SuggestNode *node, const char *s, int len) {
+    while (len > 0) {
+        node = *child_link(node, s[0]);
+        if (node == NULL) return NULL;
+        int n = len < node->label_len ? len : node->label_len;
+        if (memcmp(node->label, s, (size_t)n) != 0) return NULL;
+        s += n;
+        len -= n;
+    }
+    return node;
+}
+
+// Adds key s as the entry `line` used at time `when`, splitting edges as
+// needed, and returns the node where it ends.
+static SuggestNode *trie_insert(SuggestNode *node, const char *s, int len, unsigned long when, const char *line) {
+    for (;;) {
+        if (when >= node->best_seq) {
+            node->best_seq = when;
+            node->best_line = line;
+        }
+        if (len == 0) return node;
+        SuggestNode **link = child_link(node, s[0]);
+        SuggestNode *next = *link;
+        if (next == NULL) {
+            next = new_node(s, len);
+            next->sibling = node->child;
+            node->child = next;
+            node = next;
+            s += len;
+            len = 0;
+            continue;
+        }
+        int m = 0;
+        while (m < len && m < next->label_len && next->label[m] == s[m]) m++;
+        if (m < next->label_len) {
+            // Split the edge where the keys part
+            SuggestNode *mid = new_node(next->label, m);
+            mid->best_seq = next->best_seq;
+            mid->best_line = next->best_line;
+            mid->sibling = next->sibling;
+            mid->child = next;
+            next->sibling = NULL;
+            next->label_len -= m;
+            memmove(next->label, next->label + m, (size_t)next->label_len);
+            *link = mid;
+            next = mid;
+        }
+        node = next;
+        s += m;
+        len -= m;
+    }
+}
+
+static void trie_free(SuggestNode *node) {
+    while (node) {
+        SuggestNode *sibling = node->sibling;
+        trie_free(node->child);
+        free(node->label);
+        free(node->line);
+        free(node);
+        node = sibling;
+    }
+}
+
+// Builds "dir\0line" in the shared key buffer and returns its length.
+static int dir_key(const char *dir, const char *line, int len) {
+    size_t dir_len = strlen(dir);
+    size_t need = dir_len + 1 + (size_t)len;
+    if (need > key_cap) {
+        size_t cap = key_cap ? key_cap : 256;
+        while (cap < need) cap *= 2;
+        char *grown = realloc(key, cap);
+        if (grown == NULL) return -1;
+        key = grown;
+        key_cap = cap;
+    }
+    memcpy(key, dir, dir_len);
+    key[dir_len] = '\0';
+    memcpy(key + dir_len + 1, line, (size_t)len);
+    return (int)need;
+}
+
+// Indexes line as the most recent entry, and as the most recent in dir if
+// dir is given. Returns the indexed copy of the line.
+static const char *index_line(const char *line, const char *dir) {
+    int len = (int)strlen(line);
+    if (len == 0) return NULL;
+    SuggestNode *node = trie_walk(&lines_root, line, len);
+    const char *text = (node && node->line && strcmp(node->line, line) == 0) ? node->line : NULL;
+    char *copy = NULL;
+    if (text == NULL) {
+        copy = strdup(line);
+        if (copy == NULL) return NULL;
+        text = copy;
+    }
+    node = trie_insert(&lines_root, line, len, ++seq, text);
+    if (copy) node->line = copy;
+    if (dir) {
+        int n = dir_key(dir, line, len);
+        if (n > 0) trie_insert(&dirs_root, key, n, seq, text);
+    }
+    return text;
+}
+
+static int accept_suggestion(int count, int c) {
+    if (rl_point == rl_end && rl_end > 0) {
+        const char *line = suggest_lookup(rl_line_buffer, rl_end);
+        if (line) {
+            rl_insert_text(line + rl_end);
+            return 0;
+        }
+    }
+    return rl_forward_char(count, c);
+}
+
+void suggest_init(const char *homedir) {
+    TRACE_BEGIN("suggest_index");
+    snprintf(dirs_path, sizeof(dirs_path), "%s/.ashhistory_dirs", homedir ? homedir : ".");
+    HIST_ENTRY **hist = history_list();
+    for (int i = 0; hist && hist[i]; i++) {
+        index_line(hist[i]->line, NULL);
+    }
+    // Directory entries are only ever compared with each other, so they can
+    // be numbered after the plain history
+    FILE *f = fopen(dirs_path, "re");
+    if (f) {
+        char *buf = NULL;
+        size_t cap = 0;
+        ssize_t n;
+        while ((n = getline(&buf, &cap, f)) > 0) {
+            if (buf[n - 1] == '\n') buf[n - 1] = '\0';
+            char *tab = strchr(buf, '\t');
+            if (tab == NULL) continue;
+            *tab = '\0';
+            SuggestNode *node = trie_walk(&lines_root, tab + 1, (int)strlen(tab + 1));
+            // Only lines still in the history
+            if (node == NULL || node->line == NULL || strcmp(node->line, tab + 1) != 0) continue;
+            int len = dir_key(buf, node->line, (int)strlen(node->line));
+            if (len > 0) trie_insert(&dirs_root, key, len, ++seq, node->line);
+        }
+        free(buf);
+        fclose(f);
+    }
+    rl_bind_keyseq("\\e[C", accept_suggestion);
+    rl_bind_keyseq("\\eOC", accept_suggestion);
+    ready = true;
+    TRACE_END("suggest_index");
+}
+
+void suggest_free(void) {
+    trie_free(lines_root.child);
+    trie_free(dirs_root.child);
+    memset(&lines_root, 0, sizeof(lines_root));
+    memset(&dirs_root, 0, sizeof(dirs_root));
+    free(key);
+    key = NULL;
+    key_cap = 0;
+    ready = false;
+}
+
+void suggest_set_dir(const char *cwd) {
+    snprintf(current_dir, sizeof(current_dir), "%s", cwd);
+}
+
+void suggest_add(const char *line) {
+    if (!ready || index_line(line, current_dir) == NULL) return;
+    if (strchr(line, '\n')) return; // Would not fit on one line of the log
+    FILE *f = fopen(dirs_path, "ae");
+    if (!f) return;
+    fprintf(f, "%s\t%s\n", current_dir, line);
+    fclose(f);
+}
+
+const char *suggest_lookup(const char *prefix, int len) {
+    if (!ready || len <= 0) return NULL;
+    int n = dir_key(current_dir, prefix, len);
+    SuggestNode *node = n > 0 ? trie_walk(&dirs_root, key, n) : NULL;
+    if (node && node->best_line && (int)strlen(node->best_line) > len) return node->best_line;
+    node = trie_walk(&lines_root, prefix, len);
+    if (node && node->best_line && (int)strlen(node->best_line) > len) return node->best_line;
+    return NULL;
+}
@@ -0,0 +1,128 @@
+// trace.c - Execution tracing for ash shell
+// When ASH_TRACE=file is set, spans for tokenizing, parsing, expansion,
+// fork/exec/wait, builtins, prompt rendering, git and history I/O are
+// written to that file in Chrome trace-event JSON (the array format), which
+// loads in Perfetto and chrome://tracing. Events are buffered per process and
+// appended with O_APPEND writes, so forked children can trace into the same
+// file; the buffer is flushed when full, before exec and at exit.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "../include/trace.h"
+
+#define TRACE_BUFFER_SIZE 65536
+#define TRACE_EVENT_MAX 512
+
+bool trace_enabled = false;
+
+static int trace_fd = -1;
+static char trace_buffer[TRACE_BUFFER_SIZE];
+static size_t trace_len = 0;
+static int trace_pid = 0;
+
+static double trace_now_us(void) {
+    struct timespec ts;
+    // CLOCK_MONOTONIC is shared by all processes, so parent and child
+    // timestamps line up on one timeline.
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void trace_flush(void) {
+    size_t off = 0;
+    while (off < trace_len) {
+        ssize_t n = write(trace_fd, trace_buffer + off, trace_len - off);
+        if (n <= 0) break;
+        off += (size_t)n;
+    }
+    trace_len = 0;
+}
+
+// Copies src into dst as the body of a JSON string.
+static size_t trace_escape(char *dst, size_t cap, const char *src) {
+    size_t n = 0;
+    for (; *src && n + 7 < cap; src++) {
+        unsigned char c = (unsigned char)*src;
+        if (c == '"' || c == '\\') {
+            dst[n++] = '\\';
+            dst[n++] = (char)c;
+        } else if (c < 0x20) {
+            n += snprintf(dst + n, cap - n, "\\u%04x", c);
+        } else {
+            dst[n++] = (char)c;
+        }
+    }
+    dst[n] = '\0';
+    return n;
+}
+
+static void trace_event(const char *name, char phase, const char *detail) {
+    char event[TRACE_EVENT_MAX];
+    char escaped[TRACE_EVENT_MAX / 2];
+    int len;
+    if (detail) {
+        trace_escape(escaped, sizeof(escaped), detail);
+        len = snprintf(event, sizeof(event),
+                       "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d%s,"
+                       "\"args\":{\"detail\":\"%s\"}},\n",
+                       name, phase, trace_now_us(), trace_pid, trace_pid,
+                       phase == 'i' ? ",\"s\":\"t\"" : "", escaped);
+    } else {
+        len = snprintf(event, sizeof(event),
+                       "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d%s},\n",
+                       name, phase, trace_now_us(), trace_pid, trace_pid,
+                       phase == 'i' ? ",\"s\":\"t\"" : "");
+    }
+    if (len < 0) return;
+    if ((size_t)len >= sizeof(event)) len = sizeof(event) - 1;
+    if (trace_len + (size_t)len > sizeof(trace_buffer)) trace_flush();
+    memcpy(trace_buffer + trace_len, event, (size_t)len);
+    trace_len += (size_t)len;
+}
+
+void trace_begin(const char *name, const char *detail) {
+    trace_event(name, 'B', detail);
+}
+
+void trace_end(const char *name) {
+    trace_event(name, 'E', NULL);
+}
+
+void trace_instant(const char *name, const char *detail) {
+    trace_event(name, 'i', detail);
+}
+
+// Called in a freshly forked child: the inherited buffer belongs to the
+// parent, which will flush it itself.
+void trace_after_fork(void) {
+    trace_len = 0;
+    trace_pid = getpid();
+}
+
+// Opens the file named by ASH_TRACE and enables tracing.
+void trace_init(void) {
+    const char *path = getenv("ASH_TRACE");
+    if (!path || !*path) return;
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (trace_fd < 0) {
+        perror("ash: ASH_TRACE");
+        return;
+    }
+    // The array format allows the closing bracket to be omitted, which lets
+    // every process append events without coordinating who writes it.
+    if (write(trace_fd, "[\n", 2) != 2) {
+        close(trace_fd);
+        trace_fd = -1;
+        return;
+    }
+    trace_pid = getpid();
+    trace_enabled = true;
+    atexit(trace_flush);
+}
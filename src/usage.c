@@ -0,0 +1,87 @@
+// usage.c - Per-command resource accounting for ash shell
+// Foreground children are reaped with wait4() so their CPU time, memory,
+// faults and context switches can be summed per pipeline and per command
+// line. `status` and `time` print the results; with log_usage=true in
+// ~/.config/ash.conf every interactive command is appended to
+// ~/.ashhistory_usage together with its usage.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/ash.h"
+#include "../include/usage.h"
+
+CommandUsage segment_usage;
+CommandUsage line_usage;
+CommandUsage last_usage;
+
+static struct timespec line_start;
+
+static double timeval_seconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+void usage_reset(CommandUsage *usage) {
+    memset(usage, 0, sizeof(*usage));
+}
+
+// Adds the rusage of one reaped process (or an in-process builtin delta).
+void usage_add_rusage(CommandUsage *usage, const struct rusage *ru) {
+    usage->user += timeval_seconds(&ru->ru_utime);
+    usage->sys += timeval_seconds(&ru->ru_stime);
+    if (ru->ru_maxrss > usage->max_rss_kb) usage->max_rss_kb = ru->ru_maxrss;
+    usage->minor_faults += ru->ru_minflt;
+    usage->major_faults += ru->ru_majflt;
+    usage->voluntary_switches += ru->ru_nvcsw;
+    usage->involuntary_switches += ru->ru_nivcsw;
+}
+
+void usage_add(CommandUsage *usage, const CommandUsage *other) {
+    usage->wall += other->wall;
+    usage->user += other->user;
+    usage->sys += other->sys;
+    if (other->max_rss_kb > usage->max_rss_kb) usage->max_rss_kb = other->max_rss_kb;
+    usage->minor_faults += other->minor_faults;
+    usage->major_faults += other->major_faults;
+    usage->voluntary_switches += other->voluntary_switches;
+    usage->involuntary_switches += other->involuntary_switches;
+}
+
+// Starts accounting for a new command line.
+void usage_begin(void) {
+    usage_reset(&line_usage);
+    clock_gettime(CLOCK_MONOTONIC, &line_start);
+}
+
+// Finishes the current command line and makes it visible to `status`.
+void usage_end(int status) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    line_usage.wall = (now.tv_sec - line_start.tv_sec) + (now.tv_nsec - line_start.tv_nsec) / 1e9;
+    line_usage.status = status;
+    last_usage = line_usage;
+}
+
+void usage_print(FILE *out, const CommandUsage *usage) {
+    fprintf(out, "real %.3fs  user %.3fs  sys %.3fs  maxrss %ldKB  "
+                 "faults %ld major/%ld minor  ctxsw %ld vol/%ld invol\n",
+            usage->wall, usage->user, usage->sys, usage->max_rss_kb,
+            usage->major_faults, usage->minor_faults,
+            usage->voluntary_switches, usage->involuntary_switches);
+}
+
+// Appends the previous command line and its usage to ~/.ashhistory_usage.
+void usage_log(const char *homedir, const char *command_line) {
+    char path[ASH_MAX_PATH];
+    snprintf(path, sizeof(path), "%s/.ashhistory_usage", homedir ? homedir : ".");
+    FILE *f = fopen(path, "ae");
+    if (!f) return;
+    fprintf(f, "%ld\t%d\t%.3f\t%.3f\t%.3f\t%ld\t%ld\t%ld\t%s\n",
+            (long)time(NULL), last_usage.status, last_usage.wall, last_usage.user,
+            last_usage.sys, last_usage.max_rss_kb, last_usage.major_faults,
+            last_usage.minor_faults, command_line);
+    fclose(f);
+}
@@ -9,6 +9,10 @@ static char names[MAX_VARS][VAR_NAME_LEN];
 static char values[MAX_VARS][VAR_VALUE_LEN];
 static int var_count = 0;
 
+// Global variable definition for the shell name ($0).
+char *shell_name;
+bool shell_interactive = false;
+
 void set_variable(const char *name, const char *value) {
     for (int i = 0; i < var_count; ++i) {
         if (strcmp(names[i], name) == 0) {
@@ -35,6 +39,20 @@ const char *get_variable(const char *name) {
     return getenv(name); // Fallback to environment variables
 }
 
+void unset_variable(const char *name) {
+    for (int i = 0; i < var_count; ++i) {
+        if (strcmp(names[i], name) == 0) {
+            // Move the last variable into the freed slot
+            var_count--;
+            if (i != var_count) {
+                memcpy(names[i], names[var_count], VAR_NAME_LEN);
+                memcpy(values[i], values[var_count], VAR_VALUE_LEN);
+            }
+            return;
+        }
+    }
+}
+
 void free_variables(void) {
     // No dynamic allocation in this simple example
     var_count = 0;